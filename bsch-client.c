@@ -0,0 +1,143 @@
+/**
+ * Copyright 2010 Brian Taylor
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* the other end of bsch --server. it hands the server its stdin,
+ * stdout and stderr along with its directory, arguments and
+ * environment, then exits however the job it started did. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "server.h"
+
+extern char **environ;
+
+static void die(char *what) {
+  fprintf(stderr, "bsch-client: %s: %s\n", what, strerror(errno));
+  exit(255);
+}
+
+/* Append the NUL terminated strings of vec to buf. */
+static size_t pack(char *buf, size_t at, char **vec, uint32_t n) {
+  uint32_t i;
+  for (i = 0; i < n; i++) {
+    size_t len = strlen(vec[i]) + 1;
+    if (buf)
+      memcpy(buf + at, vec[i], len);
+    at += len;
+  }
+  return at;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s socket [script [arguments]]\n", argv[0]);
+    exit(255);
+  }
+
+  struct sockaddr_un addr;
+  if (strlen(argv[1]) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "bsch-client: socket path too long: %s\n", argv[1]);
+    exit(255);
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, argv[1]);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+    die(argv[1]);
+
+  /* the job's *args* are what bsch itself would have been given */
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd)) == NULL)
+    die("getcwd");
+  char *cwdv[] = { cwd };
+  char **args = argv + 2;
+  uint32_t nargs = argc - 2, nenv = 0;
+  while (environ[nenv] != NULL)
+    nenv++;
+
+  job_header h;
+  h.argc = nargs;
+  h.envc = nenv;
+  h.size = pack(NULL, 0, cwdv, 1);
+  h.size = pack(NULL, h.size, args, nargs);
+  h.size = pack(NULL, h.size, environ, nenv);
+  if (h.size > JOB_MAX_SIZE) {
+    fprintf(stderr, "bsch-client: arguments too long\n");
+    exit(255);
+  }
+  char *strings = malloc(h.size);
+  size_t at = pack(strings, 0, cwdv, 1);
+  at = pack(strings, at, args, nargs);
+  pack(strings, at, environ, nenv);
+
+  int fds[3] = { 0, 1, 2 };
+  char control[CMSG_SPACE(sizeof(fds))];
+  struct iovec iov = { &h, sizeof(h) };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(h))
+    die("sendmsg");
+
+  char *p = strings;
+  size_t left = h.size;
+  while (left > 0) {
+    ssize_t n = send(fd, p, left, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      die("send");
+    p += n;
+    left -= n;
+  }
+
+  int status;
+  p = (char *) &status;
+  left = sizeof(status);
+  while (left > 0) {
+    ssize_t n = read(fd, p, left);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      fprintf(stderr, "bsch-client: the server hung up\n");
+      exit(255);
+    }
+    p += n;
+    left -= n;
+  }
+
+  if (WIFSIGNALED(status))
+    exit(128 + WTERMSIG(status));
+  exit(WEXITSTATUS(status));
+}
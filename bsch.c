@@ -24,6 +24,7 @@
 #include "gc.h"
 #include "ffi.h"
 #include "vm.h"
+#include "server.h"
 
 char *version = "Mercury";
 
@@ -33,11 +34,18 @@ char **bs_paths;
 int bootstrap = 1;
 int print_help = 0;
 char *image = NULL;
+char *server = NULL;
+char **server_requires;
+int server_touch = 0;
 
 void print_usage(int ret) {
   printf ("Usage: %s [options] [script [arguments]]\n", progname);
   printf ("\t-b           Do not bootstrap\n");
   printf ("\t-l           Load an image\n");
+  printf ("\t-s sock      Run the scripts bsch-client sends to sock\n");
+  printf ("\t-r module    Require module before serving, may be repeated\n");
+  printf ("\t-t           Fault in the whole image before serving\n");
+  printf ("\t--startup-trace  Time each phase of starting up on stderr\n");
   printf ("\t-v           Print version information\n");
   printf ("\t-h           Print this usage text\n");
   exit(ret);
@@ -162,6 +170,29 @@ object * compile_library(char *libname) {
   return result;
 }
 
+/* Warm the booted image up and hand it to the fork server, returning
+ * in each job's child with the arguments for that job. */
+char **serve() {
+  char **module;
+  for (module = server_requires; *module != NULL; module++) {
+    object *require = get_hashtab(g->vm_env, make_symbol("require"), NULL);
+    if (require == NULL) {
+      fprintf(stderr, "require is not defined\n");
+      exit(4);
+    }
+    object *args = g->empty_list;
+    push_root(&args);
+    args = cons(make_symbol(*module), args);
+    apply(cdr(require), args);
+    pop_root(&args);
+  }
+  if (server_touch) {
+    pool_touch(g->global_pool);
+    startup_trace("touch");
+  }
+  return fork_server(server);
+}
+
 /* SFX stuff. */
 #include <inttypes.h>
 
@@ -199,8 +230,17 @@ int main(int argc, char ** argv) {
   bs_paths = split_path(path);
 
   /* Handle command line arguments. */
-  int c;
-  while ((c = getopt(argc, argv, "+bhvl:")) != -1)
+  static struct option long_options[] = {
+    {"server", required_argument, NULL, 's'},
+    {"require", required_argument, NULL, 'r'},
+    {"touch", no_argument, NULL, 't'},
+    {"startup-trace", no_argument, NULL, 'T'},
+    {NULL, 0, NULL, 0}
+  };
+  int c, nrequires = 0;
+  server_requires = xmalloc(argc * sizeof(char *));
+  while ((c = getopt_long(argc, argv, "+bhvl:s:r:t", long_options, NULL))
+	 != -1)
     switch (c)
       {
       case 'b':
@@ -209,6 +249,18 @@ int main(int argc, char ** argv) {
       case 'l':
 	image = optarg;
 	break;
+      case 's':
+	server = optarg;
+	break;
+      case 'r':
+	server_requires[nrequires++] = optarg;
+	break;
+      case 't':
+	server_touch = 1;
+	break;
+      case 'T':
+	startup_tracing = 1;
+	break;
       case 'v':
 	print_version ();
 	break;
@@ -221,6 +273,8 @@ int main(int argc, char ** argv) {
       }
   if (print_help)
     print_usage (EXIT_SUCCESS);
+  server_requires[nrequires] = NULL;
+  startup_trace("main");
 
   off_t img_off = 0;
 #ifdef SFX
@@ -231,7 +285,15 @@ int main(int argc, char ** argv) {
   }
 #endif
 
+  if (server && image == NULL) {
+    fprintf(stderr, "%s: --server needs an image to serve\n", progname);
+    exit(EXIT_FAILURE);
+  }
+
   if (image) {
+    /* Handle BS_RELOCATE, which moves the image as it loads */
+    if (getenv("BS_RELOCATE"))
+      pool_relocate = 1;
     int r = load_image(image, img_off);
     if (r != 0) {
       exit(EXIT_FAILURE);
@@ -242,9 +304,11 @@ int main(int argc, char ** argv) {
     interp_add_roots();
     vm_add_roots();
     ffi_add_roots();
+    startup_trace("add-roots");
 
     /* the vm needs to build some tables */
     vm_boot();
+    startup_trace("vm-boot");
 
     /* need to patch up some things that move between boots */
     patch_object(g->stdin_symbol, make_input_port(stdin, 0));
@@ -253,7 +317,11 @@ int main(int argc, char ** argv) {
 
     /* Stick arguments and BS_PATH in global environment. */
     insert_strlist(bs_paths, "*load-path*", 0);
-    insert_strlist(argv + optind, "*args*", 0);
+    startup_trace("patch-objects");
+    if (server)
+      insert_strlist(serve(), "*args*", 0);
+    else
+      insert_strlist(argv + optind, "*args*", 0);
 
     /* Fire up a REPL, or whatever the user had in mind. */
     apply(cdr(get_hashtab(g->vm_env, make_symbol("*image-start*"), NULL)),
@@ -262,6 +330,7 @@ int main(int argc, char ** argv) {
   }
 
   init();
+  startup_trace("init");
 
   /* Stick arguments and BS_PATH in global environment. */
   insert_strlist(bs_paths, "*load-path*", 1);
@@ -279,6 +348,7 @@ int main(int argc, char ** argv) {
 
   /* fist we want to bootstrap the compiled environment */
   object * result = load_library("boot.sch");
+  startup_trace("boot.sch");
 
   /* if everything went well we should get back a special symbol */
   if(result != make_symbol("finished-compile")) {
@@ -289,6 +359,7 @@ int main(int argc, char ** argv) {
 
   /* now we tear down the interpreter so we can reclaim that memory */
   destroy_interp();
+  startup_trace("destroy-interp");
 
   /* now we load standard lib (which will provide the normal repl for
      the user */
@@ -0,0 +1,703 @@
+/**
+ * Copyright 2010 Brian Taylor
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* bytevectors hold raw binary data in a single block of storage so
+ * it can be handed straight to read(), write() and foreign code. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "gc.h"
+#include "interp.h"
+#include "bytevector.h"
+
+static object *check_range(char *who, object * bv, long start, long end) {
+  if(start < 0 || end > BVLEN(bv) || start > end) {
+    return throw_message("%s: range %ld to %ld is invalid for bytevector "
+			 "of length %ld", who, start, end, BVLEN(bv));
+  }
+  return g->true;
+}
+
+/* optional [start [end]] arguments beginning at argument FROM */
+static object *optional_range(char *who, object * bv, object * args,
+			      long n_args, long stack_top, long from,
+			      long *start, long *end) {
+  *start = 0;
+  *end = BVLEN(bv);
+  if(n_args > from) {
+    if(!is_fixnum(NTH_ARG(from))) {
+      return throw_message("%s expects a fixnum start", who);
+    }
+    *start = LONG(NTH_ARG(from));
+  }
+  if(n_args > from + 1) {
+    if(!is_fixnum(NTH_ARG(from + 1))) {
+      return throw_message("%s expects a fixnum end", who);
+    }
+    *end = LONG(NTH_ARG(from + 1));
+  }
+  return check_range(who, bv, *start, *end);
+}
+
+static int host_big_endian() {
+  const unsigned short one = 1;
+  return *(const unsigned char *)&one == 0;
+}
+
+/* endianness is given as the symbol big or little, and defaults to
+ * the byte order of the host */
+static int parse_endianness(object * args, long n_args, long stack_top,
+			    long at, int *big) {
+  if(n_args <= at) {
+    *big = host_big_endian();
+    return 1;
+  }
+
+  object *sym = NTH_ARG(at);
+  if(is_symbol(sym) && !is_lazy_symbol(sym)) {
+    if(strcmp(SYMBOL(sym), "big") == 0) {
+      *big = 1;
+      return 1;
+    }
+    if(strcmp(SYMBOL(sym), "little") == 0) {
+      *big = 0;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static unsigned long load_bytes(unsigned char *bytes, int size, int big) {
+  unsigned long value = 0;
+  int ii;
+  for(ii = 0; ii < size; ++ii) {
+    unsigned long byte = big ? bytes[size - 1 - ii] : bytes[ii];
+    value |= byte << (8 * ii);
+  }
+  return value;
+}
+
+static void store_bytes(unsigned char *bytes, int size, int big,
+			unsigned long value) {
+  int ii;
+  for(ii = 0; ii < size; ++ii) {
+    bytes[big ? size - 1 - ii : ii] = (value >> (8 * ii)) & 0xff;
+  }
+}
+
+/* validates (bv k ...) where SIZE bytes are accessed at k */
+static object *check_access(char *who, object * args, long n_args,
+			    long stack_top, int size) {
+  if(!is_bytevector(FIRST) || !is_fixnum(SECOND)) {
+    return throw_message("%s expects bytevector and index", who);
+  }
+  long idx = LONG(SECOND);
+  if(idx < 0 || idx + size > BVLEN(FIRST)) {
+    return throw_message("%s: index %ld out of range", who, idx);
+  }
+  return g->true;
+}
+
+static object *int_ref(char *who, object * args, long n_args,
+		       long stack_top, int size, int is_signed) {
+  int big;
+  object *check = check_access(who, args, n_args, stack_top, size);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+  if(!parse_endianness(args, n_args, stack_top, 2, &big)) {
+    return throw_message("%s: endianness must be big or little", who);
+  }
+
+  unsigned long value = load_bytes(BYTES(FIRST) + LONG(SECOND), size, big);
+  if(is_signed && size < 8) {
+    int shift = 64 - 8 * size;
+    return make_fixnum((long)(value << shift) >> shift);
+  }
+  return make_fixnum((long)value);
+}
+
+static object *int_set(char *who, object * args, long n_args,
+		       long stack_top, int size, int is_signed) {
+  int big;
+  object *check = check_access(who, args, n_args, stack_top, size);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+  if(!is_fixnum(THIRD)) {
+    return throw_message("%s expects an integer value", who);
+  }
+  if(!parse_endianness(args, n_args, stack_top, 3, &big)) {
+    return throw_message("%s: endianness must be big or little", who);
+  }
+
+  long value = LONG(THIRD);
+  if(size < 8) {
+    long bits = 8 * size;
+    long low = is_signed ? -(1L << (bits - 1)) : 0;
+    long high = is_signed ? (1L << (bits - 1)) - 1 : (1L << bits) - 1;
+    if(value < low || value > high) {
+      return throw_message("%s: %ld does not fit in %d bytes", who,
+			   value, size);
+    }
+  }
+
+  store_bytes(BYTES(FIRST) + LONG(SECOND), size, big, (unsigned long)value);
+  return THIRD;
+}
+
+#define INT_ACCESSORS(name, size, is_signed)				\
+  DEFUN1(bytevector_##name##_ref_proc) {				\
+    return int_ref("bytevector-" #name "-ref", args, n_args,		\
+		   stack_top, size, is_signed);				\
+  }									\
+  DEFUN1(bytevector_##name##_set_proc) {				\
+    return int_set("bytevector-" #name "-set!", args, n_args,		\
+		   stack_top, size, is_signed);				\
+  }
+
+INT_ACCESSORS(u8, 1, 0)
+INT_ACCESSORS(s8, 1, 1)
+INT_ACCESSORS(u16, 2, 0)
+INT_ACCESSORS(s16, 2, 1)
+INT_ACCESSORS(u32, 4, 0)
+INT_ACCESSORS(s32, 4, 1)
+INT_ACCESSORS(u64, 8, 0)
+INT_ACCESSORS(s64, 8, 1)
+
+DEFUN1(bytevector_single_ref_proc) {
+  int big;
+  union { float f; unsigned int bits; } value;
+  object *check = check_access("bytevector-ieee-single-ref", args,
+			       n_args, stack_top, 4);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+  if(!parse_endianness(args, n_args, stack_top, 2, &big)) {
+    return throw_message("bytevector-ieee-single-ref: bad endianness");
+  }
+  value.bits = load_bytes(BYTES(FIRST) + LONG(SECOND), 4, big);
+  return make_real(value.f);
+}
+
+DEFUN1(bytevector_single_set_proc) {
+  int big;
+  union { float f; unsigned int bits; } value;
+  object *check = check_access("bytevector-ieee-single-set!", args,
+			       n_args, stack_top, 4);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+  if(!parse_endianness(args, n_args, stack_top, 3, &big)) {
+    return throw_message("bytevector-ieee-single-set!: bad endianness");
+  }
+  if(is_real(THIRD)) {
+    value.f = DOUBLE(THIRD);
+  }
+  else if(is_fixnum(THIRD)) {
+    value.f = LONG(THIRD);
+  }
+  else {
+    return throw_message("bytevector-ieee-single-set! expects a number");
+  }
+  store_bytes(BYTES(FIRST) + LONG(SECOND), 4, big, value.bits);
+  return THIRD;
+}
+
+DEFUN1(bytevector_double_ref_proc) {
+  int big;
+  union { double d; unsigned long bits; } value;
+  object *check = check_access("bytevector-ieee-double-ref", args,
+			       n_args, stack_top, 8);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+  if(!parse_endianness(args, n_args, stack_top, 2, &big)) {
+    return throw_message("bytevector-ieee-double-ref: bad endianness");
+  }
+  value.bits = load_bytes(BYTES(FIRST) + LONG(SECOND), 8, big);
+  return make_real(value.d);
+}
+
+DEFUN1(bytevector_double_set_proc) {
+  int big;
+  union { double d; unsigned long bits; } value;
+  object *check = check_access("bytevector-ieee-double-set!", args,
+			       n_args, stack_top, 8);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+  if(!parse_endianness(args, n_args, stack_top, 3, &big)) {
+    return throw_message("bytevector-ieee-double-set!: bad endianness");
+  }
+  if(is_real(THIRD)) {
+    value.d = DOUBLE(THIRD);
+  }
+  else if(is_fixnum(THIRD)) {
+    value.d = LONG(THIRD);
+  }
+  else {
+    return throw_message("bytevector-ieee-double-set! expects a number");
+  }
+  store_bytes(BYTES(FIRST) + LONG(SECOND), 8, big, value.bits);
+  return THIRD;
+}
+
+DEFUN1(make_bytevector_proc) {
+  long fill = 0;
+  if(!is_fixnum(FIRST) || LONG(FIRST) < 0 ||
+     (n_args > 1 && !is_fixnum(SECOND))) {
+    return throw_message("make-bytevector expects length and byte fill");
+  }
+  if(n_args > 1) {
+    fill = LONG(SECOND);
+  }
+
+  object *bv = make_bytevector(LONG(FIRST));
+  memset(BYTES(bv), fill, BVLEN(bv));
+  return bv;
+}
+
+DEFUN1(is_bytevector_proc) {
+  return AS_BOOL(is_bytevector(FIRST));
+}
+
+DEFUN1(bytevector_length_proc) {
+  if(!is_bytevector(FIRST)) {
+    return throw_message("bytevector-length expects bytevector");
+  }
+  return make_fixnum(BVLEN(FIRST));
+}
+
+DEFUN1(bytevector_equal_proc) {
+  if(!is_bytevector(FIRST) || !is_bytevector(SECOND)) {
+    return throw_message("bytevector=? expects bytevectors");
+  }
+  return AS_BOOL(BVLEN(FIRST) == BVLEN(SECOND) &&
+		 memcmp(BYTES(FIRST), BYTES(SECOND), BVLEN(FIRST)) == 0);
+}
+
+/* (bytevector-hash bv) is the 64 bit FNV-1a hash of the contents,
+ * folded down to a positive fixnum */
+DEFUN1(bytevector_hash_proc) {
+  if(!is_bytevector(FIRST)) {
+    return throw_message("bytevector-hash expects a bytevector");
+  }
+  const unsigned char *bytes = (const unsigned char *)BYTES(FIRST);
+  unsigned long hash = 14695981039346656037UL;
+  long ii;
+  for(ii = 0; ii < BVLEN(FIRST); ++ii) {
+    hash = (hash ^ bytes[ii]) * 1099511628211UL;
+  }
+  return make_fixnum((long)(hash >> 2));
+}
+
+DEFUN1(bytevector_fill_proc) {
+  if(!is_bytevector(FIRST) || !is_fixnum(SECOND)) {
+    return throw_message("bytevector-fill! expects bytevector and byte");
+  }
+  memset(BYTES(FIRST), LONG(SECOND), BVLEN(FIRST));
+  return FIRST;
+}
+
+/* (bytevector-copy! to at from [start [end]]) */
+DEFUN1(bytevector_copy_into_proc) {
+  long start, end;
+  object *to = FIRST;
+  object *from = THIRD;
+  if(!is_bytevector(to) || !is_fixnum(SECOND) || !is_bytevector(from)) {
+    return throw_message("bytevector-copy! expects bytevector, index "
+			 "and bytevector");
+  }
+
+  object *check = optional_range("bytevector-copy!", from, args, n_args,
+				 stack_top, 3, &start, &end);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+  long at = LONG(SECOND);
+  check = check_range("bytevector-copy!", to, at, at + (end - start));
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+
+  memmove(BYTES(to) + at, BYTES(from) + start, end - start);
+  return to;
+}
+
+DEFUN1(bytevector_copy_proc) {
+  long start, end;
+  if(!is_bytevector(FIRST)) {
+    return throw_message("bytevector-copy expects bytevector");
+  }
+  object *check = optional_range("bytevector-copy", FIRST, args, n_args,
+				 stack_top, 1, &start, &end);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+
+  object *copy = make_bytevector(end - start);
+  memcpy(BYTES(copy), BYTES(FIRST) + start, end - start);
+  return copy;
+}
+
+DEFUN1(list_to_bytevector_proc) {
+  long length = 0;
+  object *next;
+  for(next = FIRST; is_pair(next); next = cdr(next)) {
+    if(!is_fixnum(car(next))) {
+      return throw_message("u8-list->bytevector expects a list of bytes");
+    }
+    ++length;
+  }
+
+  object *bv = make_bytevector(length);
+  unsigned char *dest = BYTES(bv);
+  for(next = FIRST; is_pair(next); next = cdr(next)) {
+    *dest++ = LONG(car(next));
+  }
+  return bv;
+}
+
+DEFUN1(bytevector_to_list_proc) {
+  long ii;
+  if(!is_bytevector(FIRST)) {
+    return throw_message("bytevector->u8-list expects bytevector");
+  }
+
+  object *result = g->empty_list;
+  push_root(&result);
+  for(ii = BVLEN(FIRST) - 1; ii >= 0; --ii) {
+    result = cons(make_fixnum(BYTES(FIRST)[ii]), result);
+  }
+  pop_root(&result);
+  return result;
+}
+
+DEFUN1(string_to_utf8_proc) {
+  if(!is_string(FIRST)) {
+    return throw_message("string->utf8 expects string");
+  }
+  object *bv = make_bytevector(STRLEN(FIRST));
+  memcpy(BYTES(bv), STRING(FIRST), STRLEN(FIRST));
+  return bv;
+}
+
+DEFUN1(utf8_to_string_proc) {
+  long start, end;
+  if(!is_bytevector(FIRST)) {
+    return throw_message("utf8->string expects bytevector");
+  }
+  object *check = optional_range("utf8->string", FIRST, args, n_args,
+				 stack_top, 1, &start, &end);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+  return make_counted_string((char *)BYTES(FIRST) + start, end - start);
+}
+
+/* (read-bytevector! bv port [start [end]]) reads directly into the
+ * bytevector storage and returns the count, or eof */
+DEFUN1(read_bytevector_proc) {
+  long start, end;
+  if(!is_bytevector(FIRST) || !is_input_port(SECOND)) {
+    return throw_message("read-bytevector! expects bytevector and "
+			 "input port");
+  }
+  object *check = optional_range("read-bytevector!", FIRST, args, n_args,
+				 stack_top, 2, &start, &end);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+
+  size_t count = fread(BYTES(FIRST) + start, 1, end - start,
+		       INPUT(SECOND));
+  if(count == 0 && end > start) {
+    return g->eof_object;
+  }
+  return make_fixnum(count);
+}
+
+DEFUN1(write_bytevector_proc) {
+  long start, end;
+  if(!is_bytevector(FIRST) || !is_output_port(SECOND)) {
+    return throw_message("write-bytevector expects bytevector and "
+			 "output port");
+  }
+  object *check = optional_range("write-bytevector", FIRST, args, n_args,
+				 stack_top, 2, &start, &end);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+
+  size_t count = fwrite(BYTES(FIRST) + start, 1, end - start,
+			OUTPUT(SECOND));
+  return make_fixnum(count);
+}
+
+/* a mapped bytevector views a whole file through mmap(). slices of it
+ * share the mapping without copying, so every live mapping is kept
+ * here where the collector can find the owner of a slice. */
+typedef struct mapping {
+  unsigned char *base;
+  long length;
+  object *owner;
+  struct mapping *next;
+} mapping;
+
+static mapping *mappings = NULL;
+
+object *mapped_bytevector_owner(object * slice) {
+  mapping *m;
+  for(m = mappings; m != NULL; m = m->next) {
+    if(BYTES(slice) >= m->base && BYTES(slice) <= m->base + m->length) {
+      return m->owner;
+    }
+  }
+  return g->empty_list;
+}
+
+void unmap_bytevector(object * owner) {
+  mapping **link = &mappings;
+  while(*link != NULL) {
+    if((*link)->owner == owner) {
+      mapping *dead = *link;
+      *link = dead->next;
+      if(dead->length > 0) {
+	munmap(dead->base, dead->length);
+      }
+      free(dead);
+      return;
+    }
+    link = &(*link)->next;
+  }
+}
+
+/* translate an advice symbol into the madvise() constant */
+int parse_madvise(object * sym, int *advice) {
+  if(sym == make_symbol("normal")) {
+    *advice = MADV_NORMAL;
+  }
+  else if(sym == make_symbol("sequential")) {
+    *advice = MADV_SEQUENTIAL;
+  }
+  else if(sym == make_symbol("random")) {
+    *advice = MADV_RANDOM;
+  }
+  else if(sym == make_symbol("willneed")) {
+    *advice = MADV_WILLNEED;
+  }
+  else if(sym == make_symbol("dontneed")) {
+    *advice = MADV_DONTNEED;
+  }
+  else {
+    return 0;
+  }
+  return 1;
+}
+
+/* madvise() wants a page aligned start */
+static int advise_range(unsigned char *start, long length, int advice) {
+  long page = sysconf(_SC_PAGESIZE);
+  unsigned char *aligned = (unsigned char *)((unsigned long)start & ~(page - 1));
+  if(length == 0) {
+    return 0;
+  }
+  return madvise(aligned, length + (start - aligned), advice);
+}
+
+/* (mmap-file path [advice]) maps the file copy-on-write, so writes
+ * through the bytevector never reach the file. returns eof when the
+ * file cannot be mapped. */
+DEFUN1(mmap_file_proc) {
+  int advice = MADV_NORMAL;
+  if(!is_string(FIRST) || (n_args > 1 && !parse_madvise(SECOND, &advice))) {
+    return throw_message("mmap-file expects a path and optional advice of "
+			 "normal, sequential, random, willneed or dontneed");
+  }
+
+  int fd = open(STRING(FIRST), O_RDONLY);
+  if(fd < 0) {
+    return g->eof_object;
+  }
+  struct stat st;
+  if(fstat(fd, &st) < 0) {
+    close(fd);
+    return g->eof_object;
+  }
+
+  unsigned char *base = NULL;
+  if(st.st_size > 0) {
+    base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if(base == MAP_FAILED) {
+      close(fd);
+      return g->eof_object;
+    }
+    advise_range(base, st.st_size, advice);
+  }
+  close(fd);
+
+  object *obj = alloc_object(1);
+  obj->type = MAPPED_BYTEVECTOR;
+  BYTES(obj) = base;
+  BVLEN(obj) = st.st_size;
+
+  mapping *m = malloc(sizeof(mapping));
+  m->base = base;
+  m->length = st.st_size;
+  m->owner = obj;
+  m->next = mappings;
+  mappings = m;
+  return obj;
+}
+
+DEFUN1(is_mapped_bytevector_proc) {
+  return AS_BOOL(is_mapped_bytevector(FIRST));
+}
+
+/* (bytevector-slice bv start end) shares the storage of a mapped
+ * bytevector rather than copying it */
+DEFUN1(bytevector_slice_proc) {
+  if(!is_mapped_bytevector(FIRST) || !is_fixnum(SECOND) ||
+     !is_fixnum(THIRD)) {
+    return throw_message("bytevector-slice expects mapped bytevector, "
+			 "start and end");
+  }
+  long start = LONG(SECOND), end = LONG(THIRD);
+  object *check = check_range("bytevector-slice", FIRST, start, end);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+
+  object *slice = alloc_object(0);
+  slice->type = BYTEVECTOR_SLICE;
+  BYTES(slice) = BYTES(FIRST) + start;
+  BVLEN(slice) = end - start;
+  return slice;
+}
+
+DEFUN1(mmap_advise_proc) {
+  long start, end;
+  int advice;
+  if(!is_mapped_bytevector(FIRST) || !parse_madvise(SECOND, &advice)) {
+    return throw_message("mmap-advise expects mapped bytevector and advice");
+  }
+  object *check = optional_range("mmap-advise", FIRST, args, n_args,
+				 stack_top, 2, &start, &end);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+  return AS_BOOL(advise_range(BYTES(FIRST) + start, end - start,
+			      advice) == 0);
+}
+
+/* (bytevector-search-forward pattern bv [start]) finds a byte, a
+ * string or another bytevector, returning the index or #f */
+DEFUN1(bytevector_search_forward_proc) {
+  char byte;
+  char *needle;
+  long nlen;
+  if(is_bytevector(FIRST)) {
+    needle = (char *)BYTES(FIRST);
+    nlen = BVLEN(FIRST);
+  }
+  else if(is_string(FIRST)) {
+    needle = STRING(FIRST);
+    nlen = STRLEN(FIRST);
+  }
+  else if(is_character(FIRST)) {
+    needle = &CHAR(FIRST);
+    nlen = 1;
+  }
+  else if(is_fixnum(FIRST) && LONG(FIRST) >= 0 && LONG(FIRST) < 256) {
+    byte = LONG(FIRST);
+    needle = &byte;
+    nlen = 1;
+  }
+  else {
+    return throw_message("bytevector-search-forward expects a byte, "
+			 "character, string or bytevector pattern");
+  }
+  if(!is_bytevector(SECOND) || (n_args > 2 && !is_fixnum(THIRD))) {
+    return throw_message("bytevector-search-forward expects bytevector and "
+			 "start");
+  }
+
+  long start = n_args > 2 ? LONG(THIRD) : 0;
+  object *check = check_range("bytevector-search-forward", SECOND,
+			      start, start);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+  long found = string_search((char *)BYTES(SECOND) + start,
+			     BVLEN(SECOND) - start, needle, nlen);
+  return found < 0 ? g->false : make_fixnum(start + found);
+}
+
+void init_bytevector(definer defn) {
+#define add_procedure(scheme_name, c_name)			\
+  defn(scheme_name,						\
+       make_primitive_proc(c_name))
+
+  add_procedure("make-bytevector", make_bytevector_proc);
+  add_procedure("bytevector?", is_bytevector_proc);
+  add_procedure("bytevector-length", bytevector_length_proc);
+  add_procedure("bytevector=?", bytevector_equal_proc);
+  add_procedure("bytevector-hash", bytevector_hash_proc);
+  add_procedure("bytevector-fill!", bytevector_fill_proc);
+  add_procedure("bytevector-copy!", bytevector_copy_into_proc);
+  add_procedure("bytevector-copy", bytevector_copy_proc);
+  add_procedure("u8-list->bytevector", list_to_bytevector_proc);
+  add_procedure("bytevector->u8-list", bytevector_to_list_proc);
+  add_procedure("string->utf8", string_to_utf8_proc);
+  add_procedure("utf8->string", utf8_to_string_proc);
+  add_procedure("read-bytevector!", read_bytevector_proc);
+  add_procedure("bytevector-search-forward", bytevector_search_forward_proc);
+
+  add_procedure("mmap-file", mmap_file_proc);
+  add_procedure("mapped-bytevector?", is_mapped_bytevector_proc);
+  add_procedure("bytevector-slice", bytevector_slice_proc);
+  add_procedure("mmap-advise", mmap_advise_proc);
+  add_procedure("write-bytevector", write_bytevector_proc);
+
+  add_procedure("bytevector-u8-ref", bytevector_u8_ref_proc);
+  add_procedure("bytevector-u8-set!", bytevector_u8_set_proc);
+  add_procedure("bytevector-s8-ref", bytevector_s8_ref_proc);
+  add_procedure("bytevector-s8-set!", bytevector_s8_set_proc);
+  add_procedure("bytevector-u16-ref", bytevector_u16_ref_proc);
+  add_procedure("bytevector-u16-set!", bytevector_u16_set_proc);
+  add_procedure("bytevector-s16-ref", bytevector_s16_ref_proc);
+  add_procedure("bytevector-s16-set!", bytevector_s16_set_proc);
+  add_procedure("bytevector-u32-ref", bytevector_u32_ref_proc);
+  add_procedure("bytevector-u32-set!", bytevector_u32_set_proc);
+  add_procedure("bytevector-s32-ref", bytevector_s32_ref_proc);
+  add_procedure("bytevector-s32-set!", bytevector_s32_set_proc);
+  add_procedure("bytevector-u64-ref", bytevector_u64_ref_proc);
+  add_procedure("bytevector-u64-set!", bytevector_u64_set_proc);
+  add_procedure("bytevector-s64-ref", bytevector_s64_ref_proc);
+  add_procedure("bytevector-s64-set!", bytevector_s64_set_proc);
+  add_procedure("bytevector-ieee-single-ref", bytevector_single_ref_proc);
+  add_procedure("bytevector-ieee-single-set!", bytevector_single_set_proc);
+  add_procedure("bytevector-ieee-double-ref", bytevector_double_ref_proc);
+  add_procedure("bytevector-ieee-double-set!", bytevector_double_set_proc);
+}
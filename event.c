@@ -0,0 +1,325 @@
+/**
+ * Copyright 2010 Brian Taylor
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* an event loop over epoll. descriptors are watched for readiness and
+ * timers live in a binary heap beside them, so a single wait covers
+ * both without the FD_SETSIZE limit or per-call setup that select()
+ * has. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/epoll.h>
+
+#include "types.h"
+#include "gc.h"
+#include "interp.h"
+#include "event.h"
+
+#define MAX_EVENTS 256
+
+typedef struct timer {
+  long long deadline;		/* CLOCK_MONOTONIC microseconds */
+  long id;
+} timer;
+
+typedef struct event_loop {
+  int epfd;
+  timer *timers;
+  long timer_count;
+  long timer_capacity;
+  long next_id;
+} event_loop;
+
+static long long now_usec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+object *make_event_loop(void) {
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if(epfd < 0) {
+    return g->false;
+  }
+  event_loop *loop = malloc(sizeof(event_loop));
+  loop->epfd = epfd;
+  loop->timers = NULL;
+  loop->timer_count = loop->timer_capacity = 0;
+  loop->next_id = 0;
+
+  object *obj = alloc_object(1);
+  obj->type = EVENT_LOOP;
+  EVENT_LOOP_STATE(obj) = loop;
+  return obj;
+}
+
+void free_event_loop(object * obj) {
+  event_loop *loop = EVENT_LOOP_STATE(obj);
+  close(loop->epfd);
+  free(loop->timers);
+  free(loop);
+}
+
+int event_loop_fd(object * obj) {
+  return EVENT_LOOP_STATE(obj)->epfd;
+}
+
+/* timer heap, earliest deadline first */
+
+static void timer_swap(event_loop * loop, long a, long b) {
+  timer tmp = loop->timers[a];
+  loop->timers[a] = loop->timers[b];
+  loop->timers[b] = tmp;
+}
+
+static void timer_up(event_loop * loop, long i) {
+  while(i > 0 && loop->timers[(i - 1) / 2].deadline >
+	loop->timers[i].deadline) {
+    timer_swap(loop, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void timer_down(event_loop * loop, long i) {
+  for(;;) {
+    long least = i, left = 2 * i + 1, right = 2 * i + 2;
+    if(left < loop->timer_count &&
+       loop->timers[left].deadline < loop->timers[least].deadline) {
+      least = left;
+    }
+    if(right < loop->timer_count &&
+       loop->timers[right].deadline < loop->timers[least].deadline) {
+      least = right;
+    }
+    if(least == i) {
+      return;
+    }
+    timer_swap(loop, i, least);
+    i = least;
+  }
+}
+
+static void timer_remove(event_loop * loop, long i) {
+  loop->timers[i] = loop->timers[--loop->timer_count];
+  if(i < loop->timer_count) {
+    timer_up(loop, i);
+    timer_down(loop, i);
+  }
+}
+
+static long timer_add(event_loop * loop, long long deadline, long id) {
+  if(loop->timer_count == loop->timer_capacity) {
+    loop->timer_capacity =
+      loop->timer_capacity ? loop->timer_capacity * 2 : 16;
+    loop->timers = realloc(loop->timers,
+			   loop->timer_capacity * sizeof(timer));
+  }
+  loop->timers[loop->timer_count].deadline = deadline;
+  loop->timers[loop->timer_count].id = id;
+  timer_up(loop, loop->timer_count++);
+  return id;
+}
+
+/* a hangup or error wakes readers and writers alike, since either
+ * will find out about it on their next call */
+static object *event_kind_symbol(uint32_t events) {
+  int readable = (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+  int writable = (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) != 0;
+  if(readable && writable) {
+    return make_symbol("read-write");
+  }
+  return make_symbol(readable ? "read" : "write");
+}
+
+DEFUN1(make_event_loop_proc) {
+  return make_event_loop();
+}
+
+DEFUN1(is_event_loop_proc) {
+  return AS_BOOL(is_event_loop(FIRST));
+}
+
+/* (event-loop-watch! loop fd interest [mode]) where interest is read,
+   write or read-write and mode is level (the default), edge or
+   oneshot. watching an fd again replaces its interest, which is also
+   how a oneshot watch is rearmed. */
+DEFUN1(event_loop_watch_proc) {
+  if(!is_event_loop(FIRST) || !is_fixnum(SECOND) || !is_symbol(THIRD)) {
+    return throw_message("event-loop-watch! expects event loop, fd and "
+			 "interest");
+  }
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.data.fd = LONG(SECOND);
+
+  if(THIRD == make_symbol("read")) {
+    ev.events = EPOLLIN;
+  }
+  else if(THIRD == make_symbol("write")) {
+    ev.events = EPOLLOUT;
+  }
+  else if(THIRD == make_symbol("read-write")) {
+    ev.events = EPOLLIN | EPOLLOUT;
+  }
+  else {
+    return throw_message("event-loop-watch!: unknown interest");
+  }
+
+  if(n_args > 3) {
+    if(FOURTH == make_symbol("edge")) {
+      ev.events |= EPOLLET;
+    }
+    else if(FOURTH == make_symbol("oneshot")) {
+      ev.events |= EPOLLONESHOT;
+    }
+    else if(FOURTH != make_symbol("level")) {
+      return throw_message("event-loop-watch!: unknown mode");
+    }
+  }
+
+  int epfd = event_loop_fd(FIRST);
+  int result = epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+  if(result < 0 && errno == EEXIST) {
+    result = epoll_ctl(epfd, EPOLL_CTL_MOD, ev.data.fd, &ev);
+  }
+  return AS_BOOL(result == 0);
+}
+
+DEFUN1(event_loop_unwatch_proc) {
+  if(!is_event_loop(FIRST) || !is_fixnum(SECOND)) {
+    return throw_message("event-loop-unwatch! expects event loop and fd");
+  }
+  return AS_BOOL(epoll_ctl(event_loop_fd(FIRST), EPOLL_CTL_DEL,
+			   LONG(SECOND), NULL) == 0);
+}
+
+/* (event-loop-add-timer! loop usec [id]) fires once, usec from now.
+   the id defaults to a fresh one and is what the wait reports. */
+DEFUN1(event_loop_add_timer_proc) {
+  if(!is_event_loop(FIRST) || !is_fixnum(SECOND) ||
+     (n_args > 2 && !is_fixnum(THIRD))) {
+    return throw_message("event-loop-add-timer! expects event loop and "
+			 "microseconds");
+  }
+  event_loop *loop = EVENT_LOOP_STATE(FIRST);
+  long id = n_args > 2 ? LONG(THIRD) : loop->next_id++;
+  return make_fixnum(timer_add(loop, now_usec() + LONG(SECOND), id));
+}
+
+DEFUN1(event_loop_cancel_timer_proc) {
+  if(!is_event_loop(FIRST) || !is_fixnum(SECOND)) {
+    return throw_message("event-loop-cancel-timer! expects event loop and "
+			 "timer id");
+  }
+  event_loop *loop = EVENT_LOOP_STATE(FIRST);
+  long i;
+  for(i = 0; i < loop->timer_count; i++) {
+    if(loop->timers[i].id == LONG(SECOND)) {
+      timer_remove(loop, i);
+      return g->true;
+    }
+  }
+  return g->false;
+}
+
+DEFUN1(event_loop_timer_count_proc) {
+  if(!is_event_loop(FIRST)) {
+    return throw_message("event-loop-timer-count expects event loop");
+  }
+  return make_fixnum(EVENT_LOOP_STATE(FIRST)->timer_count);
+}
+
+/* (event-loop-wait loop [usec]) blocks until an fd is ready, a timer
+   expires or usec passes, and returns a list of (fd . read|write|
+   read-write) and (timer . id). without a timeout and with no timers
+   pending it waits on the fds alone. */
+DEFUN1(event_loop_wait_proc) {
+  if(!is_event_loop(FIRST) || (n_args > 1 && !is_fixnum(SECOND))) {
+    return throw_message("event-loop-wait expects event loop and "
+			 "microseconds");
+  }
+  event_loop *loop = EVENT_LOOP_STATE(FIRST);
+  long long limit = n_args > 1 ? LONG(SECOND) : -1;
+  if(loop->timer_count > 0) {
+    long long until = loop->timers[0].deadline - now_usec();
+    if(until < 0) {
+      until = 0;
+    }
+    if(limit < 0 || until < limit) {
+      limit = until;
+    }
+  }
+
+  /* round up so a timer is never woken for just before its deadline */
+  long long ms = limit < 0 ? -1 : limit / 1000 + (limit % 1000 != 0);
+  int timeout = ms > INT_MAX ? INT_MAX : (int)ms;
+  struct epoll_event events[MAX_EVENTS];
+  int count = epoll_wait(loop->epfd, events, MAX_EVENTS, timeout);
+  if(count < 0) {
+    if(errno != EINTR) {
+      return g->false;
+    }
+    count = 0;
+  }
+
+  object *result = g->empty_list;
+  push_root(&result);
+  object *key = NULL;
+  push_root(&key);
+
+  long long now = now_usec();
+  while(loop->timer_count > 0 && loop->timers[0].deadline <= now) {
+    key = make_fixnum(loop->timers[0].id);
+    timer_remove(loop, 0);
+    object *event = cons(key, key);
+    push_root(&event);
+    CAR(event) = make_symbol("timer");
+    result = cons(event, result);
+    pop_root(&event);
+  }
+
+  int i;
+  for(i = 0; i < count; i++) {
+    key = make_fixnum(events[i].data.fd);
+    object *event = cons(key, event_kind_symbol(events[i].events));
+    push_root(&event);
+    result = cons(event, result);
+    pop_root(&event);
+  }
+
+  pop_root(&key);
+  pop_root(&result);
+  return result;
+}
+
+void init_event(definer defn) {
+#define add_procedure(scheme_name, c_name)			\
+  defn(scheme_name,						\
+       make_primitive_proc(c_name))
+
+  add_procedure("make-event-loop", make_event_loop_proc);
+  add_procedure("event-loop?", is_event_loop_proc);
+  add_procedure("event-loop-watch!", event_loop_watch_proc);
+  add_procedure("event-loop-unwatch!", event_loop_unwatch_proc);
+  add_procedure("event-loop-add-timer!", event_loop_add_timer_proc);
+  add_procedure("event-loop-cancel-timer!", event_loop_cancel_timer_proc);
+  add_procedure("event-loop-timer-count", event_loop_timer_count_proc);
+  add_procedure("event-loop-wait", event_loop_wait_proc);
+}
@@ -0,0 +1,1096 @@
+/**
+ * Copyright 2010 Brian Taylor
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* fasl records are a binary encoding of data that reads back without
+ * going through the printer and reader. each record starts with the
+ * magic "BSF" and a version byte and holds one object:
+ *
+ *   n t f e         '(), #t, #f and eof
+ *   i varint        fixnum, zigzag encoded
+ *   d 8 bytes       flonum, little endian IEEE double
+ *   c byte          character
+ *   s varint bytes  string
+ *   b varint bytes  bytevector
+ *   y varint bytes  symbol, numbered in order of appearance
+ *   Y varint        the symbol with that number
+ *   g               uninterned symbol
+ *   p car cdr       pair, with the cdr following directly
+ *   v varint ...    vector of that many objects
+ *   h varint ...    hash table of that many keys each followed by
+ *                   its value
+ *   k varint ...    compiled procedure: its length in bytecode words,
+ *                   an opcode number and zigzag operands for each
+ *                   instruction, then a count and its constants
+ *   = object        object that is referenced again later
+ *   @ varint        the Nth object marked with =
+ *
+ * a pass before writing finds the objects reachable more than once,
+ * so shared structure and cycles come back with the same shape.
+ * compiled procedures are written only when they close over nothing,
+ * like a compiled top level form, along with the code of the lambdas
+ * in them. globals are written by name and looked up again when the
+ * code first runs. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "gc.h"
+#include "interp.h"
+#include "socket.h"
+#include "vm.h"
+#include "fasl.h"
+
+#define FASL_VERSION 1
+#define FASL_FLUSH 65536
+
+/* the most bytes a record read from a pipe may claim to hold, since
+ * there is no telling how many are still to come */
+#define FASL_STREAM_LIMIT (1L << 28)
+
+/* how deeply containers may nest in a record. the coders recurse in C
+ * for each level, except along the cdrs of a list */
+#define FASL_MAX_DEPTH 10000
+
+/* identity table from object to a number while writing */
+typedef struct seen_table {
+  object **keys;
+  long *values;
+  long size;
+  long count;
+} seen_table;
+
+static unsigned long seen_hash(object * obj, long size) {
+  return (((uintptr_t) obj >> 3) * 2654435761UL) & (size - 1);
+}
+
+/* a table made WITHOUT_VALUES is only a set */
+#define WITH_VALUES 1
+#define WITHOUT_VALUES 0
+
+static void seen_init(seen_table * t, int with_values) {
+  t->size = 1024;
+  t->count = 0;
+  t->keys = calloc(t->size, sizeof(object *));
+  t->values = with_values ? malloc(t->size * sizeof(long)) : NULL;
+}
+
+static void seen_free(seen_table * t) {
+  free(t->keys);
+  free(t->values);
+}
+
+static long *seen_find(seen_table * t, object * obj) {
+  unsigned long ii = seen_hash(obj, t->size);
+  while(t->keys[ii] != NULL) {
+    if(t->keys[ii] == obj) {
+      return &t->values[ii];
+    }
+    ii = (ii + 1) & (t->size - 1);
+  }
+  return NULL;
+}
+
+static int seen_add(seen_table * t, object * obj, long value);
+
+static void seen_grow(seen_table * t) {
+  seen_table bigger;
+  bigger.size = t->size * 2;
+  bigger.count = 0;
+  bigger.keys = calloc(bigger.size, sizeof(object *));
+  bigger.values = t->values ? malloc(bigger.size * sizeof(long)) : NULL;
+  long ii;
+  for(ii = 0; ii < t->size; ++ii) {
+    if(t->keys[ii] != NULL) {
+      seen_add(&bigger, t->keys[ii], t->values ? t->values[ii] : 0);
+    }
+  }
+  seen_free(t);
+  *t = bigger;
+}
+
+/* adds OBJ unless it is already there, returning whether it was */
+static int seen_add(seen_table * t, object * obj, long value) {
+  if(t->count * 2 >= t->size) {
+    seen_grow(t);
+  }
+  unsigned long ii = seen_hash(obj, t->size);
+  while(t->keys[ii] != NULL) {
+    if(t->keys[ii] == obj) {
+      return 1;
+    }
+    ii = (ii + 1) & (t->size - 1);
+  }
+  t->keys[ii] = obj;
+  if(t->values) {
+    t->values[ii] = value;
+  }
+  t->count++;
+  return 0;
+}
+
+/* objects with an identity worth preserving */
+static int fasl_shareable(object * obj) {
+  if(TAGGED(obj)) {
+    return 0;
+  }
+  switch (obj->type) {
+  case PAIR:
+  case VECTOR:
+  case HASH_TABLE:
+  case STRING:
+  case BYTEVECTOR:
+  case MAPPED_BYTEVECTOR:
+  case BYTEVECTOR_SLICE:
+  case LAZY_SYMBOL:
+    return obj != g->empty_vector;
+  default:
+    return 0;
+  }
+}
+
+/* what the constants of compiled code are to the instructions using
+ * them. once a gvar instruction has run, it caches the (symbol . value)
+ * slot of its global in place of the symbol. the code a fn instruction
+ * makes closures of holds the compiler's environment, which means
+ * nothing once the code is written */
+#define CONST_GLOBAL 1
+#define CONST_LAMBDA 2
+
+static char *code_consts(object * fn) {
+  object *bytecode = BYTECODE(fn);
+  long n = LONG(CAR(bytecode));
+  void **codes = ALIEN_PTR(CAR(CDR(bytecode)));
+  object *consts = CAR(CDR(CDR(bytecode)));
+  char *uses = calloc(VSIZE(consts) + 1, 1);
+  long ii;
+  for(ii = 0; ii + 1 < n; ii += 2) {
+    long opcode = bytecode_opcode(codes[ii]);
+    long index = (long)codes[ii + 1] >> 16;
+    if(index < 0 || index >= VSIZE(consts)) {
+      continue;
+    }
+    if(opcode == bytecode_gvar_opcode()) {
+      uses[index] = CONST_GLOBAL;
+    }
+    else if(opcode == bytecode_fn_opcode()) {
+      uses[index] = CONST_LAMBDA;
+    }
+  }
+  return uses;
+}
+
+static object *code_const(object * fn, char *uses, long index) {
+  object *obj = VARRAY(CAR(CDR(CDR(BYTECODE(fn)))))[index];
+  return uses[index] == CONST_GLOBAL && is_pair(obj) ? CAR(obj) : obj;
+}
+
+static int fasl_scan(seen_table * visited, seen_table * shared,
+		     object * obj, long depth);
+
+static int fasl_scan_code(seen_table * visited, seen_table * shared,
+			  object * fn, long depth) {
+  char *uses = code_consts(fn);
+  long n = VSIZE(CAR(CDR(CDR(BYTECODE(fn)))));
+  long ii;
+  int ok = 1;
+  for(ii = 0; ii < n && ok; ++ii) {
+    ok = fasl_scan(visited, shared, code_const(fn, uses, ii), depth + 1);
+  }
+  free(uses);
+  return ok;
+}
+
+/* collects the objects reached more than once into SHARED, each
+ * numbered 0 until it is written. 0 if OBJ nests too deeply to write */
+static int fasl_scan(seen_table * visited, seen_table * shared,
+		     object * obj, long depth) {
+  if(depth > FASL_MAX_DEPTH) {
+    return 0;
+  }
+  if(is_compiled_proc(obj)) {
+    return fasl_scan_code(visited, shared, obj, depth);
+  }
+  while(fasl_shareable(obj)) {
+    if(seen_add(visited, obj, 0)) {
+      seen_add(shared, obj, 0);
+      return 1;
+    }
+
+    if(obj->type == PAIR) {
+      if(!fasl_scan(visited, shared, CAR(obj), depth + 1)) {
+	return 0;
+      }
+      obj = CDR(obj);
+    }
+    else if(obj->type == VECTOR) {
+      long ii;
+      for(ii = 0; ii < VSIZE(obj); ++ii) {
+	if(!fasl_scan(visited, shared, VARRAY(obj)[ii], depth + 1)) {
+	  return 0;
+	}
+      }
+      return 1;
+    }
+    else if(obj->type == HASH_TABLE) {
+      hashtab_iter_t iter;
+      htb_iter_init(HTAB(obj), &iter);
+      while(iter.key != NULL) {
+	if(!fasl_scan(visited, shared, iter.key, depth + 1) ||
+	   !fasl_scan(visited, shared, iter.value, depth + 1)) {
+	  return 0;
+	}
+	htb_iter_inc(&iter);
+      }
+      return 1;
+    }
+    else {
+      return 1;
+    }
+  }
+  return 1;
+}
+
+/* the encoder collects bytes here, passing them on to a port as the
+ * buffer fills or keeping them all for a bytevector */
+typedef struct fasl_out {
+  unsigned char *data;
+  long length;
+  long capacity;
+  object *port;
+  seen_table shared;
+  seen_table symbols;
+  long labels;
+  long depth;
+  char *error;
+} fasl_out;
+
+static void out_flush(fasl_out * out) {
+  if(out->port == NULL || out->length == 0) {
+    return;
+  }
+  if(is_socket_port(out->port)) {
+    socket_port_write(out->port, out->data, out->length);
+  }
+  else {
+    fwrite(out->data, 1, out->length, OUTPUT(out->port));
+  }
+  out->length = 0;
+}
+
+static void out_reserve(fasl_out * out, long n) {
+  if(out->length + n <= out->capacity) {
+    return;
+  }
+  if(out->port != NULL) {
+    out_flush(out);
+    if(n <= out->capacity) {
+      return;
+    }
+  }
+  while(out->capacity < out->length + n) {
+    out->capacity *= 2;
+  }
+  out->data = realloc(out->data, out->capacity);
+}
+
+static void out_byte(fasl_out * out, unsigned char byte) {
+  out_reserve(out, 1);
+  out->data[out->length++] = byte;
+}
+
+static void out_bytes(fasl_out * out, const void *src, long n) {
+  out_reserve(out, n);
+  memcpy(out->data + out->length, src, n);
+  out->length += n;
+}
+
+static void out_varint(fasl_out * out, unsigned long value) {
+  out_reserve(out, 10);
+  while(value >= 0x80) {
+    out->data[out->length++] = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  out->data[out->length++] = value;
+}
+
+static void out_counted(fasl_out * out, unsigned char tag,
+			const void *src, long n) {
+  out_byte(out, tag);
+  out_varint(out, n);
+  out_bytes(out, src, n);
+}
+
+static void out_symbol(fasl_out * out, object * sym) {
+  long *index = seen_find(&out->symbols, sym);
+  if(index != NULL) {
+    out_byte(out, 'Y');
+    out_varint(out, *index);
+    return;
+  }
+  seen_add(&out->symbols, sym, out->symbols.count);
+  out_counted(out, 'y', SYMBOL(sym), strlen(SYMBOL(sym)));
+}
+
+static void fasl_encode(fasl_out * out, object * obj);
+
+static void fasl_encode_code(fasl_out * out, object * fn, int lambda) {
+  object *bytecode = BYTECODE(fn);
+  long n = LONG(CAR(bytecode));
+  void **codes = ALIEN_PTR(CAR(CDR(bytecode)));
+  long count = VSIZE(CAR(CDR(CDR(bytecode))));
+  long ii;
+
+  if(!lambda && CENV(fn) != g->empty_list) {
+    out->error = "fasl cannot write closures";
+    return;
+  }
+  out_byte(out, 'k');
+  out_varint(out, n);
+  for(ii = 0; ii + 1 < n; ii += 2) {
+    long opcode = bytecode_opcode(codes[ii]);
+    long operands = (long)codes[ii + 1];
+    if(opcode < 0) {
+      out->error = "fasl cannot write code with an unknown opcode";
+      return;
+    }
+    out_byte(out, opcode);
+    out_varint(out, ((unsigned long)operands << 1) ^ (operands >> 63));
+  }
+
+  char *uses = code_consts(fn);
+  out_varint(out, count);
+  for(ii = 0; ii < count && !out->error; ++ii) {
+    object *obj = code_const(fn, uses, ii);
+    if(uses[ii] == CONST_LAMBDA && is_compiled_proc(obj)) {
+      fasl_encode_code(out, obj, 1);
+    }
+    else {
+      fasl_encode(out, obj);
+    }
+  }
+  free(uses);
+}
+
+static void fasl_encode_one(fasl_out * out, object * obj) {
+  for(;;) {
+    if(TAGGED(obj)) {
+      out_byte(out, 'i');
+      long value = SMALL_FIXNUM(obj);
+      out_varint(out, ((unsigned long)value << 1) ^ (value >> 63));
+      return;
+    }
+
+    /* only the shared objects need looking up, and usually there
+     * are none at all */
+    long *label;
+    if(out->shared.count > 0 && fasl_shareable(obj) &&
+       (label = seen_find(&out->shared, obj)) != NULL) {
+      if(*label > 0) {
+	out_byte(out, '@');
+	out_varint(out, *label - 1);
+	return;
+      }
+      out_byte(out, '=');
+      *label = ++out->labels;
+    }
+
+    switch (obj->type) {
+    case THE_EMPTY_LIST:
+      out_byte(out, 'n');
+      return;
+    case BOOLEAN:
+      out_byte(out, obj == g->false ? 'f' : 't');
+      return;
+    case EOF_OBJECT:
+      out_byte(out, 'e');
+      return;
+    case FIXNUM:{
+	long value = LONG(obj);
+	out_byte(out, 'i');
+	out_varint(out, ((unsigned long)value << 1) ^ (value >> 63));
+	return;
+      }
+    case FLOATNUM:{
+	uint64_t bits;
+	unsigned char bytes[8];
+	memcpy(&bits, &DOUBLE(obj), 8);
+	int ii;
+	for(ii = 0; ii < 8; ++ii) {
+	  bytes[ii] = bits >> (8 * ii);
+	}
+	out_byte(out, 'd');
+	out_bytes(out, bytes, 8);
+	return;
+      }
+    case CHARACTER:
+      out_byte(out, 'c');
+      out_byte(out, CHAR(obj));
+      return;
+    case STRING:
+      out_counted(out, 's', STRING(obj), STRLEN(obj));
+      return;
+    case BYTEVECTOR:
+    case MAPPED_BYTEVECTOR:
+    case BYTEVECTOR_SLICE:
+      out_counted(out, 'b', BYTES(obj), BVLEN(obj));
+      return;
+    case SYMBOL:
+      out_symbol(out, obj);
+      return;
+    case LAZY_SYMBOL:
+      out_byte(out, 'g');
+      return;
+    case PAIR:
+      out_byte(out, 'p');
+      fasl_encode(out, CAR(obj));
+      if(out->error) {
+	return;
+      }
+      obj = CDR(obj);
+      continue;
+    case VECTOR:{
+	long ii;
+	out_byte(out, 'v');
+	out_varint(out, VSIZE(obj));
+	for(ii = 0; ii < VSIZE(obj) && !out->error; ++ii) {
+	  fasl_encode(out, VARRAY(obj)[ii]);
+	}
+	return;
+      }
+    case HASH_TABLE:{
+	hashtab_iter_t iter;
+	out_byte(out, 'h');
+	out_varint(out, HTAB(obj)->count);
+	htb_iter_init(HTAB(obj), &iter);
+	while(iter.key != NULL && !out->error) {
+	  fasl_encode(out, iter.key);
+	  fasl_encode(out, iter.value);
+	  htb_iter_inc(&iter);
+	}
+	return;
+      }
+    case COMPILED_PROC:
+      fasl_encode_code(out, obj, 0);
+      return;
+    default:
+      out->error = "fasl cannot write procedures, ports or other "
+	"host objects";
+      return;
+    }
+  }
+}
+
+static void fasl_encode(fasl_out * out, object * obj) {
+  if(++out->depth > FASL_MAX_DEPTH) {
+    out->error = "fasl cannot write objects nested this deeply";
+  }
+  else {
+    fasl_encode_one(out, obj);
+  }
+  --out->depth;
+}
+
+/* encodes OBJ as one record. the caller frees out->data */
+static void fasl_begin(fasl_out * out, object * port) {
+  out->capacity = FASL_FLUSH;
+  out->length = 0;
+  out->data = malloc(out->capacity);
+  out->port = port;
+  out->labels = 0;
+  out->depth = 0;
+  out->error = NULL;
+  seen_init(&out->shared, WITH_VALUES);
+  seen_init(&out->symbols, WITH_VALUES);
+}
+
+static void fasl_record(fasl_out * out, object * obj, object * port) {
+  fasl_begin(out, port);
+  seen_table visited;
+  seen_init(&visited, WITHOUT_VALUES);
+  if(!fasl_scan(&visited, &out->shared, obj, 0)) {
+    out->error = "fasl cannot write objects nested this deeply";
+  }
+  seen_free(&visited);
+  out_bytes(out, "BSF", 3);
+  out_byte(out, FASL_VERSION);
+  if(!out->error) {
+    fasl_encode(out, obj);
+  }
+
+  seen_free(&out->shared);
+  seen_free(&out->symbols);
+}
+
+/* (fasl-write obj port) writes OBJ to an output or socket port */
+DEFUN1(fasl_write_proc) {
+  object *port = SECOND;
+  if(!is_output_port(port) && !is_socket_port(port)) {
+    return throw_message("fasl-write expects an object and output port");
+  }
+  if(is_socket_port(port) && !socket_port_is_open(port)) {
+    return throw_message("fasl-write: the socket port is closed");
+  }
+
+  fasl_out out;
+  fasl_record(&out, FIRST, port);
+  if(out.error == NULL) {
+    out_flush(&out);
+  }
+  free(out.data);
+  return out.error ? throw_message("%s", out.error) : g->true;
+}
+
+/* (fasl-encode obj [failure]) is the record for OBJ as a bytevector.
+ * FAILURE, when given, is returned rather than an error for objects
+ * fasl cannot write */
+DEFUN1(fasl_encode_proc) {
+  fasl_out out;
+  fasl_record(&out, FIRST, NULL);
+  if(out.error) {
+    free(out.data);
+    return n_args > 1 ? SECOND : throw_message("%s", out.error);
+  }
+  object *result = make_bytevector(out.length);
+  memcpy(BYTES(result), out.data, out.length);
+  free(out.data);
+  return result;
+}
+
+/* (fasl-code-hash proc) hashes the code of a compiled procedure or
+ * macro as fasl would write it, leaving out what it closes over, or is
+ * #f if that code cannot be written. load keys its cache on the
+ * macros a file was expanded with this way. */
+DEFUN1(fasl_code_hash_proc) {
+  if(!is_compiled_proc(FIRST) && !is_compiled_syntax_proc(FIRST)) {
+    return throw_message("fasl-code-hash expects a compiled procedure");
+  }
+  fasl_out out;
+  fasl_begin(&out, NULL);
+  seen_table visited;
+  seen_init(&visited, WITHOUT_VALUES);
+  if(!fasl_scan_code(&visited, &out.shared, FIRST, 0)) {
+    out.error = "fasl cannot write objects nested this deeply";
+  }
+  seen_free(&visited);
+  if(!out.error) {
+    fasl_encode_code(&out, FIRST, 1);
+  }
+  seen_free(&out.shared);
+  seen_free(&out.symbols);
+
+  unsigned long hash = 14695981039346656037UL;
+  long ii;
+  for(ii = 0; ii < out.length; ++ii) {
+    hash = (hash ^ (unsigned char)out.data[ii]) * 1099511628211UL;
+  }
+  free(out.data);
+  return out.error ? g->false : make_fixnum((long)(hash >> 2));
+}
+
+/* the decoder reads straight from memory or a stdio stream */
+typedef struct fasl_in {
+  const unsigned char *base;
+  long pos;
+  long end;
+  FILE *stream;
+  object **labels;
+  long label_count;
+  long label_capacity;
+  object **symbols;
+  long symbol_count;
+  long symbol_capacity;
+  char *scratch;
+  long scratch_size;
+  long depth;
+  char *error;
+} fasl_in;
+
+static int in_byte(fasl_in * in) {
+  if(in->stream) {
+    return getc(in->stream);
+  }
+  return in->pos < in->end ? in->base[in->pos++] : -1;
+}
+
+/* how many bytes of input are left at most */
+static long in_remaining(fasl_in * in) {
+  struct stat st;
+  if(in->stream == NULL) {
+    return in->end - in->pos;
+  }
+  if(fstat(fileno(in->stream), &st) == 0 && S_ISREG(st.st_mode)) {
+    long pos = ftell(in->stream);
+    return pos < 0 || pos > st.st_size ? 0 : st.st_size - pos;
+  }
+  return FASL_STREAM_LIMIT;
+}
+
+/* points *dst at N bytes of input, or returns 0 if they are not all
+ * there */
+static int in_bytes(fasl_in * in, long n, const char **dst) {
+  if(n < 0 || n > in_remaining(in)) {
+    return 0;
+  }
+  if(in->stream == NULL) {
+    *dst = (const char *)in->base + in->pos;
+    in->pos += n;
+    return 1;
+  }
+  if(n > in->scratch_size) {
+    char *scratch = realloc(in->scratch, n);
+    if(scratch == NULL) {
+      return 0;
+    }
+    in->scratch = scratch;
+    in->scratch_size = n;
+  }
+  *dst = in->scratch;
+  return (long)fread(in->scratch, 1, n, in->stream) == n;
+}
+
+static long in_varint(fasl_in * in) {
+  unsigned long value = 0;
+  int shift = 0;
+  for(;;) {
+    int byte = in_byte(in);
+    if(byte < 0 || shift > 63) {
+      in->error = "fasl record is truncated";
+      return 0;
+    }
+    value |= (unsigned long)(byte & 0x7f) << shift;
+    if(byte < 0x80) {
+      return value;
+    }
+    shift += 7;
+  }
+}
+
+/* reads the number of items to follow, each of which takes at least
+ * SIZE bytes, so a corrupt count fails here rather than allocating for
+ * items that are not there */
+static long in_count(fasl_in * in, long size) {
+  long n = in_varint(in);
+  if(in->error) {
+    return 0;
+  }
+  if(n < 0 || n > in_remaining(in) / size) {
+    in->error = "fasl record has a bad length";
+    return 0;
+  }
+  return n;
+}
+
+static void *in_push(void *array, long *count, long *capacity,
+		     object * obj) {
+  object **items = array;
+  if(*count == *capacity) {
+    *capacity = *capacity ? *capacity * 2 : 64;
+    items = realloc(items, *capacity * sizeof(object *));
+  }
+  items[(*count)++] = obj;
+  return items;
+}
+
+static void fasl_decode(fasl_in * in, object ** slot);
+
+/* code from a file runs without the checks the compiler makes, so
+ * every constant, global and lambda an instruction refers to has to
+ * be there and every jump has to land on an instruction */
+static int code_valid(void **codes, long n, object * consts) {
+  long ii;
+  if(n == 0) {
+    return 0;
+  }
+  for(ii = 0; ii < n; ii += 2) {
+    long operands = (long)codes[ii + 1];
+    long index = operands >> 16;
+    if(operands < 0) {
+      return 0;
+    }
+    switch (opcode_operand(bytecode_opcode(codes[ii]))) {
+    case OPERAND_CONST:
+      if(index >= VSIZE(consts)) {
+	return 0;
+      }
+      break;
+    case OPERAND_GLOBAL:
+      if(index >= VSIZE(consts) || !is_symbol(VARRAY(consts)[index])) {
+	return 0;
+      }
+      break;
+    case OPERAND_CODE:
+      if(index >= VSIZE(consts) || !is_compiled_proc(VARRAY(consts)[index])) {
+	return 0;
+      }
+      break;
+    case OPERAND_JUMP:
+      if(index * 2 >= n) {
+	return 0;
+      }
+      break;
+    }
+  }
+  return 1;
+}
+
+/* compiled code comes back with its opcodes as this process numbers
+ * them and with an empty environment */
+static void fasl_decode_code(fasl_in * in, object ** slot) {
+  long n = in_count(in, 1);
+  long ii;
+  if(in->error) {
+    return;
+  }
+  if(n % 2 != 0) {
+    in->error = "fasl record has bad code";
+    return;
+  }
+
+  void **codes = MALLOC((n ? n : 1) * sizeof(void *));
+  object *code = make_alien(codes, g->free_ptr_fn);
+  object *consts = g->empty_vector;
+  push_root(&code);
+  push_root(&consts);
+  for(ii = 0; ii < n && !in->error; ii += 2) {
+    int opcode = in_byte(in);
+    unsigned long zigzag = in_varint(in);
+    codes[ii] = opcode_bytecode(opcode);
+    codes[ii + 1] = (void *)((long)(zigzag >> 1) ^ -(long)(zigzag & 1));
+    if(codes[ii] == NULL && !in->error) {
+      in->error = "fasl record has an unknown opcode";
+    }
+  }
+
+  long count = in->error ? 0 : in_count(in, 1);
+  if(count > 0 && !in->error) {
+    consts = make_vector(g->empty_list, count);
+  }
+  for(ii = 0; ii < count && !in->error; ++ii) {
+    fasl_decode(in, &VARRAY(consts)[ii]);
+  }
+
+  if(!in->error && !code_valid(codes, n, consts)) {
+    in->error = "fasl record has bad code";
+  }
+  if(!in->error) {
+    object *bytecode = cons(consts, g->empty_list);
+    push_root(&bytecode);
+    bytecode = cons(code, bytecode);
+    object *length = make_fixnum(n);
+    push_root(&length);
+    bytecode = cons(length, bytecode);
+    *slot = make_compiled_proc(bytecode, g->empty_list);
+    pop_root(&length);
+    pop_root(&bytecode);
+  }
+  pop_root(&consts);
+  pop_root(&code);
+}
+
+/* decodes one object into *SLOT. containers are stored and labelled
+ * before their contents are read so references back to them work, and
+ * everything hangs off the rooted result as it is built */
+static void fasl_decode_one(fasl_in * in, object ** slot) {
+  for(;;) {
+    int tag = in_byte(in);
+    int define = 0;
+    object *obj;
+    const char *bytes;
+    long n;
+
+    if(tag == '=') {
+      define = 1;
+      tag = in_byte(in);
+    }
+
+    switch (tag) {
+    case 'n':
+      *slot = g->empty_list;
+      return;
+    case 't':
+      *slot = g->true;
+      return;
+    case 'f':
+      *slot = g->false;
+      return;
+    case 'e':
+      *slot = g->eof_object;
+      return;
+    case 'i':{
+	unsigned long zigzag = in_varint(in);
+	*slot = make_fixnum((long)(zigzag >> 1) ^ -(long)(zigzag & 1));
+	return;
+      }
+    case 'd':{
+	uint64_t bits = 0;
+	double value;
+	int ii;
+	if(!in_bytes(in, 8, &bytes)) {
+	  break;
+	}
+	for(ii = 0; ii < 8; ++ii) {
+	  bits |= (uint64_t) (unsigned char)bytes[ii] << (8 * ii);
+	}
+	memcpy(&value, &bits, 8);
+	*slot = make_real(value);
+	return;
+      }
+    case 'c':
+      n = in_byte(in);
+      if(n < 0) {
+	break;
+      }
+      *slot = make_character(n);
+      return;
+    case 's':
+    case 'b':
+    case 'y':
+      n = in_count(in, 1);
+      if(in->error) {
+	return;
+      }
+      if(!in_bytes(in, n, &bytes)) {
+	break;
+      }
+      if(tag == 'y') {
+	obj = make_symbol_n(bytes, n);
+	if(n > 0 && bytes[0] == ':') {
+	  /* keywords evaluate to themselves, as when read */
+	  push_root(&obj);
+	  vm_definer(SYMBOL(obj), obj);
+	  pop_root(&obj);
+	}
+	in->symbols = in_push(in->symbols, &in->symbol_count,
+			      &in->symbol_capacity, obj);
+	*slot = obj;
+	return;
+      }
+      if(tag == 's') {
+	obj = make_counted_string((char *)bytes, n);
+      }
+      else {
+	obj = make_bytevector(n);
+	memcpy(BYTES(obj), bytes, n);
+      }
+      *slot = obj;
+      if(define) {
+	in->labels = in_push(in->labels, &in->label_count,
+			     &in->label_capacity, obj);
+      }
+      return;
+    case 'Y':
+      n = in_varint(in);
+      if(in->error || n < 0 || n >= in->symbol_count) {
+	in->error = "fasl record has a bad symbol reference";
+	return;
+      }
+      *slot = in->symbols[n];
+      return;
+    case 'g':
+      *slot = make_uninterned_symbol();
+      if(define) {
+	in->labels = in_push(in->labels, &in->label_count,
+			     &in->label_capacity, *slot);
+      }
+      return;
+    case '@':
+      n = in_varint(in);
+      if(in->error || n < 0 || n >= in->label_count) {
+	in->error = "fasl record has a bad shared reference";
+	return;
+      }
+      *slot = in->labels[n];
+      return;
+    case 'p':
+      obj = cons(g->empty_list, g->empty_list);
+      *slot = obj;
+      if(define) {
+	in->labels = in_push(in->labels, &in->label_count,
+			     &in->label_capacity, obj);
+      }
+      fasl_decode(in, &CAR(obj));
+      if(in->error) {
+	return;
+      }
+      slot = &CDR(obj);
+      continue;
+    case 'v':{
+	long ii;
+	n = in_count(in, 1);
+	if(in->error) {
+	  return;
+	}
+	obj = n ? make_vector(g->empty_list, n) : g->empty_vector;
+	*slot = obj;
+	if(define) {
+	  in->labels = in_push(in->labels, &in->label_count,
+			       &in->label_capacity, obj);
+	}
+	for(ii = 0; ii < n && !in->error; ++ii) {
+	  fasl_decode(in, &VARRAY(obj)[ii]);
+	}
+	return;
+      }
+    case 'h':{
+	long ii;
+	n = in_count(in, 2);
+	if(in->error) {
+	  return;
+	}
+	obj = make_hashtab(n < 31 ? 31 : n | 1);
+	*slot = obj;
+	if(define) {
+	  in->labels = in_push(in->labels, &in->label_count,
+			       &in->label_capacity, obj);
+	}
+	object *key = g->empty_list;
+	object *value = g->empty_list;
+	push_root(&key);
+	push_root(&value);
+	for(ii = 0; ii < n && !in->error; ++ii) {
+	  fasl_decode(in, &key);
+	  if(!in->error) {
+	    fasl_decode(in, &value);
+	  }
+	  if(!in->error) {
+	    set_hashtab(obj, key, value);
+	  }
+	}
+	pop_root(&value);
+	pop_root(&key);
+	return;
+      }
+    case 'k':
+      fasl_decode_code(in, slot);
+      return;
+    default:
+      if(tag < 0) {
+	in->error = "fasl record is truncated";
+      }
+      else {
+	in->error = "fasl record has an unknown tag";
+      }
+      return;
+    }
+
+    /* the cases that break ran out of input */
+    in->error = "fasl record is truncated";
+    return;
+  }
+}
+
+static void fasl_decode(fasl_in * in, object ** slot) {
+  if(++in->depth > FASL_MAX_DEPTH) {
+    in->error = "fasl record nests too deeply";
+  }
+  else {
+    fasl_decode_one(in, slot);
+  }
+  --in->depth;
+}
+
+/* decodes the record at the current position, eof if there is none */
+static object *fasl_read_record(fasl_in * in) {
+  const char *magic;
+  in->labels = NULL;
+  in->label_count = in->label_capacity = 0;
+  in->symbols = NULL;
+  in->symbol_count = in->symbol_capacity = 0;
+  in->scratch = NULL;
+  in->scratch_size = 0;
+  in->depth = 0;
+  in->error = NULL;
+
+  int first = in_byte(in);
+  if(first < 0) {
+    return g->eof_object;
+  }
+  if(first != 'B' || !in_bytes(in, 2, &magic) ||
+     magic[0] != 'S' || magic[1] != 'F') {
+    free(in->scratch);
+    return throw_message("not a fasl record");
+  }
+  int version = in_byte(in);
+  if(version != FASL_VERSION) {
+    free(in->scratch);
+    return throw_message("fasl record is version %d, expected %d",
+			 version, FASL_VERSION);
+  }
+
+  object *result = g->empty_list;
+  push_root(&result);
+  fasl_decode(in, &result);
+  pop_root(&result);
+
+  free(in->labels);
+  free(in->symbols);
+  free(in->scratch);
+  return in->error ? throw_message("%s", in->error) : result;
+}
+
+/* (fasl-read port) reads the next record from an input port, or
+ * returns eof at the end */
+DEFUN1(fasl_read_proc) {
+  if(!is_input_port(FIRST)) {
+    return throw_message("fasl-read expects an input port");
+  }
+  fasl_in in;
+  in.stream = INPUT(FIRST);
+  return fasl_read_record(&in);
+}
+
+/* (fasl-decode bytevector [start]) decodes the record at START,
+ * returning it consed onto the position after it, or eof */
+DEFUN1(fasl_decode_proc) {
+  if(!is_bytevector(FIRST) || (n_args > 1 && !is_fixnum(SECOND))) {
+    return throw_message("fasl-decode expects a bytevector and start");
+  }
+  fasl_in in;
+  in.stream = NULL;
+  in.base = BYTES(FIRST);
+  in.end = BVLEN(FIRST);
+  in.pos = n_args > 1 ? LONG(SECOND) : 0;
+  if(in.pos < 0 || in.pos > in.end) {
+    return throw_message("fasl-decode start out of range");
+  }
+
+  object *result = fasl_read_record(&in);
+  if(is_primitive_exception(result) || result == g->eof_object) {
+    return result;
+  }
+  push_root(&result);
+  object *next = make_fixnum(in.pos);
+  push_root(&next);
+  result = cons(result, next);
+  pop_root(&next);
+  pop_root(&result);
+  return result;
+}
+
+void init_fasl(definer defn) {
+#define add_procedure(scheme_name, c_name)			\
+  defn(scheme_name,						\
+       make_primitive_proc(c_name))
+
+  add_procedure("fasl-write", fasl_write_proc);
+  add_procedure("fasl-read", fasl_read_proc);
+  add_procedure("fasl-encode", fasl_encode_proc);
+  add_procedure("fasl-decode", fasl_decode_proc);
+  add_procedure("fasl-code-hash", fasl_code_hash_proc);
+}
@@ -279,18 +279,56 @@ DEFUN1(ffi_address_of) {
 }
 
 DEFUN1(string_to_alien) {
-  char *str = STRING(FIRST);
-
-  long length = strlen(str) + 1;
+  long length = STRLEN(FIRST) + 1;
   char *copy = MALLOC(length);
-  int ii = 0;
-  for(; ii < length + 1; ++ii) {
-    copy[ii] = str[ii];
-  }
+  memcpy(copy, STRING(FIRST), length);
 
   return make_alien(copy, g->free_ptr_fn);
 }
 
+/* the alien points into the bytevector's own storage, so it is only
+   valid while the bytevector is reachable */
+DEFUN1(bytevector_to_alien) {
+  long offset = n_args > 1 && is_fixnum(SECOND) ? LONG(SECOND) : 0;
+  if(!is_bytevector(FIRST) || (n_args > 1 && !is_fixnum(SECOND))
+     || offset < 0 || offset > BVLEN(FIRST)) {
+    return throw_message("ffi:%%bytevector-to-alien expects a bytevector "
+			 "and an offset within it");
+  }
+  return make_alien(BYTES(FIRST) + offset, g->empty_list);
+}
+
+/* the alien and the offset into it for copying bytes in or out. aliens
+ * don't know their size, so only the bytevector side is bounded */
+static char *alien_offset(object * alien, object * offset) {
+  if(!is_alien(alien) || ALIEN_PTR(alien) == NULL || !is_fixnum(offset)
+     || LONG(offset) < 0) {
+    return NULL;
+  }
+  return (char *)ALIEN_PTR(alien) + LONG(offset);
+}
+
+DEFUN1(alien_to_bytevector) {
+  char *ptr = alien_offset(FIRST, SECOND);
+  if(ptr == NULL || !is_fixnum(THIRD) || LONG(THIRD) < 0) {
+    return throw_message("ffi:%%alien-to-bytevector expects an alien, "
+			 "an offset and a count");
+  }
+  object *bv = make_bytevector(LONG(THIRD));
+  memcpy(BYTES(bv), ptr, BVLEN(bv));
+  return bv;
+}
+
+DEFUN1(bytevector_into_alien) {
+  char *ptr = alien_offset(FIRST, SECOND);
+  if(ptr == NULL || !is_bytevector(THIRD)) {
+    return throw_message("ffi:%%pack-bytevector expects an alien, "
+			 "an offset and a bytevector");
+  }
+  memcpy(ptr, BYTES(THIRD), BVLEN(THIRD));
+  return FIRST;
+}
+
 DEFUN1(alien_to_string) {
   char *str = ALIEN_PTR(FIRST);
   return make_string(str);
@@ -347,6 +385,9 @@ void init_ffi(definer defn) {
 
   add_procedure("ffi:string-to-alien", string_to_alien);
   add_procedure("ffi:alien-to-string", alien_to_string);
+  add_procedure("ffi:%bytevector-to-alien", bytevector_to_alien);
+  add_procedure("ffi:%alien-to-bytevector", alien_to_bytevector);
+  add_procedure("ffi:%pack-bytevector", bytevector_into_alien);
   add_procedure("ffi:int-to-alien", int_to_alien);
   add_procedure("ffi:alien-to-int", alien_to_int);
   add_procedure("ffi:stream-to-alien", stream_to_alien);
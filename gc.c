@@ -17,12 +17,18 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <time.h>
+#include <sys/resource.h>
 
 #include "types.h"
 #include "hashtab.h"
 #include "pool.h"
 #include "gc.h"
 #include "ffi.h"
+#include "bytevector.h"
+#include "socket.h"
+#include "event.h"
+#include "port.h"
 
 /* enable gc debuging by defining
  * DEBUG_GC
@@ -56,10 +62,366 @@ void *xmalloc(size_t size) {
   return obj;
 }
 
+/* zeroes the free pool memory and the data of the free heap objects
+ * after a collection, so stale garbage isn't written into images */
+static void clear_free_memory(void) {
+  object *obj;
+  pool_free_size(g->global_pool, 1);
+  for(obj = g->Next_Free_Object; obj != NULL; obj = obj->next) {
+    memset(&obj->data, 0, sizeof(obj->data));
+  }
+}
+
+/* zeroes the rest of the last word of an allocation holding raw
+ * bytes. it can still hold part of a pointer from whatever had the
+ * memory before, and moving an image would relocate that word along
+ * with the bytes sharing it */
+static void clear_slack(void *p, size_t used) {
+  size_t end = (used + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+  memset((char *)p + used, 0, end - used);
+}
+
+static void clear_slack_words(doubly_linked_list * list, object * stop) {
+  object *obj;
+  for(obj = list->head; obj != stop; obj = obj->next) {
+    switch (obj->type) {
+    case STRING:
+      clear_slack(obj->data.string.value, STRLEN(obj) + 1);
+      break;
+    case SYMBOL:
+      clear_slack(SYMBOL(obj), strlen(SYMBOL(obj)) + 1);
+      break;
+    case BYTEVECTOR:
+    case S8VECTOR:
+    case U16VECTOR:
+    case S16VECTOR:
+    case U32VECTOR:
+    case S32VECTOR:
+    case U64VECTOR:
+    case S64VECTOR:
+    case F32VECTOR:
+    case F64VECTOR:
+      clear_slack(BYTES(obj), BVLEN(obj) * hvector_element_size(obj->type));
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+/* counts the words of BYTES bytes from START that look like pointers
+ * into the pool, adding them to WORDS when it's given */
+static long raw_words(void *start, size_t bytes, void **words, long n) {
+  uintptr_t *word = start;
+  uintptr_t *end = word + (bytes + sizeof(void *) - 1) / sizeof(void *);
+  for(; word < end; ++word) {
+    if(pool_holds(g->global_pool, *word)) {
+      if(words != NULL)
+	words[n] = word;
+      ++n;
+    }
+  }
+  return n;
+}
+
+/* the numbers, lengths and bytes the heap objects hold, as far as
+ * they look like pointers. moving an image would take them for ones */
+static long find_raw_words(doubly_linked_list * list, object * stop,
+			   void **words, long n) {
+  object *obj;
+  for(obj = list->head; obj != stop; obj = obj->next) {
+    switch (obj->type) {
+    case FIXNUM:
+      n = raw_words(&LONG(obj), sizeof(long), words, n);
+      break;
+    case FLOATNUM:
+      n = raw_words(&DOUBLE(obj), sizeof(double), words, n);
+      break;
+    case STRING:
+      n = raw_words(STRING(obj), STRLEN(obj) + 1, words, n);
+      n = raw_words(&STRLEN(obj), sizeof(long), words, n);
+      break;
+    case SYMBOL:
+      n = raw_words(SYMBOL(obj), strlen(SYMBOL(obj)) + 1, words, n);
+      break;
+    case VECTOR:
+      n = raw_words(&VSIZE(obj), sizeof(long), words, n);
+      break;
+    case STRING_BUILDER:
+      n = raw_words(&BUILDER_LENGTH(obj), sizeof(long), words, n);
+      break;
+    case BYTEVECTOR:
+    case S8VECTOR:
+    case U16VECTOR:
+    case S16VECTOR:
+    case U32VECTOR:
+    case S32VECTOR:
+    case U64VECTOR:
+    case S64VECTOR:
+    case F32VECTOR:
+    case F64VECTOR:
+      n = raw_words(BYTES(obj), BVLEN(obj) * hvector_element_size(obj->type),
+		    words, n);
+      n = raw_words(&BVLEN(obj), sizeof(long), words, n);
+      break;
+    case MAPPED_BYTEVECTOR:
+    case BYTEVECTOR_SLICE:
+      n = raw_words(&BVLEN(obj), sizeof(long), words, n);
+      break;
+    default:
+      break;
+    }
+  }
+  return n;
+}
+
+/* saves the raw words that look like pointers with the pool, so they
+ * are left alone when the image is moved. storing them can grow the
+ * pool, which takes in more addresses, so then they're found again */
+static void keep_raw_words(void) {
+  int r;
+  do {
+    long n = find_raw_words(&g->Old_Heap_Objects, NULL, NULL, 0);
+    n = find_raw_words(&g->Active_Heap_Objects, g->Next_Free_Object, NULL, n);
+    void **words = xmalloc((n ? n : 1) * sizeof(void *));
+    n = find_raw_words(&g->Old_Heap_Objects, NULL, words, 0);
+    n = find_raw_words(&g->Active_Heap_Objects, g->Next_Free_Object, words,
+		       n);
+    r = pool_set_raw(g->global_pool, words, n);
+    free(words);
+  } while(r < 0);
+}
+
+static void thaw_heap(void);
+
 int save_image(char *filename, int compress) {
+  thaw_heap();
+  clear_free_memory();
+  clear_slack_words(&g->Old_Heap_Objects, NULL);
+  clear_slack_words(&g->Active_Heap_Objects, g->Next_Free_Object);
+  keep_raw_words();
   return pool_dump(g->global_pool, filename, compress);
 }
 
+/* bytes of the pool holding live data, right after a collection */
+static long heap_live_size(void) {
+  long free_objects = baker_collect();
+  return pool_size(g->global_pool) - pool_free_size(g->global_pool, 0) -
+    free_objects * sizeof(object);
+}
+
+/* tree shaking. an image starts from the roots in the global state
+ * alone, and from there the program can only name the globals
+ * reachable without passing through the global environment itself,
+ * which would reach everything. the set of objects seen is malloc()ed
+ * so tracing doesn't allocate from the heap being traced */
+typedef struct shake_set {
+  object **keys;
+  long size;
+  long count;
+} shake_set;
+
+static int shake_seen(shake_set * set, object * obj) {
+  unsigned long ii = (((unsigned long)obj >> 3) * 2654435761UL) &
+    (set->size - 1);
+  while(set->keys[ii] != NULL) {
+    if(set->keys[ii] == obj) {
+      return 1;
+    }
+    ii = (ii + 1) & (set->size - 1);
+  }
+  return 0;
+}
+
+static void shake_add(shake_set * set, object * obj) {
+  long ii;
+  if(set->count * 2 >= set->size) {
+    shake_set bigger = { xmalloc(sizeof(object *) * set->size * 2),
+      set->size * 2, 0
+    };
+    memset(bigger.keys, 0, sizeof(object *) * bigger.size);
+    for(ii = 0; ii < set->size; ++ii) {
+      if(set->keys[ii] != NULL) {
+	shake_add(&bigger, set->keys[ii]);
+      }
+    }
+    free(set->keys);
+    *set = bigger;
+  }
+  ii = (((unsigned long)obj >> 3) * 2654435761UL) & (set->size - 1);
+  while(set->keys[ii] != NULL) {
+    ii = (ii + 1) & (set->size - 1);
+  }
+  set->keys[ii] = obj;
+  set->count++;
+}
+
+typedef struct shake_stack {
+  object **objs;
+  long top;
+  long size;
+} shake_stack;
+
+static void shake_push(shake_stack * todo, object * obj) {
+  if(obj == NULL || is_small_fixnum(obj)) {
+    return;
+  }
+  if(todo->top == todo->size) {
+    todo->size *= 2;
+    todo->objs = realloc(todo->objs, sizeof(object *) * todo->size);
+  }
+  todo->objs[todo->top++] = obj;
+}
+
+static void shake_trace(shake_set * seen, shake_stack * todo) {
+  hashtab_iter_t iter;
+  long ii;
+  while(todo->top > 0) {
+    object *obj = todo->objs[--todo->top];
+    if(shake_seen(seen, obj)) {
+      continue;
+    }
+    shake_add(seen, obj);
+
+    switch (obj->type) {
+    case SYMBOL:
+      /* naming a global keeps its binding */
+      shake_push(todo, get_hashtab(g->vm_env, obj, NULL));
+      break;
+    case PAIR:
+      shake_push(todo, CAR(obj));
+      shake_push(todo, CDR(obj));
+      break;
+    case COMPOUND_PROC:
+    case SYNTAX_PROC:
+      shake_push(todo, COMPOUND_PARMS_AND_ENV(obj));
+      shake_push(todo, COMPOUND_BODY(obj));
+      break;
+    case VECTOR:
+      for(ii = 0; ii < VSIZE(obj); ++ii) {
+	shake_push(todo, VARRAY(obj)[ii]);
+      }
+      break;
+    case COMPILED_PROC:
+    case COMPILED_SYNTAX_PROC:
+      shake_push(todo, BYTECODE(obj));
+      shake_push(todo, CENV(obj));
+      break;
+    case META_PROC:
+      shake_push(todo, METAPROC(obj));
+      shake_push(todo, METADATA(obj));
+      break;
+    case BYTEVECTOR_SLICE:
+      shake_push(todo, mapped_bytevector_owner(obj));
+      break;
+    case STRING_BUILDER:
+      shake_push(todo, BUILDER_STORAGE(obj));
+      break;
+    case HASH_TABLE:
+      if(obj == g->vm_env) {
+	break;
+      }
+      htb_iter_init(HTAB(obj), &iter);
+      while(iter.key != NULL) {
+	shake_push(todo, iter.key);
+	shake_push(todo, iter.value);
+	htb_iter_inc(&iter);
+      }
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+/* the reader macro tables hold handlers like #. that evaluate, so
+ * they are only traced when the reader itself is reachable */
+static int shake_reader(shake_set * seen, shake_stack * todo) {
+  object *reader = get_hashtab(g->vm_env, make_symbol("%read-buffer"), NULL);
+  if(reader == NULL || !shake_seen(seen, reader)) {
+    return 0;
+  }
+  shake_push(todo, g->reader_macros);
+  shake_push(todo, g->reader_dispatch);
+  shake_trace(seen, todo);
+  return 1;
+}
+
+static void clear_reader_table(object * table) {
+  long ii;
+  for(ii = 0; ii < VSIZE(table); ++ii) {
+    VARRAY(table)[ii] = g->false;
+  }
+}
+
+/* unbinds every global that nothing live refers to, apart from the
+ * symbols in KEEP and those the runtime looks up by name, returning
+ * the list of symbols unbound. code still holding the compiler may
+ * expand any macro, so then the macros all stay */
+static object *shake_globals(object * keep) {
+  shake_set seen = { xmalloc(sizeof(object *) * 65536), 65536, 0 };
+  shake_stack todo = { xmalloc(sizeof(object *) * 1024), 0, 1024 };
+  hashtab_iter_t iter;
+  long ii;
+
+  memset(seen.keys, 0, sizeof(object *) * seen.size);
+  for(ii = 0; ii < g->Root_Objects->top; ++ii) {
+    object **root = g->Root_Objects->objs[ii];
+    if(root != &g->vm_env && root != &g->symbol_table &&
+       root != &g->reader_macros && root != &g->reader_dispatch) {
+      shake_push(&todo, *root);
+    }
+  }
+  shake_push(&todo, keep);
+  shake_push(&todo, make_symbol("*image-start*"));
+  shake_push(&todo, make_symbol("*load-path*"));
+  shake_push(&todo, make_symbol("*args*"));
+  shake_push(&todo, g->stdin_symbol);
+  shake_push(&todo, g->stdout_symbol);
+  shake_push(&todo, g->stderr_symbol);
+  shake_trace(&seen, &todo);
+  int reader = shake_reader(&seen, &todo);
+
+  object *compiler = get_hashtab(g->vm_env, make_symbol("compiler"), NULL);
+  if(compiler != NULL && shake_seen(&seen, compiler)) {
+    htb_iter_init(HTAB(g->vm_env), &iter);
+    while(iter.key != NULL) {
+      object *slot = iter.value;
+      if(!is_small_fixnum(CDR(slot)) &&
+	 CDR(slot)->type == COMPILED_SYNTAX_PROC) {
+	shake_push(&todo, slot);
+      }
+      htb_iter_inc(&iter);
+    }
+    shake_trace(&seen, &todo);
+    reader = shake_reader(&seen, &todo);
+  }
+
+  /* nothing above allocated, but consing the result will */
+  object *removed = g->empty_list;
+  push_root(&removed);
+  htb_iter_init(HTAB(g->vm_env), &iter);
+  while(iter.key != NULL) {
+    if(!shake_seen(&seen, iter.value)) {
+      removed = cons(iter.key, removed);
+    }
+    htb_iter_inc(&iter);
+  }
+  free(seen.keys);
+  free(todo.objs);
+  if(!reader) {
+    clear_reader_table(g->reader_macros);
+    clear_reader_table(g->reader_dispatch);
+  }
+
+  object *next;
+  for(next = removed; next != g->empty_list; next = CDR(next)) {
+    remkey_hashtab(g->vm_env, CAR(next));
+  }
+  pop_root(&removed);
+  return removed;
+}
+
 void patch_object(object * sym, object * new_value) {
   /* find what the symbol points to */
   object *old_val = get_hashtab(g->vm_env, sym, NULL);
@@ -74,13 +436,70 @@ void patch_object(object * sym, object * new_value) {
   memcpy(&(old_val->data), &(new_value->data), sizeof(new_value->data));
 }
 
+/* hash tables hash their keys by address, so an image loaded
+ * somewhere other than where it was saved needs them rebucketed. each
+ * one is waiting to be finalized, which saves walking the heap */
+static void rehash_tables(void) {
+  long ii;
+  for(ii = 0; ii < g->Finalizable_Objects->top; ++ii) {
+    object *obj = g->Finalizable_Objects->objs[ii];
+    if(obj->type == HASH_TABLE)
+      htb_rehash(HTAB(obj));
+  }
+}
+
+static void freeze_heap(void);
+
 int load_image(char *filename, off_t offset) {
   g = pool_load(filename, offset);
   if(g == NULL)
     return -1;			/* Error. */
+  startup_trace("pool-load");
+  if(pool_relocation != 0) {
+    rehash_tables();
+    startup_trace("rehash-tables");
+  }
+  freeze_heap();
+  startup_trace("freeze-heap");
   return 0;
 }
 
+int startup_tracing = 0;
+
+static double ms_between(struct timeval *a, struct timeval *b) {
+  return (b->tv_sec - a->tv_sec) * 1e3 + (b->tv_usec - a->tv_usec) / 1e3;
+}
+
+void startup_trace(char *phase) {
+  static struct timespec start, last;
+  static struct rusage last_usage;
+  static int started = 0;
+  if(!startup_tracing)
+    return;
+
+  struct timespec now;
+  struct rusage usage;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  getrusage(RUSAGE_SELF, &usage);
+  if(started) {
+    double wall = (now.tv_sec - last.tv_sec) * 1e3 +
+      (now.tv_nsec - last.tv_nsec) / 1e6;
+    double total = (now.tv_sec - start.tv_sec) * 1e3 +
+      (now.tv_nsec - start.tv_nsec) / 1e6;
+    double cpu = ms_between(&last_usage.ru_utime, &usage.ru_utime) +
+      ms_between(&last_usage.ru_stime, &usage.ru_stime);
+    fprintf(stderr, "startup: %-24s %9.3f ms %9.3f ms cpu %6ld minor "
+	    "%4ld major faults %9.3f ms total\n", phase, wall, cpu,
+	    usage.ru_minflt - last_usage.ru_minflt,
+	    usage.ru_majflt - last_usage.ru_majflt, total);
+  } else {
+    start = now;
+    started = 1;
+  }
+  last = now;
+  last_usage = usage;
+}
+
 void throw_gc_va(char *msg, va_list args) {
   vfprintf(stderr, msg, args);
   exit(2);
@@ -321,6 +740,14 @@ void gc_init(void) {
   g->Finalizable_Objects = make_stack_set(400);
   g->Finalizable_Objects_Next = make_stack_set(400);
 
+  g->base_color = 0;
+  g->base_colors = 0;
+  g->Remembered_Objects = make_stack_set(400);
+  g->Base_Heap_Objects.head = NULL;
+  g->Base_Heap_Objects.tail = NULL;
+  g->Base_Heap_Objects.num_objects = 0;
+  g->Base_Free_Objects = g->Base_Heap_Objects;
+
   g->Active_Heap_Objects.head = NULL;
   g->Active_Heap_Objects.tail = NULL;
   g->Active_Heap_Objects.num_objects = 0;
@@ -386,81 +813,101 @@ void extend_heap(long extension) {
   debug_validate(&Active_Heap_Objects);
 }
 
-void move_reachable(object * root, doubly_linked_list * to_set) {
+/* marks whatever OBJ points to and moves it onto the head of the
+   to_set, where it waits to be scanned in turn */
+static void move_referents(object * obj, doubly_linked_list * to_set) {
   int ii;
   hashtab_iter_t htab_iter;
 
-  if(root == NULL)
-    return;
-  if(is_small_fixnum(root))
-    return;
-  if(root->color == g->current_color)
-    return;
-
-  /* mark this and move it into the to_set we will be building a queue
-     of objects to scan from the front and scanning in the prev
-     direction */
-  root->color = g->current_color;
-  move_object_to_head(root, &(g->Active_Heap_Objects), to_set);
-
-  object *scan_iter = to_set->head;
-
   /* we do the same thing a lot... make a macro! */
   object *temp;
 #define maybe_move(obj)							\
   do {									\
     temp = obj;								\
-    if(!is_small_fixnum(temp) && temp->color != g->current_color) {	\
+    if(!is_small_fixnum(temp) && temp->color != g->current_color &&	\
+       !is_frozen(temp)) {						\
       move_object_to_head(temp, &(g->Active_Heap_Objects), to_set);	\
       temp->color = g->current_color;					\
     }									\
   } while(0)
 
-  while(scan_iter != NULL) {
-    /* scan fields */
-    if(is_small_fixnum(scan_iter)) {
-      scan_iter = scan_iter->prev;
-      continue;
+  switch (obj->type) {
+  case PAIR:
+    maybe_move(CAR(obj));
+    maybe_move(CDR(obj));
+    break;
+  case COMPOUND_PROC:
+  case SYNTAX_PROC:
+    maybe_move(COMPOUND_PARMS_AND_ENV(obj));
+    maybe_move(COMPOUND_BODY(obj));
+    break;
+  case VECTOR:
+    for(ii = 0; ii < VSIZE(obj); ++ii) {
+      maybe_move(VARRAY(obj)[ii]);
+    }
+    break;
+  case COMPILED_PROC:
+  case COMPILED_SYNTAX_PROC:
+    maybe_move(BYTECODE(obj));
+    maybe_move(CENV(obj));
+    break;
+  case META_PROC:
+    maybe_move(METAPROC(obj));
+    maybe_move(METADATA(obj));
+    break;
+  case BYTEVECTOR_SLICE:
+    maybe_move(mapped_bytevector_owner(obj));
+    break;
+  case STRING_BUILDER:
+    maybe_move(BUILDER_STORAGE(obj));
+    break;
+  case HASH_TABLE:
+    htb_iter_init(HTAB(obj), &htab_iter);
+    while(htab_iter.key != NULL) {
+      maybe_move((object *) htab_iter.key);
+      maybe_move((object *) htab_iter.value);
+      htb_iter_inc(&htab_iter);
     }
+  default:
+    break;
+  }
+}
 
-    switch (scan_iter->type) {
-    case PAIR:
-      maybe_move(CAR(scan_iter));
-      maybe_move(CDR(scan_iter));
-      break;
-    case COMPOUND_PROC:
-    case SYNTAX_PROC:
-      maybe_move(COMPOUND_PARMS_AND_ENV(scan_iter));
-      maybe_move(COMPOUND_BODY(scan_iter));
-      break;
-    case VECTOR:
-      for(ii = 0; ii < VSIZE(scan_iter); ++ii) {
-	maybe_move(VARRAY(scan_iter)[ii]);
-      }
-      break;
-    case COMPILED_PROC:
-    case COMPILED_SYNTAX_PROC:
-      maybe_move(BYTECODE(scan_iter));
-      maybe_move(CENV(scan_iter));
-      break;
-    case META_PROC:
-      maybe_move(METAPROC(scan_iter));
-      maybe_move(METADATA(scan_iter));
-      break;
-    case HASH_TABLE:
-      htb_iter_init(HTAB(scan_iter), &htab_iter);
-      while(htab_iter.key != NULL) {
-	maybe_move((object *) htab_iter.key);
-	maybe_move((object *) htab_iter.value);
-	htb_iter_inc(&htab_iter);
-      }
-    default:
-      break;
+/* the to_set is a queue of objects to scan from the front, scanning
+   in the prev direction */
+static void move_queued(object * scan_iter, doubly_linked_list * to_set) {
+  while(scan_iter != NULL) {
+    /* scan fields */
+    if(!is_small_fixnum(scan_iter)) {
+      move_referents(scan_iter, to_set);
     }
     scan_iter = scan_iter->prev;
   }
 }
 
+void move_reachable(object * root, doubly_linked_list * to_set) {
+  if(root == NULL)
+    return;
+  if(is_small_fixnum(root))
+    return;
+  if(root->color == g->current_color || is_frozen(root))
+    return;
+
+  /* mark this and move it into the to_set we will be building a queue
+     of objects to scan */
+  root->color = g->current_color;
+  move_object_to_head(root, &(g->Active_Heap_Objects), to_set);
+  move_queued(to_set->head, to_set);
+}
+
+/* a remembered object stays where it is, frozen, and only what it
+   points to is moved */
+static void move_remembered(object * obj, doubly_linked_list * to_set) {
+  object *mark = to_set->head;
+  move_referents(obj, to_set);
+  move_queued(mark ? mark->prev : to_set->tail, to_set);
+}
+
 void finalize_object(object * head) {
   /* free any extra memory associated with this type */
   switch (head->type) {
@@ -470,6 +917,31 @@ void finalize_object(object * head) {
   case VECTOR:
     FREE(VARRAY(head));
     break;
+  case BYTEVECTOR:
+  case S8VECTOR:
+  case U16VECTOR:
+  case S16VECTOR:
+  case U32VECTOR:
+  case S32VECTOR:
+  case U64VECTOR:
+  case S64VECTOR:
+  case F32VECTOR:
+  case F64VECTOR:
+    FREE(BYTES(head));
+    break;
+  case MAPPED_BYTEVECTOR:
+    unmap_bytevector(head);
+    break;
+  case SOCKET_PORT:
+    free_socket_port(head);
+    break;
+  case EVENT_LOOP:
+    free_event_loop(head);
+    break;
+  case INPUT_PORT:
+  case OUTPUT_PORT:
+    finalize_port(head);
+    break;
   case HASH_TABLE:
     htb_destroy(HTAB(head));
     break;
@@ -481,23 +953,37 @@ void finalize_object(object * head) {
   }
 }
 
+/* the colors of frozen objects are never handed out */
+static void advance_color(void) {
+  do {
+    ++(g->current_color);
+  } while(is_frozen_color(g->current_color));
+}
+
 long baker_collect() {
   /* merge everything into one big heap */
   append_to_tail(&(g->Active_Heap_Objects), &(g->Old_Heap_Objects));
 
   /* move everything reachable from a root into the old set */
-  ++(g->current_color);
+  advance_color();
   int ii = 0;
   for(ii = 0; ii < g->Root_Objects->top; ++ii) {
     object **next = g->Root_Objects->objs[ii];
     move_reachable(*next, &(g->Old_Heap_Objects));
   }
 
+  /* frozen objects are reachable by definition, but the ones written
+     to since can lead to others that aren't frozen */
+  for(ii = 0; ii < g->Remembered_Objects->top; ++ii) {
+    move_remembered(g->Remembered_Objects->objs[ii],
+		    &(g->Old_Heap_Objects));
+  }
+
   /* now finalize anything that needs it */
   long idx = 0;
   for(idx = 0; idx < g->Finalizable_Objects->top; ++idx) {
     object *obj = g->Finalizable_Objects->objs[idx];
-    if(obj->color != g->current_color) {
+    if(obj->color != g->current_color && !is_frozen(obj)) {
       finalize_object(obj);
     }
     else {
@@ -511,7 +997,7 @@ long baker_collect() {
   g->Finalizable_Objects_Next = temp;
   clear_stack_set(g->Finalizable_Objects_Next);
 
-  ++(g->current_color);
+  advance_color();
 
   /* both sets should be valid */
   debug_validate(&Old_Heap_Objects);
@@ -563,3 +1049,124 @@ object *alloc_object(char needs_finalization) {
   return obj;
 }
 
+void finalize_when_collected(object * obj) {
+  stack_set_push(g->Finalizable_Objects, obj);
+}
+
+/* everything in a freshly loaded image is frozen, so the pages it
+ * was mapped from stay shared with every other process loading it.
+ * the live objects are set aside as they are, along with the free
+ * ones among them, and the heap starts over with nothing in it */
+static void freeze_heap(void) {
+  object *obj, *free = g->Next_Free_Object;
+  doubly_linked_list *active = &g->Active_Heap_Objects;
+  doubly_linked_list used = { NULL, NULL, 0 };
+
+  /* whatever was allocated since the last collection comes first */
+  if(free != active->head) {
+    used.head = active->head;
+    used.tail = free ? free->prev : active->tail;
+    for(obj = used.head; obj != free; obj = obj->next) {
+      ++used.num_objects;
+    }
+    used.tail->next = NULL;
+  }
+  if(free) {
+    free->prev = NULL;
+    g->Base_Free_Objects.head = free;
+    g->Base_Free_Objects.tail = active->tail;
+    g->Base_Free_Objects.num_objects = active->num_objects - used.num_objects;
+  }
+  active->head = active->tail = NULL;
+  active->num_objects = 0;
+  g->Next_Free_Object = NULL;
+  /* and grows again from small, it's all private memory */
+  g->Next_Heap_Extension = 1000;
+
+  append_to_tail(&(g->Old_Heap_Objects), &used);
+  append_to_tail(&(g->Base_Heap_Objects), &(g->Old_Heap_Objects));
+  clear_stack_set(g->Remembered_Objects);
+
+  /* nor is the free memory among them allocated from */
+  pool_seal(g->global_pool);
+
+  /* live objects are the last color marked and the one allocated */
+  g->base_color = g->current_color - 1;
+  g->base_colors = 3;
+  advance_color();
+}
+
+/* puts the frozen objects back in the heap, to be collected and saved
+ * like any other */
+static void thaw_heap(void) {
+  object *obj;
+  if(g->base_colors == 0)
+    return;
+
+  for(obj = g->Base_Heap_Objects.head; obj != NULL; obj = obj->next) {
+    obj->color = g->current_color;
+  }
+  append_to_tail(&(g->Old_Heap_Objects), &(g->Base_Heap_Objects));
+  if(g->Next_Free_Object == NULL) {
+    g->Next_Free_Object = g->Base_Free_Objects.head;
+  }
+  append_to_tail(&(g->Active_Heap_Objects), &(g->Base_Free_Objects));
+  clear_stack_set(g->Remembered_Objects);
+  pool_unseal(g->global_pool);
+  g->base_colors = 0;
+}
+
+void remember_object(object * obj) {
+  char remembered = g->base_color + g->base_colors - 1;
+  if(obj->color != remembered) {
+    obj->color = remembered;
+    stack_set_push(g->Remembered_Objects, obj);
+  }
+}
+
+/* keeps just the roots inside the global state, the ones an image is
+ * loaded with, so whatever only the running code holds is garbage.
+ * nothing can return to the vm afterwards */
+static void drop_stack_roots(void) {
+  long ii, top = 0;
+  for(ii = 0; ii < g->Root_Objects->top; ++ii) {
+    char *root = g->Root_Objects->objs[ii];
+    if(root >= (char *)g && root < (char *)(g + 1)) {
+      g->Root_Objects->objs[top++] = root;
+    }
+  }
+  g->Root_Objects->top = top;
+}
+
+/* saves an image holding only what *image-start* can reach, without
+ * docstrings. this wrecks the running process, so it is meant for a
+ * forked child. the live bytes before and after, the number of
+ * docstrings and then each global removed go to REPORT a line each */
+int save_shaken_image(char *filename, int compress, object * keep,
+		      FILE * report) {
+  thaw_heap();
+  long before = heap_live_size();
+  long docstrings = 0;
+  drop_stack_roots();
+  push_root(&keep);
+
+  object *docs = get_hashtab(g->vm_env, make_symbol("*documentation*"), NULL);
+  if(docs != NULL) {
+    object *doc;
+    for(doc = CDR(docs); is_pair(doc); doc = CDR(doc)) {
+      ++docstrings;
+    }
+    CDR(docs) = g->empty_list;
+  }
+
+  object *removed = shake_globals(keep);
+  push_root(&removed);
+  long after = heap_live_size();
+  fprintf(report, "%ld %ld %ld\n", before, after, docstrings);
+  for(; removed != g->empty_list; removed = CDR(removed)) {
+    fprintf(report, "%s\n", SYMBOL(CAR(removed)));
+  }
+  pop_root(&removed);
+  pop_root(&keep);
+  return save_image(filename, compress);
+}
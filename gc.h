@@ -36,7 +36,15 @@ void FREE(void *p);       /* mmap()ed */
 
 int save_image(char *filename, int compress);
 int load_image(char *filename, off_t offset);
+
+/* With startup_tracing set, startup_trace() reports to stderr the
+ * time and page faults taken since its last call, naming the phase
+ * that just finished. The first call only starts the clock. */
+extern int startup_tracing;
+void startup_trace(char *phase);
 void patch_object(object *sym, object *new_value);
+int save_shaken_image(char *filename, int compress, object *keep,
+		      FILE *report);
 
 typedef struct doubly_linked_list {
   object *head;
@@ -66,6 +74,16 @@ typedef struct global_state {
 
   char current_color;
 
+  /* the objects of a loaded image are frozen. they take the colors
+     from base_color up, count base_colors, which the collector counts
+     as marked, and they stay out of the heap lists so it never writes
+     them. the last frozen color is for those in Remembered_Objects */
+  char base_color;
+  unsigned char base_colors;
+  struct stack_set *Remembered_Objects;
+  doubly_linked_list Base_Heap_Objects;
+  doubly_linked_list Base_Free_Objects;
+
   /* VM */
   object *cc_bytecode;
   object *error_sym;
@@ -80,6 +98,7 @@ typedef struct global_state {
   object *false;
   object *true;
   object *symbol_table;
+  long symbol_count;
   object *quote_symbol;
   object *quasiquote_symbol;
   object *unquote_symbol;
@@ -100,6 +119,8 @@ typedef struct global_state {
   object *env;
   object *vm_env;
   object *all_characters;
+  object *reader_macros;
+  object *reader_dispatch;
 
   /* FFI */
   object *free_ptr_fn;
@@ -120,4 +141,20 @@ typedef struct global_state {
 
 extern global_state *g;
 
+/* storing a pointer into an object that may be frozen has to go
+ * through here, so the collector knows to look in it */
+void remember_object(object *obj);
+
+/* have finalize_object() called on obj once it is collected, for an
+ * object that only picks up something to release after it is made */
+void finalize_when_collected(object *obj);
+#define is_frozen_color(color)					\
+  ((unsigned char)((color) - g->base_color) < g->base_colors)
+#define is_frozen(obj) is_frozen_color((obj)->color)
+#define write_barrier(obj)			\
+  do {						\
+    if(unlikely(is_frozen(obj)))		\
+      remember_object(obj);			\
+  } while(0)
+
 #endif
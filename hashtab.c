@@ -127,6 +127,30 @@ hashtab_t *htb_grow(hashtab_t * old_ht, size_t new_size) {
   return new_ht;
 }
 
+/* rebucket the nodes in place */
+void htb_rehash(hashtab_t * hashtable) {
+  hashtab_node_t *nodes = NULL, *next_node, *node;
+
+  /* Take every node out into one list. */
+  int i;
+  for(i = 0; i < (int)hashtable->size; i++) {
+    for(node = hashtable->arr[i]; node != NULL; node = next_node) {
+      next_node = node->next;
+      node->next = nodes;
+      nodes = node;
+    }
+    hashtable->arr[i] = NULL;
+  }
+
+  /* And push each onto the head of its new bucket. */
+  for(node = nodes; node != NULL; node = next_node) {
+    int index = htb_hash(node->key, hashtable->size);
+    next_node = node->next;
+    node->next = hashtable->arr[index];
+    hashtable->arr[index] = node;
+  }
+}
+
 /* free all resources used by the hashtable */
 void htb_destroy(hashtab_t * hashtable) {
   hashtab_node_t *next_node, *last_node;
@@ -74,6 +74,10 @@ void htb_remove (hashtab_t * hashtable, void *key);
  * grow. */
 hashtab_t *htb_grow (hashtab_t * hashtable, size_t new_size);
 
+/* Put every node back in the bucket its key hashes to, for when the
+ * keys have all moved in memory. The nodes are reused as they are. */
+void htb_rehash (hashtab_t * hashtable);
+
 /* Free all resources used by the hashtable. */
 void htb_destroy (hashtab_t * hashtable);
 
@@ -0,0 +1,339 @@
+/**
+ * Copyright 2010 Brian Taylor
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* HTTP/1.x request heads parsed in one pass over the received bytes.
+ * rather than building strings the parser reports where the method,
+ * path and each header name and value lie, so a request costs one
+ * vector of offsets and the substrings it actually asks for. */
+
+#include <string.h>
+#include <strings.h>
+
+#include "types.h"
+#include "gc.h"
+#include "interp.h"
+#include "socket.h"
+#include "http.h"
+
+#define HTTP_MAX_HEADERS 100
+#define HTTP_MAX_HEAD 65536
+
+#define HTTP_INCOMPLETE 0
+#define HTTP_BAD -1
+
+typedef struct http_span {
+  long start;
+  long end;
+} http_span;
+
+typedef struct http_head {
+  http_span method;
+  http_span path;
+  int minor_version;
+  int header_count;
+  http_span names[HTTP_MAX_HEADERS];
+  http_span values[HTTP_MAX_HEADERS];
+} http_head;
+
+/* RFC 7230 tchar */
+static int is_token_char(unsigned char c) {
+  if(c <= 0x20 || c >= 0x7f) {
+    return 0;
+  }
+  return strchr("\"(),/:;<=>?@[\\]{}", c) == NULL;
+}
+
+#define NEED(n) if(p + (n) > len) return HTTP_INCOMPLETE
+
+static long parse_eol(const unsigned char *buf, long len, long p) {
+  NEED(1);
+  if(buf[p] == '\r') {
+    NEED(2);
+    return buf[p + 1] == '\n' ? p + 2 : HTTP_BAD;
+  }
+  return buf[p] == '\n' ? p + 1 : HTTP_BAD;
+}
+
+/* returns the length of the head including its blank line,
+ * HTTP_INCOMPLETE if more bytes are needed or HTTP_BAD */
+static long parse_head(const unsigned char *buf, long len, http_head * head) {
+  long p = 0, start, next;
+  static const char version[] = "HTTP/1.";
+  int i;
+
+  /* blank lines before a request line are tolerated */
+  while(p < len && (buf[p] == '\r' || buf[p] == '\n')) {
+    p++;
+  }
+
+  start = p;
+  while(p < len && is_token_char(buf[p])) {
+    p++;
+  }
+  NEED(1);
+  if(p == start || buf[p] != ' ') {
+    return HTTP_BAD;
+  }
+  head->method.start = start;
+  head->method.end = p++;
+
+  start = p;
+  while(p < len && buf[p] > 0x20 && buf[p] != 0x7f) {
+    p++;
+  }
+  NEED(1);
+  if(p == start || buf[p] != ' ') {
+    return HTTP_BAD;
+  }
+  head->path.start = start;
+  head->path.end = p++;
+
+  for(i = 0; i < 8; i++) {
+    NEED(i + 1);
+    if(i < 7 ? buf[p + i] != version[i] :
+       (buf[p + i] != '0' && buf[p + i] != '1')) {
+      return HTTP_BAD;
+    }
+  }
+  head->minor_version = buf[p + 7] - '0';
+  p += 8;
+  if((next = parse_eol(buf, len, p)) <= 0) {
+    return next;
+  }
+  p = next;
+
+  head->header_count = 0;
+  for(;;) {
+    NEED(1);
+    if(buf[p] == '\r' || buf[p] == '\n') {
+      return parse_eol(buf, len, p);
+    }
+    if(head->header_count == HTTP_MAX_HEADERS) {
+      return HTTP_BAD;
+    }
+
+    /* a leading space would be an obsolete folded line: refused */
+    start = p;
+    while(p < len && is_token_char(buf[p])) {
+      p++;
+    }
+    NEED(1);
+    if(p == start || buf[p] != ':') {
+      return HTTP_BAD;
+    }
+    head->names[head->header_count].start = start;
+    head->names[head->header_count].end = p++;
+
+    while(p < len && (buf[p] == ' ' || buf[p] == '\t')) {
+      p++;
+    }
+    start = p;
+    while(p < len && buf[p] != '\r' && buf[p] != '\n') {
+      if((buf[p] < 0x20 && buf[p] != '\t') || buf[p] == 0x7f) {
+	return HTTP_BAD;
+      }
+      p++;
+    }
+    NEED(1);
+    long end = p;
+    while(end > start && (buf[end - 1] == ' ' || buf[end - 1] == '\t')) {
+      end--;
+    }
+    head->values[head->header_count].start = start;
+    head->values[head->header_count].end = end;
+    head->header_count++;
+
+    if((next = parse_eol(buf, len, p)) <= 0) {
+      return next;
+    }
+    p = next;
+  }
+}
+
+static long http_parse(const unsigned char *buf, long len, http_head * head) {
+  long result = parse_head(buf, len, head);
+  if(result == HTTP_INCOMPLETE && len >= HTTP_MAX_HEAD) {
+    return HTTP_BAD;
+  }
+  return result;
+}
+
+/* #(length method-start method-end path-start path-end minor-version
+ *   name-start name-end value-start value-end ...), offsets shifted
+ * by BASE */
+static object *head_offsets(http_head * head, long length, long base) {
+  object *offsets = make_vector(g->false, 6 + 4 * head->header_count);
+  push_root(&offsets);
+  object **slot = VARRAY(offsets);
+  int i;
+
+  *slot++ = make_fixnum(length);
+  *slot++ = make_fixnum(head->method.start + base);
+  *slot++ = make_fixnum(head->method.end + base);
+  *slot++ = make_fixnum(head->path.start + base);
+  *slot++ = make_fixnum(head->path.end + base);
+  *slot++ = make_fixnum(head->minor_version);
+  for(i = 0; i < head->header_count; i++) {
+    *slot++ = make_fixnum(head->names[i].start + base);
+    *slot++ = make_fixnum(head->names[i].end + base);
+    *slot++ = make_fixnum(head->values[i].start + base);
+    *slot++ = make_fixnum(head->values[i].end + base);
+  }
+  pop_root(&offsets);
+  return offsets;
+}
+
+/* (http-parse-request buf [start [end]]) parses the head at START of
+   a string or bytevector. returns its offsets vector, #f if the head
+   is not all there yet, or bad. */
+DEFUN1(http_parse_request_proc) {
+  unsigned char *base;
+  long length;
+  if(is_string(FIRST)) {
+    base = (unsigned char *)STRING(FIRST);
+    length = STRLEN(FIRST);
+  }
+  else if(is_bytevector(FIRST)) {
+    base = BYTES(FIRST);
+    length = BVLEN(FIRST);
+  }
+  else {
+    return throw_message("http-parse-request expects a string or "
+			 "bytevector");
+  }
+  long start = 0, end = length;
+  if(n_args > 1) {
+    if(!is_fixnum(SECOND)) {
+      return throw_message("http-parse-request expects a fixnum start");
+    }
+    start = LONG(SECOND);
+  }
+  if(n_args > 2) {
+    if(!is_fixnum(THIRD)) {
+      return throw_message("http-parse-request expects a fixnum end");
+    }
+    end = LONG(THIRD);
+  }
+  if(start < 0 || end > length || start > end) {
+    return throw_message("http-parse-request: range %ld to %ld is invalid "
+			 "for buffer of length %ld", start, end, length);
+  }
+
+  http_head head;
+  long result = http_parse(base + start, end - start, &head);
+  if(result == HTTP_BAD) {
+    return make_symbol("bad");
+  }
+  if(result == HTTP_INCOMPLETE) {
+    return g->false;
+  }
+  return head_offsets(&head, result, start);
+}
+
+/* (socket-read-http-head port) takes the next request head from a
+   socket port's receive buffer, reading more as needed, and returns
+   (head . offsets) with offsets into the head string. would-block,
+   eof or bad otherwise. */
+DEFUN1(socket_read_http_head_proc) {
+  if(!is_socket_port(FIRST)) {
+    return throw_message("socket-read-http-head expects socket port");
+  }
+  http_head head;
+  unsigned char *data;
+  long result;
+  for(;;) {
+    long length = socket_port_peek(FIRST, &data);
+    result = length > 0 ? http_parse(data, length, &head) : HTTP_INCOMPLETE;
+    if(result != HTTP_INCOMPLETE) {
+      break;
+    }
+    long more = socket_port_more_input(FIRST);
+    if(more == SOCKET_AGAIN) {
+      return socket_would_block();
+    }
+    if(more <= 0) {
+      return g->eof_object;
+    }
+  }
+  if(result == HTTP_BAD) {
+    return make_symbol("bad");
+  }
+
+  object *text = make_counted_string((char *)data, result);
+  push_root(&text);
+  socket_port_consume(FIRST, result);
+  object *offsets = head_offsets(&head, result, 0);
+  push_root(&offsets);
+  object *pair = cons(text, offsets);
+  pop_root(&offsets);
+  pop_root(&text);
+  return pair;
+}
+
+/* the header offsets come in start and end pairs that must lie within
+   the head, since the vector could have come from anywhere */
+static int header_offsets_valid(object * head, object * offsets) {
+  if(VSIZE(offsets) < 6 || (VSIZE(offsets) - 6) % 4 != 0) {
+    return 0;
+  }
+  object **slot = VARRAY(offsets);
+  long i;
+  for(i = 6; i < VSIZE(offsets); i += 2) {
+    if(!is_fixnum(slot[i]) || !is_fixnum(slot[i + 1])) {
+      return 0;
+    }
+    long start = LONG(slot[i]), end = LONG(slot[i + 1]);
+    if(start < 0 || start > end || end > STRLEN(head)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* (http-head-ref head offsets name) is the value of the first header
+   called NAME, compared without case, or #f */
+DEFUN1(http_head_ref_proc) {
+  if(!is_string(FIRST) || !is_vector(SECOND) || !is_string(THIRD)) {
+    return throw_message("http-head-ref expects head, offsets and name");
+  }
+  if(!header_offsets_valid(FIRST, SECOND)) {
+    return throw_message("http-head-ref: offsets don't fit the head");
+  }
+  object **slot = VARRAY(SECOND);
+  long count = (VSIZE(SECOND) - 6) / 4;
+  long i;
+  for(i = 0; i < count; i++) {
+    long start = LONG(slot[6 + 4 * i]);
+    long end = LONG(slot[7 + 4 * i]);
+    if(end - start == STRLEN(THIRD) &&
+       strncasecmp(STRING(FIRST) + start, STRING(THIRD), end - start) == 0) {
+      long vstart = LONG(slot[8 + 4 * i]);
+      return make_counted_string(STRING(FIRST) + vstart,
+				 LONG(slot[9 + 4 * i]) - vstart);
+    }
+  }
+  return g->false;
+}
+
+void init_http(definer defn) {
+#define add_procedure(scheme_name, c_name)			\
+  defn(scheme_name,						\
+       make_primitive_proc(c_name))
+
+  add_procedure("http-parse-request", http_parse_request_proc);
+  add_procedure("socket-read-http-head", socket_read_http_head_proc);
+  add_procedure("http-head-ref", http_head_ref_proc);
+}
@@ -0,0 +1,790 @@
+/**
+ * Copyright 2010 Brian Taylor
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* SRFI-4 style homogeneous numeric vectors. Elements are stored
+ * unboxed and contiguously, and the bulk kernels at the bottom work
+ * on that storage directly. The f64 kernels use SSE2 where the
+ * compiler offers it and everything else is a plain loop. */
+
+#include <stdio.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "types.h"
+#include "gc.h"
+#include "interp.h"
+#include "hvector.h"
+
+/* type, scheme name, element type, accumulator type, is float */
+#define HV_KINDS(X)						\
+  X(BYTEVECTOR, u8, unsigned char, long, 0)			\
+  X(S8VECTOR, s8, signed char, long, 0)				\
+  X(U16VECTOR, u16, unsigned short, long, 0)			\
+  X(S16VECTOR, s16, short, long, 0)				\
+  X(U32VECTOR, u32, unsigned int, long, 0)			\
+  X(S32VECTOR, s32, int, long, 0)				\
+  X(U64VECTOR, u64, unsigned long, long, 0)			\
+  X(S64VECTOR, s64, long, long, 0)				\
+  X(F32VECTOR, f32, float, double, 1)				\
+  X(F64VECTOR, f64, double, double, 1)
+
+static object *hv_ref(object * vec, long idx) {
+  switch (vec->type) {
+#define REF_CASE(type, name, ctype, acc, is_float)			\
+    case type:								\
+      if(is_float) {							\
+	return make_real(((ctype *)BYTES(vec))[idx]);			\
+      }									\
+      return make_fixnum((long)((ctype *)BYTES(vec))[idx]);
+    HV_KINDS(REF_CASE)
+#undef REF_CASE
+  default:
+    return throw_message("not a homogeneous vector");
+  }
+}
+
+/* returns 0 if VALUE can't be stored in VEC */
+static int hv_set(object * vec, long idx, object * value) {
+  switch (vec->type) {
+#define SET_CASE(type, name, ctype, acc, is_float)			\
+    case type:								\
+      if(is_float) {							\
+	if(is_real(value)) {						\
+	  ((ctype *)BYTES(vec))[idx] = DOUBLE(value);			\
+	}								\
+	else if(is_fixnum(value)) {					\
+	  ((ctype *)BYTES(vec))[idx] = LONG(value);			\
+	}								\
+	else {								\
+	  return 0;							\
+	}								\
+      }									\
+      else {								\
+	if(!is_fixnum(value) ||						\
+	   (sizeof(ctype) < sizeof(long) &&				\
+	    (long)(ctype)LONG(value) != LONG(value))) {			\
+	  return 0;							\
+	}								\
+	((ctype *)BYTES(vec))[idx] = LONG(value);			\
+      }									\
+      return 1;
+    HV_KINDS(SET_CASE)
+#undef SET_CASE
+  default:
+    return 0;
+  }
+}
+
+void owrite_hvector(FILE * out, object * vec) {
+  long ii;
+  switch (vec->type) {
+#define WRITE_CASE(type, name, ctype, acc, is_float)			\
+    case type:								\
+      fprintf(out, "#" #name "(");					\
+      for(ii = 0; ii < BVLEN(vec); ++ii) {				\
+	if(ii > 0) {							\
+	  putc(' ', out);						\
+	}								\
+	if(is_float) {							\
+	  fprintf(out, "%lf", (double)((ctype *)BYTES(vec))[ii]);	\
+	}								\
+	else if(type == U64VECTOR) {					\
+	  fprintf(out, "%lu", (unsigned long)((ctype *)BYTES(vec))[ii]); \
+	}								\
+	else {								\
+	  fprintf(out, "%ld", (long)((ctype *)BYTES(vec))[ii]);	\
+	}								\
+      }									\
+      putc(')', out);							\
+      break;
+    HV_KINDS(WRITE_CASE)
+#undef WRITE_CASE
+  default:
+    break;
+  }
+}
+
+static object *make_hvector_proc(object_type type, char *who,
+				 object * args, long n_args,
+				 long stack_top) {
+  long ii;
+  if(!is_fixnum(FIRST) || LONG(FIRST) < 0) {
+    return throw_message("%s expects a length", who);
+  }
+
+  object *vec = make_hvector(type, LONG(FIRST));
+  if(n_args > 1) {
+    for(ii = 0; ii < BVLEN(vec); ++ii) {
+      if(!hv_set(vec, ii, SECOND)) {
+	return throw_message("%s: bad fill value", who);
+      }
+    }
+  }
+  else {
+    memset(BYTES(vec), 0, BVLEN(vec) * hvector_element_size(type));
+  }
+  return vec;
+}
+
+static object *hvector_from_args(object_type type, char *who,
+				 object * args, long n_args,
+				 long stack_top) {
+  long ii;
+  object *vec = make_hvector(type, n_args);
+  for(ii = 0; ii < n_args; ++ii) {
+    if(!hv_set(vec, ii, NTH_ARG(ii))) {
+      return throw_message("%s: bad element", who);
+    }
+  }
+  return vec;
+}
+
+static object *list_to_hvector(object_type type, char *who, object * list) {
+  long length = 0;
+  long ii = 0;
+  object *next;
+  for(next = list; is_pair(next); next = cdr(next)) {
+    ++length;
+  }
+
+  object *vec = make_hvector(type, length);
+  for(next = list; is_pair(next); next = cdr(next)) {
+    if(!hv_set(vec, ii++, car(next))) {
+      return throw_message("%s: bad element", who);
+    }
+  }
+  return vec;
+}
+
+static object *hvector_to_list(object * vec) {
+  long ii;
+  object *result = g->empty_list;
+  object *elem = g->empty_list;
+  push_root(&result);
+  push_root(&elem);
+  for(ii = BVLEN(vec) - 1; ii >= 0; --ii) {
+    elem = hv_ref(vec, ii);
+    result = cons(elem, result);
+  }
+  pop_root(&elem);
+  pop_root(&result);
+  return result;
+}
+
+static object *checked_ref(char *who, object * vec, object * idx) {
+  if(!is_fixnum(idx) || LONG(idx) < 0 || LONG(idx) >= BVLEN(vec)) {
+    return throw_message("%s: index out of range", who);
+  }
+  return hv_ref(vec, LONG(idx));
+}
+
+static object *checked_set(char *who, object * vec, object * idx,
+			   object * value) {
+  if(!is_fixnum(idx) || LONG(idx) < 0 || LONG(idx) >= BVLEN(vec)) {
+    return throw_message("%s: index out of range", who);
+  }
+  if(!hv_set(vec, LONG(idx), value)) {
+    return throw_message("%s: value does not fit", who);
+  }
+  return value;
+}
+
+/* the per-type scheme interface: make-f64vector, f64vector?,
+ * f64vector-ref and so on */
+#define TYPED_PROCS(tag, name, ctype, acc, is_float)			\
+  DEFUN1(make_##name##vector_proc) {					\
+    return make_hvector_proc(tag, "make-" #name "vector", args,	\
+			     n_args, stack_top);			\
+  }									\
+  DEFUN1(name##vector_proc) {						\
+    return hvector_from_args(tag, #name "vector", args, n_args,	\
+			     stack_top);				\
+  }									\
+  DEFUN1(is_##name##vector_proc) {					\
+    return AS_BOOL(!TAGGED(FIRST) && FIRST->type == tag);		\
+  }									\
+  DEFUN1(name##vector_length_proc) {					\
+    if(TAGGED(FIRST) || FIRST->type != tag) {				\
+      return throw_message(#name "vector-length expects " #name	\
+			   "vector");					\
+    }									\
+    return make_fixnum(BVLEN(FIRST));					\
+  }									\
+  DEFUN1(name##vector_ref_proc) {					\
+    if(TAGGED(FIRST) || FIRST->type != tag) {				\
+      return throw_message(#name "vector-ref expects " #name "vector"); \
+    }									\
+    return checked_ref(#name "vector-ref", FIRST, SECOND);		\
+  }									\
+  DEFUN1(name##vector_set_proc) {					\
+    if(TAGGED(FIRST) || FIRST->type != tag) {				\
+      return throw_message(#name "vector-set! expects " #name		\
+			   "vector");					\
+    }									\
+    return checked_set(#name "vector-set!", FIRST, SECOND, THIRD);	\
+  }									\
+  DEFUN1(name##vector_to_list_proc) {					\
+    if(TAGGED(FIRST) || FIRST->type != tag) {				\
+      return throw_message(#name "vector->list expects " #name		\
+			   "vector");					\
+    }									\
+    return hvector_to_list(FIRST);					\
+  }									\
+  DEFUN1(list_to_##name##vector_proc) {					\
+    return list_to_hvector(tag, "list->" #name "vector", FIRST);	\
+  }
+
+HV_KINDS(TYPED_PROCS)
+#undef TYPED_PROCS
+
+/* generic access for code that handles any kind of homogeneous vector */
+
+DEFUN1(is_hvector_proc) {
+  return AS_BOOL(is_hvector(FIRST));
+}
+
+DEFUN1(hvector_length_proc) {
+  if(!is_hvector(FIRST)) {
+    return throw_message("hvector-length expects homogeneous vector");
+  }
+  return make_fixnum(BVLEN(FIRST));
+}
+
+DEFUN1(hvector_ref_proc) {
+  if(!is_hvector(FIRST)) {
+    return throw_message("hvector-ref expects homogeneous vector");
+  }
+  return checked_ref("hvector-ref", FIRST, SECOND);
+}
+
+DEFUN1(hvector_set_proc) {
+  if(!is_hvector(FIRST)) {
+    return throw_message("hvector-set! expects homogeneous vector");
+  }
+  return checked_set("hvector-set!", FIRST, SECOND, THIRD);
+}
+
+DEFUN1(hvector_copy_proc) {
+  if(!is_hvector(FIRST)) {
+    return throw_message("hvector-copy expects homogeneous vector");
+  }
+  object *copy = make_hvector(FIRST->type, BVLEN(FIRST));
+  memcpy(BYTES(copy), BYTES(FIRST),
+	 BVLEN(FIRST) * hvector_element_size(FIRST->type));
+  return copy;
+}
+
+DEFUN1(hvector_to_list_proc) {
+  if(!is_hvector(FIRST)) {
+    return throw_message("hvector->list expects homogeneous vector");
+  }
+  return hvector_to_list(FIRST);
+}
+
+/* SSE2 versions of the f64 kernels. each handles pairs of doubles and
+ * finishes an odd trailing element in scalar code. */
+#ifdef __SSE2__
+static void f64_add_sse2(double *dst, double *a, double *b, long n) {
+  long ii;
+  for(ii = 0; ii + 2 <= n; ii += 2) {
+    _mm_storeu_pd(dst + ii, _mm_add_pd(_mm_loadu_pd(a + ii),
+				       _mm_loadu_pd(b + ii)));
+  }
+  for(; ii < n; ++ii) {
+    dst[ii] = a[ii] + b[ii];
+  }
+}
+
+static void f64_scale_sse2(double *dst, double *a, double alpha, long n) {
+  long ii;
+  __m128d factor = _mm_set1_pd(alpha);
+  for(ii = 0; ii + 2 <= n; ii += 2) {
+    _mm_storeu_pd(dst + ii, _mm_mul_pd(_mm_loadu_pd(a + ii), factor));
+  }
+  for(; ii < n; ++ii) {
+    dst[ii] = a[ii] * alpha;
+  }
+}
+
+static void f64_axpy_sse2(double alpha, double *x, double *y, long n) {
+  long ii;
+  __m128d factor = _mm_set1_pd(alpha);
+  for(ii = 0; ii + 2 <= n; ii += 2) {
+    __m128d scaled = _mm_mul_pd(_mm_loadu_pd(x + ii), factor);
+    _mm_storeu_pd(y + ii, _mm_add_pd(_mm_loadu_pd(y + ii), scaled));
+  }
+  for(; ii < n; ++ii) {
+    y[ii] += alpha * x[ii];
+  }
+}
+
+static double f64_dot_sse2(double *a, double *b, long n) {
+  long ii;
+  double lanes[2];
+  __m128d sum = _mm_setzero_pd();
+  for(ii = 0; ii + 2 <= n; ii += 2) {
+    sum = _mm_add_pd(sum, _mm_mul_pd(_mm_loadu_pd(a + ii),
+				     _mm_loadu_pd(b + ii)));
+  }
+  _mm_storeu_pd(lanes, sum);
+  double result = lanes[0] + lanes[1];
+  for(; ii < n; ++ii) {
+    result += a[ii] * b[ii];
+  }
+  return result;
+}
+
+static double f64_sum_sse2(double *a, long n) {
+  long ii;
+  double lanes[2];
+  __m128d sum = _mm_setzero_pd();
+  for(ii = 0; ii + 2 <= n; ii += 2) {
+    sum = _mm_add_pd(sum, _mm_loadu_pd(a + ii));
+  }
+  _mm_storeu_pd(lanes, sum);
+  double result = lanes[0] + lanes[1];
+  for(; ii < n; ++ii) {
+    result += a[ii];
+  }
+  return result;
+}
+
+/* n must be at least 1 */
+static double f64_extreme_sse2(double *a, long n, int want_max) {
+  long ii;
+  double lanes[2];
+  __m128d best = _mm_set1_pd(a[0]);
+  for(ii = 0; ii + 2 <= n; ii += 2) {
+    __m128d next = _mm_loadu_pd(a + ii);
+    best = want_max ? _mm_max_pd(best, next) : _mm_min_pd(best, next);
+  }
+  _mm_storeu_pd(lanes, best);
+  double result = want_max ? (lanes[0] > lanes[1] ? lanes[0] : lanes[1])
+    : (lanes[0] < lanes[1] ? lanes[0] : lanes[1]);
+  for(; ii < n; ++ii) {
+    if(want_max ? a[ii] > result : a[ii] < result) {
+      result = a[ii];
+    }
+  }
+  return result;
+}
+
+#define SIMD_F64(type, call) if(type == F64VECTOR) { call; }
+#else
+#define SIMD_F64(type, call)
+#endif
+
+/* scalar kernels for every element type */
+#define KERNELS(type, name, ctype, acc, is_float)			\
+  static void add_##name(ctype *dst, ctype *a, ctype *b, long n) {	\
+    long ii;								\
+    SIMD_F64(type, f64_add_sse2((double *)dst, (double *)a,		\
+				(double *)b, n); return);		\
+    for(ii = 0; ii < n; ++ii) {						\
+      dst[ii] = a[ii] + b[ii];						\
+    }									\
+  }									\
+  static void scale_##name(ctype *dst, ctype *a, acc alpha, long n) {	\
+    long ii;								\
+    SIMD_F64(type, f64_scale_sse2((double *)dst, (double *)a,		\
+				  alpha, n); return);			\
+    for(ii = 0; ii < n; ++ii) {						\
+      dst[ii] = a[ii] * alpha;						\
+    }									\
+  }									\
+  static void axpy_##name(acc alpha, ctype *x, ctype *y, long n) {	\
+    long ii;								\
+    SIMD_F64(type, f64_axpy_sse2(alpha, (double *)x, (double *)y, n);	\
+	     return);							\
+    for(ii = 0; ii < n; ++ii) {						\
+      y[ii] += alpha * x[ii];						\
+    }									\
+  }									\
+  static acc dot_##name(ctype *a, ctype *b, long n) {			\
+    long ii;								\
+    acc result = 0;							\
+    SIMD_F64(type, return f64_dot_sse2((double *)a, (double *)b, n));	\
+    for(ii = 0; ii < n; ++ii) {						\
+      result += (acc)a[ii] * b[ii];					\
+    }									\
+    return result;							\
+  }									\
+  static acc sum_##name(ctype *a, long n) {				\
+    long ii;								\
+    acc result = 0;							\
+    SIMD_F64(type, return f64_sum_sse2((double *)a, n));		\
+    for(ii = 0; ii < n; ++ii) {						\
+      result += a[ii];							\
+    }									\
+    return result;							\
+  }									\
+  static acc extreme_##name(ctype *a, long n, int want_max) {		\
+    long ii;								\
+    ctype result = a[0];						\
+    SIMD_F64(type, return f64_extreme_sse2((double *)a, n, want_max));	\
+    for(ii = 1; ii < n; ++ii) {						\
+      if(want_max ? a[ii] > result : a[ii] < result) {			\
+	result = a[ii];							\
+      }									\
+    }									\
+    return result;							\
+  }									\
+  static void prefix_sum_##name(ctype *dst, ctype *a, long n) {		\
+    long ii;								\
+    ctype running = 0;							\
+    for(ii = 0; ii < n; ++ii) {						\
+      running += a[ii];							\
+      dst[ii] = running;						\
+    }									\
+  }									\
+  static void compare_##name(unsigned char *mask, ctype *a, ctype *b,	\
+			     long b_step, int op, long n) {		\
+    long ii;								\
+    for(ii = 0; ii < n; ++ii) {						\
+      ctype x = a[ii];							\
+      ctype y = b[ii * b_step];						\
+      switch (op) {							\
+      case 0: mask[ii] = x < y; break;					\
+      case 1: mask[ii] = x <= y; break;					\
+      case 2: mask[ii] = x == y; break;					\
+      case 3: mask[ii] = x >= y; break;					\
+      default: mask[ii] = x > y; break;					\
+      }									\
+    }									\
+  }
+
+HV_KINDS(KERNELS)
+#undef KERNELS
+
+static int is_float_kind(object * vec) {
+  return vec->type == F32VECTOR || vec->type == F64VECTOR;
+}
+
+static object *make_number(object * vec, double d, long l) {
+  return is_float_kind(vec) ? make_real(d) : make_fixnum(l);
+}
+
+/* numeric argument converted for the element type of VEC */
+static int scalar_arg(object * vec, object * arg, double *d, long *l) {
+  if(is_fixnum(arg)) {
+    *l = LONG(arg);
+    *d = LONG(arg);
+    return 1;
+  }
+  if(is_real(arg) && is_float_kind(vec)) {
+    *d = DOUBLE(arg);
+    *l = DOUBLE(arg);
+    return 1;
+  }
+  return 0;
+}
+
+static object *same_shape(char *who, object * a, object * b) {
+  if(!is_hvector(a) || !is_hvector(b) || a->type != b->type ||
+     BVLEN(a) != BVLEN(b)) {
+    return throw_message("%s expects homogeneous vectors of the same "
+			 "type and length", who);
+  }
+  return g->true;
+}
+
+/* optional destination argument at position AT, or a fresh vector
+   shaped like SRC */
+static object *destination(char *who, object * src, object * args,
+			   long n_args, long stack_top, long at) {
+  if(n_args > at) {
+    return same_shape(who, src, NTH_ARG(at)) == g->true ?
+      NTH_ARG(at) : throw_message("%s: bad destination", who);
+  }
+  return make_hvector(src->type, BVLEN(src));
+}
+
+/* (hvector-add a b [dst]) */
+DEFUN1(hvector_add_proc) {
+  object *check = same_shape("hvector-add", FIRST, SECOND);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+  object *dst = destination("hvector-add", FIRST, args, n_args,
+			    stack_top, 2);
+  if(is_primitive_exception(dst)) {
+    return dst;
+  }
+
+  switch (FIRST->type) {
+#define ADD_CASE(type, name, ctype, acc, is_float)			\
+    case type:								\
+      add_##name((ctype *)BYTES(dst), (ctype *)BYTES(FIRST),		\
+		 (ctype *)BYTES(SECOND), BVLEN(dst));			\
+      break;
+    HV_KINDS(ADD_CASE)
+#undef ADD_CASE
+  default:
+    break;
+  }
+  return dst;
+}
+
+/* (hvector-scale v alpha [dst]) */
+DEFUN1(hvector_scale_proc) {
+  double d;
+  long l;
+  if(!is_hvector(FIRST) || !scalar_arg(FIRST, SECOND, &d, &l)) {
+    return throw_message("hvector-scale expects homogeneous vector and "
+			 "number");
+  }
+  object *dst = destination("hvector-scale", FIRST, args, n_args,
+			    stack_top, 2);
+  if(is_primitive_exception(dst)) {
+    return dst;
+  }
+
+  switch (FIRST->type) {
+#define SCALE_CASE(type, name, ctype, acc, is_float)			\
+    case type:								\
+      scale_##name((ctype *)BYTES(dst), (ctype *)BYTES(FIRST),		\
+		   is_float ? (acc)d : (acc)l, BVLEN(dst));		\
+      break;
+    HV_KINDS(SCALE_CASE)
+#undef SCALE_CASE
+  default:
+    break;
+  }
+  return dst;
+}
+
+/* (hvector-axpy! alpha x y) sets y to alpha * x + y */
+DEFUN1(hvector_axpy_proc) {
+  double d;
+  long l;
+  object *check = same_shape("hvector-axpy!", SECOND, THIRD);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+  if(!scalar_arg(SECOND, FIRST, &d, &l)) {
+    return throw_message("hvector-axpy! expects a numeric alpha");
+  }
+
+  switch (SECOND->type) {
+#define AXPY_CASE(type, name, ctype, acc, is_float)			\
+    case type:								\
+      axpy_##name(is_float ? (acc)d : (acc)l, (ctype *)BYTES(SECOND),	\
+		  (ctype *)BYTES(THIRD), BVLEN(THIRD));			\
+      break;
+    HV_KINDS(AXPY_CASE)
+#undef AXPY_CASE
+  default:
+    break;
+  }
+  return THIRD;
+}
+
+DEFUN1(hvector_dot_proc) {
+  object *check = same_shape("hvector-dot", FIRST, SECOND);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+
+  switch (FIRST->type) {
+#define DOT_CASE(type, name, ctype, acc, is_float)			\
+    case type: {							\
+      acc result = dot_##name((ctype *)BYTES(FIRST),			\
+			      (ctype *)BYTES(SECOND), BVLEN(FIRST));	\
+      return make_number(FIRST, result, (long)result);			\
+    }
+    HV_KINDS(DOT_CASE)
+#undef DOT_CASE
+  default:
+    return g->false;
+  }
+}
+
+DEFUN1(hvector_sum_proc) {
+  if(!is_hvector(FIRST)) {
+    return throw_message("hvector-sum expects homogeneous vector");
+  }
+
+  switch (FIRST->type) {
+#define SUM_CASE(type, name, ctype, acc, is_float)			\
+    case type: {							\
+      acc result = sum_##name((ctype *)BYTES(FIRST), BVLEN(FIRST));	\
+      return make_number(FIRST, result, (long)result);			\
+    }
+    HV_KINDS(SUM_CASE)
+#undef SUM_CASE
+  default:
+    return g->false;
+  }
+}
+
+static object *extreme(char *who, object * vec, int want_max) {
+  if(!is_hvector(vec) || BVLEN(vec) == 0) {
+    return throw_message("%s expects a non-empty homogeneous vector", who);
+  }
+
+  switch (vec->type) {
+#define EXTREME_CASE(type, name, ctype, acc, is_float)			\
+    case type: {							\
+      acc result = extreme_##name((ctype *)BYTES(vec), BVLEN(vec),	\
+				  want_max);				\
+      return make_number(vec, result, (long)result);			\
+    }
+    HV_KINDS(EXTREME_CASE)
+#undef EXTREME_CASE
+  default:
+    return g->false;
+  }
+}
+
+DEFUN1(hvector_min_proc) {
+  return extreme("hvector-min", FIRST, 0);
+}
+
+DEFUN1(hvector_max_proc) {
+  return extreme("hvector-max", FIRST, 1);
+}
+
+/* (hvector-prefix-sum v [dst]) running totals */
+DEFUN1(hvector_prefix_sum_proc) {
+  if(!is_hvector(FIRST)) {
+    return throw_message("hvector-prefix-sum expects homogeneous vector");
+  }
+  object *dst = destination("hvector-prefix-sum", FIRST, args, n_args,
+			    stack_top, 1);
+  if(is_primitive_exception(dst)) {
+    return dst;
+  }
+
+  switch (FIRST->type) {
+#define PREFIX_CASE(type, name, ctype, acc, is_float)			\
+    case type:								\
+      prefix_sum_##name((ctype *)BYTES(dst), (ctype *)BYTES(FIRST),	\
+			BVLEN(dst));					\
+      break;
+    HV_KINDS(PREFIX_CASE)
+#undef PREFIX_CASE
+  default:
+    break;
+  }
+  return dst;
+}
+
+/* (hvector-compare op a b) where op is one of < <= = >= > and b is a
+   vector like a or a single number. returns a bytevector of 0 and 1 */
+DEFUN1(hvector_compare_proc) {
+  int op;
+  object *sym = FIRST;
+  object *a = SECOND;
+  object *b = THIRD;
+  if(!is_symbol(sym) || is_lazy_symbol(sym)) {
+    return throw_message("hvector-compare expects a comparison symbol");
+  }
+  if(strcmp(SYMBOL(sym), "<") == 0) {
+    op = 0;
+  }
+  else if(strcmp(SYMBOL(sym), "<=") == 0) {
+    op = 1;
+  }
+  else if(strcmp(SYMBOL(sym), "=") == 0) {
+    op = 2;
+  }
+  else if(strcmp(SYMBOL(sym), ">=") == 0) {
+    op = 3;
+  }
+  else if(strcmp(SYMBOL(sym), ">") == 0) {
+    op = 4;
+  }
+  else {
+    return throw_message("hvector-compare: unknown comparison %s",
+			 SYMBOL(sym));
+  }
+
+  if(!is_hvector(a)) {
+    return throw_message("hvector-compare expects homogeneous vector");
+  }
+
+  /* a scalar is compared against every element by using a stride of
+     zero over a one element vector */
+  object *other = b;
+  long step = 1;
+  push_root(&other);
+  if(!is_hvector(b)) {
+    other = make_hvector(a->type, 1);
+    if(!hv_set(other, 0, b)) {
+      pop_root(&other);
+      return throw_message("hvector-compare: bad scalar");
+    }
+    step = 0;
+  }
+  else if(is_primitive_exception(same_shape("hvector-compare", a, b))) {
+    pop_root(&other);
+    return throw_message("hvector-compare expects matching vectors");
+  }
+
+  object *mask = make_bytevector(BVLEN(a));
+  pop_root(&other);
+
+  switch (a->type) {
+#define COMPARE_CASE(type, name, ctype, acc, is_float)			\
+    case type:								\
+      compare_##name(BYTES(mask), (ctype *)BYTES(a),			\
+		     (ctype *)BYTES(other), step, op, BVLEN(a));	\
+      break;
+    HV_KINDS(COMPARE_CASE)
+#undef COMPARE_CASE
+  default:
+    break;
+  }
+  return mask;
+}
+
+void init_hvector(definer defn) {
+#define add_procedure(scheme_name, c_name)			\
+  defn(scheme_name,						\
+       make_primitive_proc(c_name))
+
+#define ADD_TYPED(type, name, ctype, acc, is_float)			\
+  add_procedure("make-" #name "vector", make_##name##vector_proc);	\
+  add_procedure(#name "vector", name##vector_proc);			\
+  add_procedure(#name "vector?", is_##name##vector_proc);		\
+  add_procedure(#name "vector-length", name##vector_length_proc);	\
+  add_procedure(#name "vector-ref", name##vector_ref_proc);		\
+  add_procedure(#name "vector-set!", name##vector_set_proc);		\
+  add_procedure(#name "vector->list", name##vector_to_list_proc);	\
+  add_procedure("list->" #name "vector", list_to_##name##vector_proc);
+
+  HV_KINDS(ADD_TYPED)
+#undef ADD_TYPED
+
+  add_procedure("hvector?", is_hvector_proc);
+  add_procedure("hvector-length", hvector_length_proc);
+  add_procedure("hvector-ref", hvector_ref_proc);
+  add_procedure("hvector-set!", hvector_set_proc);
+  add_procedure("hvector-copy", hvector_copy_proc);
+  add_procedure("hvector->list", hvector_to_list_proc);
+
+  add_procedure("hvector-add", hvector_add_proc);
+  add_procedure("hvector-scale", hvector_scale_proc);
+  add_procedure("hvector-axpy!", hvector_axpy_proc);
+  add_procedure("hvector-dot", hvector_dot_proc);
+  add_procedure("hvector-sum", hvector_sum_proc);
+  add_procedure("hvector-min", hvector_min_proc);
+  add_procedure("hvector-max", hvector_max_proc);
+  add_procedure("hvector-prefix-sum", hvector_prefix_sum_proc);
+  add_procedure("hvector-compare", hvector_compare_proc);
+}
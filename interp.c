@@ -20,9 +20,11 @@
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <ctype.h>
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 
 #include "types.h"
 #include "interp.h"
@@ -31,6 +33,13 @@
 #include "vm.h"
 #include "ffi.h"
 #include "socket.h"
+#include "event.h"
+#include "http.h"
+#include "fasl.h"
+#include "bytevector.h"
+#include "hvector.h"
+#include "port.h"
+#include "pool.h"
 
 static const int DEBUG_LEVEL = 1;
 
@@ -452,7 +461,8 @@ DEFUN1(is_eq_proc) {
   case CHARACTER:
     return (CHAR(FIRST) == CHAR(SECOND)) ? g->true : g->false;
   case STRING:
-    return (strcmp(STRING(FIRST), STRING(SECOND)) == 0) ? g->true : g->false;
+    return AS_BOOL(STRLEN(FIRST) == STRLEN(SECOND) &&
+		   memcmp(STRING(FIRST), STRING(SECOND), STRLEN(FIRST)) == 0);
   default:
     return (FIRST == SECOND) ? g->true : g->false;
   }
@@ -500,6 +510,7 @@ DEFUN1(close_output_port_proc) {
     pclose(out);
   else
     fclose(out);
+  release_port_state(out);
   set_output_port_opened(obj, 0);
   return g->true;
 }
@@ -522,6 +533,7 @@ DEFUN1(close_input_port_proc) {
     pclose(in);
   else
     fclose(in);
+  release_port_state(in);
   set_input_port_opened(obj, 0);
   return g->true;
 }
@@ -624,16 +636,149 @@ DEFUN1(getenv_proc) {
   return make_string(val);
 }
 
+DEFUN1(startup_trace_proc) {
+  startup_trace(STRING(FIRST));
+  return g->true;
+}
+
+/* the compression of an image from the level given to %save-image:
+ * 0 for none, a zlib level, or lz for the faster in-tree codec */
+static int image_compression(object * level) {
+  if(is_symbol(level) && strcmp(SYMBOL(level), "lz") == 0)
+    return POOL_LZ;
+  return LONG(level);
+}
+
 DEFUN1(save_image_proc) {
   baker_collect();
 
   object *file = FIRST;
-  int r = save_image(STRING(file), LONG(SECOND));
+  int r = save_image(STRING(file), image_compression(SECOND));
   if(r < 0)
     return throw_message("could not save image");
   return g->true;
 }
 
+/* (%save-shaken-image file compress keep) saves a tree shaken image
+ * from a forked child, leaving this process as it was. returns the
+ * live bytes before and after, the number of docstrings dropped and
+ * the globals removed */
+DEFUN1(save_shaken_image_proc) {
+  int fds[2];
+  if(pipe(fds) < 0) {
+    return throw_message("could not save image");
+  }
+  fflush(NULL);
+  pid_t pid = fork();
+  if(pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return throw_message("could not save image");
+  }
+  if(pid == 0) {
+    close(fds[0]);
+    FILE *report = fdopen(fds[1], "w");
+    /* the name is garbage once the shake lets go of the stack */
+    char *filename = strdup(STRING(FIRST));
+    int r = save_shaken_image(filename, image_compression(SECOND), THIRD,
+				report);
+    fclose(report);
+    _exit(r < 0 ? 1 : 0);
+  }
+
+  close(fds[1]);
+  FILE *report = fdopen(fds[0], "r");
+  long before = 0, after = 0, docstrings = 0;
+  char line[4096];
+  object *removed = g->empty_list;
+  object *sym = g->empty_list;
+  push_root(&removed);
+  push_root(&sym);
+  if(fscanf(report, "%ld %ld %ld\n", &before, &after, &docstrings) == 3) {
+    while(fgets(line, sizeof(line), report) != NULL) {
+      line[strcspn(line, "\n")] = '\0';
+      sym = make_symbol(line);
+      removed = cons(sym, removed);
+    }
+  }
+  fclose(report);
+
+  int status;
+  waitpid(pid, &status, 0);
+  object *result = g->false;
+  if(WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+    sym = make_fixnum(docstrings);
+    removed = cons(sym, removed);
+    sym = make_fixnum(after);
+    removed = cons(sym, removed);
+    sym = make_fixnum(before);
+    result = cons(sym, removed);
+  }
+  pop_root(&sym);
+  pop_root(&removed);
+  return result == g->false ? throw_message("could not save image") : result;
+}
+
+/* (%snapshot-image file compress) saves an image from a forked child
+ * while this process carries on. the child works from a copy on
+ * write view of the heap as it was at the fork. returns the child's
+ * pid and a pipe that reads end of file once the child is done */
+DEFUN1(snapshot_image_proc) {
+  int fds[2];
+  if(pipe(fds) < 0) {
+    return throw_message("could not snapshot image");
+  }
+  fflush(NULL);
+  pid_t pid = fork();
+  if(pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return throw_message("could not snapshot image");
+  }
+  if(pid == 0) {
+    close(fds[0]);
+    baker_collect();
+    int r = save_image(STRING(FIRST), image_compression(SECOND));
+    _exit(r < 0 ? 1 : 0);
+  }
+
+  close(fds[1]);
+  object *child = make_fixnum(pid);
+  object *fd = g->empty_list;
+  push_root(&child);
+  push_root(&fd);
+  fd = make_fixnum(fds[0]);
+  child = cons(child, fd);
+  pop_root(&fd);
+  pop_root(&child);
+  return child;
+}
+
+/* (%snapshot-wait snapshot) reaps a snapshot's child, true if it
+ * saved the image. the snapshot keeps the answer in place of the pid
+ * and pipe, so waiting on it again only returns that */
+DEFUN1(snapshot_wait_proc) {
+  object *snapshot = FIRST;
+  if(!is_pair(snapshot)) {
+    return throw_message("snapshot-wait expects a snapshot");
+  }
+  if(is_boolean(CAR(snapshot))) {
+    return CAR(snapshot);
+  }
+  if(!is_fixnum(CAR(snapshot)) || !is_fixnum(CDR(snapshot))) {
+    return throw_message("snapshot-wait expects a snapshot");
+  }
+
+  int status;
+  object *saved = g->false;
+  close(LONG(CDR(snapshot)));
+  if(waitpid(LONG(CAR(snapshot)), &status, 0) >= 0)
+    saved = AS_BOOL(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  set_car(snapshot, saved);
+  set_cdr(snapshot, g->false);
+  return saved;
+}
+
 object *apply(object * fn, object * evald_args) {
   /* essentially duplicated from interp but I'm not
    * sure how to implement this properly otherwise.*/
@@ -715,6 +860,13 @@ DEFUN1(write_proc) {
 DEFUN1(write_char_proc) {
   object *port = SECOND;
   object *ch = FIRST;
+  if(is_character(ch) && is_socket_port(port)) {
+    if(!socket_port_is_open(port)) {
+      return throw_message("write-char: the socket port is closed");
+    }
+    socket_port_write(port, &CHAR(ch), 1);
+    return g->true;
+  }
   if(!is_character(ch) || !is_output_port(port)) {
     return throw_message("write-char expects output port and character");
   }
@@ -724,22 +876,38 @@ DEFUN1(write_char_proc) {
 
 DEFUN1(read_char_proc) {
   object *port = FIRST;
+  int result;
+  if(is_socket_port(port)) {
+    result = socket_port_getc(port);
+    if(result == SOCKET_AGAIN) {
+      return socket_would_block();
+    }
+    return (result == EOF) ? g->eof_object : make_character(result);
+  }
   if(!is_input_port(port)) {
     return throw_message("read-char expects input port");
   }
-  int result = getc(INPUT(port));
+  result = getc(INPUT(port));
   return (result == EOF) ? g->eof_object : make_character(result);
 }
 
 DEFUN1(unread_char_proc) {
   object *ch = FIRST;
   object *port = SECOND;
-
+  if(!is_character(ch) || !(is_socket_port(port) || is_input_port(port))) {
+    return throw_message("unread-char expects character and input port");
+  }
+  if(is_socket_port(port)) {
+    return AS_BOOL(socket_port_ungetc(port, (unsigned char)CHAR(ch)) != EOF);
+  }
   ungetc(CHAR(ch), INPUT(port));
   return g->true;
 }
 
 DEFUN1(fileno_proc) {
+  if(is_socket_port(FIRST)) {
+    return make_fixnum(socket_port_fd(FIRST));
+  }
   return make_fixnum(fileno(INPUT(FIRST)));
 }
 
@@ -801,6 +969,10 @@ DEFUN1(select_proc) {
 }
 
 DEFUN1(flush_output_proc) {
+  if(is_socket_port(FIRST)) {
+    int result = socket_port_flush(FIRST);
+    return result == SOCKET_AGAIN ? socket_would_block() : AS_BOOL(result == 0);
+  }
   return AS_BOOL(fflush(OUTPUT(FIRST)) == 0);
 }
 
@@ -825,22 +997,28 @@ DEFUN1(integer_to_char_proc) {
 }
 
 DEFUN1(make_string_proc) {
-  long length = LONG(FIRST) + 1;
-  object *fill = SECOND;
+  if(!is_fixnum(FIRST) || LONG(FIRST) < 0) {
+    return throw_message("make-string expects a non-negative length");
+  }
+  long length = LONG(FIRST);
   char fill_char = '\0';
-  if(is_character(fill)) {
-    fill_char = CHAR(fill);
+  if(n_args > 1 && is_character(SECOND)) {
+    fill_char = CHAR(SECOND);
   }
 
-  object *string = make_filled_string(length, fill_char);
-  STRING(string)[length - 1] = '\0';
-  return string;
+  return make_filled_string(length, fill_char);
 }
 
+/* reading the index just past the end yields the terminating NUL so
+ * that older code which scans for #\nul keeps working */
 DEFUN1(string_ref_proc) {
   if(!is_string(FIRST) || !is_fixnum(SECOND)) {
     return throw_message("string-ref invalid arguments");
   }
+  if(LONG(SECOND) < 0 || LONG(SECOND) > STRLEN(FIRST)) {
+    return throw_message("index %ld is out of bounds for string of length %ld",
+			 LONG(SECOND), STRLEN(FIRST));
+  }
 
   return make_character(STRING(FIRST)[LONG(SECOND)]);
 }
@@ -849,10 +1027,505 @@ DEFUN1(string_set_proc) {
   if(!is_string(FIRST) || !is_fixnum(SECOND) || !is_character(THIRD)) {
     return throw_message("string-set invalid arguments");
   }
+  if(LONG(SECOND) < 0 || LONG(SECOND) >= STRLEN(FIRST)) {
+    return throw_message("index %ld is out of bounds for string of length %ld",
+			 LONG(SECOND), STRLEN(FIRST));
+  }
   STRING(FIRST)[LONG(SECOND)] = CHAR(THIRD);
   return FIRST;
 }
 
+DEFUN1(string_length_proc) {
+  if(!is_string(FIRST)) {
+    return throw_message("string-length expects string");
+  }
+  return make_fixnum(STRLEN(FIRST));
+}
+
+/* make sure start and end describe a valid region of str */
+static object *check_string_range(char *who, object * str,
+				  long start, long end) {
+  if(start < 0 || end > STRLEN(str) || start > end) {
+    return throw_message("%s: range %ld to %ld is invalid for string of "
+			 "length %ld", who, start, end, STRLEN(str));
+  }
+  return g->true;
+}
+
+DEFUN1(substring_proc) {
+  object *str = FIRST;
+  if(!is_string(str) || !is_fixnum(SECOND) ||
+     (n_args > 2 && !is_fixnum(THIRD))) {
+    return throw_message("substring expects string and indexes");
+  }
+
+  long start = LONG(SECOND);
+  long end = n_args > 2 ? LONG(THIRD) : STRLEN(str);
+  object *check = check_string_range("substring", str, start, end);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+
+  return make_counted_string(STRING(str) + start, end - start);
+}
+
+/* (string-copy! to at from [start [end]]) */
+DEFUN1(string_copy_proc) {
+  object *to = FIRST;
+  object *from = THIRD;
+  if(!is_string(to) || !is_fixnum(SECOND) || !is_string(from)) {
+    return throw_message("string-copy! expects string index string");
+  }
+
+  if((n_args > 3 && !is_fixnum(FOURTH)) || (n_args > 4 && !is_fixnum(FIFTH))) {
+    return throw_message("string-copy! expects fixnum start and end");
+  }
+
+  long at = LONG(SECOND);
+  long start = n_args > 3 ? LONG(FOURTH) : 0;
+  long end = n_args > 4 ? LONG(FIFTH) : STRLEN(from);
+  object *check = check_string_range("string-copy!", from, start, end);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+  check = check_string_range("string-copy!", to, at, at + (end - start));
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+
+  memmove(STRING(to) + at, STRING(from) + start, end - start);
+  return to;
+}
+
+/* three way comparison of two strings like memcmp but ordering a
+ * prefix before the longer string */
+static int string_compare(object * a, object * b) {
+  long len = STRLEN(a) < STRLEN(b) ? STRLEN(a) : STRLEN(b);
+  int cmp = memcmp(STRING(a), STRING(b), len);
+  if(cmp != 0) {
+    return cmp;
+  }
+  return (STRLEN(a) > STRLEN(b)) - (STRLEN(a) < STRLEN(b));
+}
+
+DEFUN1(string_equal_proc) {
+  long ii;
+  for(ii = 0; ii < n_args; ++ii) {
+    if(!is_string(NTH_ARG(ii))) {
+      return throw_message("string=? expects strings");
+    }
+  }
+  for(ii = 1; ii < n_args; ++ii) {
+    object *a = NTH_ARG(ii - 1);
+    object *b = NTH_ARG(ii);
+    if(STRLEN(a) != STRLEN(b) ||
+       memcmp(STRING(a), STRING(b), STRLEN(a)) != 0) {
+      return g->false;
+    }
+  }
+  return g->true;
+}
+
+DEFUN1(string_less_proc) {
+  long ii;
+  for(ii = 0; ii < n_args; ++ii) {
+    if(!is_string(NTH_ARG(ii))) {
+      return throw_message("string<? expects strings");
+    }
+  }
+  for(ii = 1; ii < n_args; ++ii) {
+    if(string_compare(NTH_ARG(ii - 1), NTH_ARG(ii)) >= 0) {
+      return g->false;
+    }
+  }
+  return g->true;
+}
+
+/* (string-index str char [start]) gives the position of the first
+ * char at or after start or #f */
+DEFUN1(string_index_proc) {
+  object *str = FIRST;
+  if(!is_string(str) || !is_character(SECOND) ||
+     (n_args > 2 && !is_fixnum(THIRD))) {
+    return throw_message("string-index expects string and character");
+  }
+
+  long start = n_args > 2 ? LONG(THIRD) : 0;
+  object *check = check_string_range("string-index", str, start, start);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+
+  char *found = memchr(STRING(str) + start, CHAR(SECOND),
+		       STRLEN(str) - start);
+  if(found == NULL) {
+    return g->false;
+  }
+  return make_fixnum(found - STRING(str));
+}
+
+DEFUN1(string_upcase_proc) {
+  long ii;
+  if(!is_string(FIRST)) {
+    return throw_message("string-upcase expects string");
+  }
+  object *result = make_counted_string(STRING(FIRST), STRLEN(FIRST));
+  for(ii = 0; ii < STRLEN(result); ++ii) {
+    STRING(result)[ii] = toupper((unsigned char)STRING(result)[ii]);
+  }
+  return result;
+}
+
+DEFUN1(string_downcase_proc) {
+  long ii;
+  if(!is_string(FIRST)) {
+    return throw_message("string-downcase expects string");
+  }
+  object *result = make_counted_string(STRING(FIRST), STRLEN(FIRST));
+  for(ii = 0; ii < STRLEN(result); ++ii) {
+    STRING(result)[ii] = tolower((unsigned char)STRING(result)[ii]);
+  }
+  return result;
+}
+
+/* find needle in haystack, returning the offset or -1. short
+ * needles lean on memchr, which libc vectorizes, to find candidate
+ * positions. longer needles use Horspool's skip table. */
+long string_search(char *hay, long hlen, char *needle, long nlen) {
+  long ii;
+  if(nlen == 0) {
+    return 0;
+  }
+  if(nlen > hlen) {
+    return -1;
+  }
+
+  if(nlen < 8) {
+    char *pos = hay;
+    char *last = hay + hlen - nlen;
+    while(pos <= last) {
+      pos = memchr(pos, needle[0], last - pos + 1);
+      if(pos == NULL) {
+	return -1;
+      }
+      if(memcmp(pos + 1, needle + 1, nlen - 1) == 0) {
+	return pos - hay;
+      }
+      ++pos;
+    }
+    return -1;
+  }
+
+  long skip[256];
+  for(ii = 0; ii < 256; ++ii) {
+    skip[ii] = nlen;
+  }
+  for(ii = 0; ii < nlen - 1; ++ii) {
+    skip[(unsigned char)needle[ii]] = nlen - 1 - ii;
+  }
+
+  long pos = 0;
+  unsigned char tail = needle[nlen - 1];
+  while(pos <= hlen - nlen) {
+    unsigned char ch = hay[pos + nlen - 1];
+    if(ch == tail && memcmp(hay + pos, needle, nlen - 1) == 0) {
+      return pos;
+    }
+    pos += skip[ch];
+  }
+  return -1;
+}
+
+/* a search pattern may be given as either a character or a string */
+static int pattern_bytes(object * pattern, char **bytes, long *length) {
+  if(is_string(pattern)) {
+    *bytes = STRING(pattern);
+    *length = STRLEN(pattern);
+    return 1;
+  }
+  else if(is_character(pattern)) {
+    *bytes = &CHAR(pattern);
+    *length = 1;
+    return 1;
+  }
+  return 0;
+}
+
+DEFUN1(string_search_forward_proc) {
+  char *needle;
+  long nlen;
+  object *str = SECOND;
+  if(!pattern_bytes(FIRST, &needle, &nlen) || !is_string(str) ||
+     (n_args > 2 && !is_fixnum(THIRD))) {
+    return throw_message("string-search-forward expects pattern, string "
+			 "and start");
+  }
+
+  long start = n_args > 2 ? LONG(THIRD) : 0;
+  object *check = check_string_range("string-search-forward", str,
+				     start, start);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+
+  long found = string_search(STRING(str) + start, STRLEN(str) - start,
+			     needle, nlen);
+  if(found < 0) {
+    return g->false;
+  }
+  return make_fixnum(start + found);
+}
+
+DEFUN1(string_split_proc) {
+  char *sep;
+  long seplen;
+  object *str = FIRST;
+  if(!is_string(str) || !pattern_bytes(SECOND, &sep, &seplen) ||
+     seplen == 0 || (n_args > 2 && !is_fixnum(THIRD))) {
+    return throw_message("string-split expects string and non-empty "
+			 "separator");
+  }
+
+  long limit = n_args > 2 ? LONG(THIRD) : 0;
+  long pieces = 1;
+  long pos = 0;
+  object *result = g->empty_list;
+  object *tail = g->empty_list;
+  object *piece = g->empty_list;
+  push_root(&result);
+  push_root(&tail);
+  push_root(&piece);
+
+  while(1) {
+    long found = -1;
+    if(limit <= 0 || pieces < limit) {
+      found = string_search(STRING(str) + pos, STRLEN(str) - pos,
+			    sep, seplen);
+    }
+    long end = found < 0 ? STRLEN(str) : pos + found;
+
+    piece = make_counted_string(STRING(str) + pos, end - pos);
+    piece = cons(piece, g->empty_list);
+    if(is_the_empty_list(result)) {
+      result = piece;
+    }
+    else {
+      set_cdr(tail, piece);
+    }
+    tail = piece;
+
+    if(found < 0) {
+      break;
+    }
+    pos = end + seplen;
+    ++pieces;
+  }
+
+  pop_root(&piece);
+  pop_root(&tail);
+  pop_root(&result);
+  return result;
+}
+
+DEFUN1(string_join_proc) {
+  char *sep = " ";
+  long seplen = 1;
+  object *strs = FIRST;
+  object *next;
+  if(n_args > 1 && !pattern_bytes(SECOND, &sep, &seplen)) {
+    return throw_message("string-join expects a string delimiter");
+  }
+
+  long length = 0;
+  long count = 0;
+  for(next = strs; is_pair(next); next = cdr(next)) {
+    if(!is_string(car(next))) {
+      return throw_message("string-join expects a list of strings");
+    }
+    length += STRLEN(car(next));
+    ++count;
+  }
+  if(count > 1) {
+    length += seplen * (count - 1);
+  }
+
+  object *result = make_empty_string(length);
+  char *dest = STRING(result);
+  for(next = strs; is_pair(next); next = cdr(next)) {
+    if(next != strs) {
+      memcpy(dest, sep, seplen);
+      dest += seplen;
+    }
+    memcpy(dest, STRING(car(next)), STRLEN(car(next)));
+    dest += STRLEN(car(next));
+  }
+  return result;
+}
+
+/* shared by the string-trim variants. trims whitespace unless a
+ * specific character is given */
+static object *string_trim(char *who, object * args, long n_args,
+			   long stack_top, int left, int right) {
+  object *str = FIRST;
+  if(!is_string(str) || (n_args > 1 && !is_character(SECOND))) {
+    return throw_message("%s expects string and optional character", who);
+  }
+
+  char *bytes = STRING(str);
+  long start = 0;
+  long end = STRLEN(str);
+#define TRIMMED(ch) (n_args > 1 ? (ch) == CHAR(SECOND) : isspace(ch))
+  if(left) {
+    while(start < end && TRIMMED((unsigned char)bytes[start])) {
+      ++start;
+    }
+  }
+  if(right) {
+    while(end > start && TRIMMED((unsigned char)bytes[end - 1])) {
+      --end;
+    }
+  }
+#undef TRIMMED
+
+  if(start == 0 && end == STRLEN(str)) {
+    return str;
+  }
+  return make_counted_string(bytes + start, end - start);
+}
+
+DEFUN1(string_trim_proc) {
+  return string_trim("string-trim", args, n_args, stack_top, 1, 1);
+}
+
+DEFUN1(string_trim_left_proc) {
+  return string_trim("string-trim-left", args, n_args, stack_top, 1, 0);
+}
+
+DEFUN1(string_trim_right_proc) {
+  return string_trim("string-trim-right", args, n_args, stack_top, 0, 1);
+}
+
+DEFUN1(string_count_proc) {
+  char *needle;
+  long nlen;
+  object *str = FIRST;
+  if(!is_string(str) || !pattern_bytes(SECOND, &needle, &nlen) ||
+     nlen == 0 || (n_args > 2 && !is_fixnum(THIRD)) ||
+     (n_args > 3 && !is_fixnum(FOURTH))) {
+    return throw_message("string-count expects string and non-empty "
+			 "pattern");
+  }
+
+  long start = n_args > 2 ? LONG(THIRD) : 0;
+  long end = n_args > 3 ? LONG(FOURTH) : STRLEN(str);
+  object *check = check_string_range("string-count", str, start, end);
+  if(is_primitive_exception(check)) {
+    return check;
+  }
+
+  long count = 0;
+  char *bytes = STRING(str);
+  if(nlen == 1) {
+    char *pos = bytes + start;
+    char *stop = bytes + end;
+    while((pos = memchr(pos, needle[0], stop - pos)) != NULL) {
+      ++count;
+      ++pos;
+    }
+  }
+  else {
+    long found;
+    while((found = string_search(bytes + start, end - start,
+				 needle, nlen)) >= 0) {
+      ++count;
+      start += found + nlen;
+    }
+  }
+  return make_fixnum(count);
+}
+
+DEFUN1(string_append_proc) {
+  long ii;
+  long length = 0;
+  for(ii = 0; ii < n_args; ++ii) {
+    if(!is_string(NTH_ARG(ii))) {
+      return throw_message("string-append expects strings");
+    }
+    length += STRLEN(NTH_ARG(ii));
+  }
+
+  object *result = make_empty_string(length);
+  char *dest = STRING(result);
+  for(ii = 0; ii < n_args; ++ii) {
+    memcpy(dest, STRING(NTH_ARG(ii)), STRLEN(NTH_ARG(ii)));
+    dest += STRLEN(NTH_ARG(ii));
+  }
+  return result;
+}
+
+DEFUN1(make_string_builder_proc) {
+  long capacity = 64;
+  if(n_args > 0) {
+    if(!is_fixnum(FIRST) || LONG(FIRST) < 0) {
+      return throw_message("make-string-builder expects a capacity");
+    }
+    capacity = LONG(FIRST);
+  }
+  return make_string_builder(capacity);
+}
+
+DEFUN1(is_string_builder_proc) {
+  return AS_BOOL(is_string_builder(FIRST));
+}
+
+DEFUN1(string_builder_append_proc) {
+  long ii;
+  object *builder = FIRST;
+  if(!is_string_builder(builder)) {
+    return throw_message("string-builder-append! expects a builder");
+  }
+
+  for(ii = 1; ii < n_args; ++ii) {
+    object *item = NTH_ARG(ii);
+    if(is_string(item)) {
+      string_builder_append(builder, STRING(item), STRLEN(item));
+    }
+    else if(is_character(item)) {
+      string_builder_append(builder, &CHAR(item), 1);
+    }
+    else {
+      return throw_message("string-builder-append! expects strings "
+			   "or characters");
+    }
+  }
+  return builder;
+}
+
+DEFUN1(string_builder_length_proc) {
+  if(!is_string_builder(FIRST)) {
+    return throw_message("string-builder-length expects a builder");
+  }
+  return make_fixnum(BUILDER_LENGTH(FIRST));
+}
+
+DEFUN1(string_builder_ref_proc) {
+  if(!is_string_builder(FIRST) || !is_fixnum(SECOND)) {
+    return throw_message("string-builder-ref expects builder and index");
+  }
+  long idx = LONG(SECOND);
+  if(idx < 0 || idx >= BUILDER_LENGTH(FIRST)) {
+    return throw_message("string-builder-ref index %ld out of range", idx);
+  }
+  return make_character(STRING(BUILDER_STORAGE(FIRST))[idx]);
+}
+
+DEFUN1(string_builder_to_string_proc) {
+  if(!is_string_builder(FIRST)) {
+    return throw_message("string-builder->string expects a builder");
+  }
+  return string_builder_to_string(FIRST);
+}
+
 int snprintf(char *, size_t, const char *, ...);
 
 DEFUN1(number_to_string_proc) {
@@ -929,6 +1602,7 @@ DEFUN1(get_vector_element_proc) {
 }
 
 DEFUN1(set_vector_element_proc) {
+  write_barrier(FIRST);
   VARRAY(FIRST)[LONG(SECOND)] = THIRD;
   return THIRD;
 }
@@ -1011,14 +1685,11 @@ DEFUN1(chdir_proc) {
 }
 
 DEFUN1(concat_proc) {
-  char *str1 = STRING(FIRST);
-  char *str2 = STRING(SECOND);
-  size_t len1 = strlen(str1);
-  size_t len2 = strlen(str2);
-  char *buffer = xmalloc(len1 + len2 + 1);
-  snprintf(buffer, len1 + len2 + 1, "%s%s", str1, str2);
-  object *str = make_string(buffer);
-  free(buffer);
+  long len1 = STRLEN(FIRST);
+  long len2 = STRLEN(SECOND);
+  object *str = make_empty_string(len1 + len2);
+  memcpy(STRING(str), STRING(FIRST), len1);
+  memcpy(STRING(str) + len1, STRING(SECOND), len2);
   return str;
 }
 
@@ -1131,7 +1802,7 @@ object *owrite(FILE * out, object * obj) {
   case STRING:
     str = obj->data.string.value;
     putc('"', out);
-    while(*str != '\0') {
+    for(ii = 0; ii < STRLEN(obj); ++ii, ++str) {
       switch (*str) {
       case '\n':
 	fprintf(out, "\\n");
@@ -1145,7 +1816,6 @@ object *owrite(FILE * out, object * obj) {
       default:
 	putc(*str, out);
       }
-      str++;
     }
     putc('"', out);
     break;
@@ -1267,6 +1937,37 @@ object *owrite(FILE * out, object * obj) {
   case ALIEN:
     fprintf(out, "#<alien-object %p>", ALIEN_PTR(obj));
     break;
+  case STRING_BUILDER:
+    fprintf(out, "#<string-builder %ld>", BUILDER_LENGTH(obj));
+    break;
+  case BYTEVECTOR:
+    fprintf(out, "#u8(");
+    for(ii = 0; ii < BVLEN(obj); ++ii) {
+      fprintf(out, ii > 0 ? " %d" : "%d", BYTES(obj)[ii]);
+    }
+    putc(')', out);
+    break;
+  case MAPPED_BYTEVECTOR:
+  case BYTEVECTOR_SLICE:
+    fprintf(out, "#<mapped-bytevector %ld>", BVLEN(obj));
+    break;
+  case SOCKET_PORT:
+    fprintf(out, "#<socket-port %d>", socket_port_fd(obj));
+    break;
+  case EVENT_LOOP:
+    fprintf(out, "#<event-loop %d>", event_loop_fd(obj));
+    break;
+  case S8VECTOR:
+  case U16VECTOR:
+  case S16VECTOR:
+  case U32VECTOR:
+  case S32VECTOR:
+  case U64VECTOR:
+  case S64VECTOR:
+  case F32VECTOR:
+  case F64VECTOR:
+    owrite_hvector(out, obj);
+    break;
   default:
     return throw_message("cannot write unknown type: %d\n", obj->type);
   }
@@ -1653,13 +2354,39 @@ void init_prim_environment(definer defn) {
   add_procedure("gc", gc_proc);
   add_procedure("%system", system_proc);
   add_procedure("%getenv", getenv_proc);
+  add_procedure("%startup-trace", startup_trace_proc);
   add_procedure("%save-image", save_image_proc);
+  add_procedure("%save-shaken-image", save_shaken_image_proc);
+  add_procedure("%snapshot-image", snapshot_image_proc);
+  add_procedure("%snapshot-wait", snapshot_wait_proc);
 
   add_procedure("char->integer", char_to_integer_proc);
   add_procedure("integer->char", integer_to_char_proc);
   add_procedure("make-string", make_string_proc);
   add_procedure("string-ref", string_ref_proc);
   add_procedure("string-set!", string_set_proc);
+  add_procedure("string-length", string_length_proc);
+  add_procedure("substring", substring_proc);
+  add_procedure("string-copy!", string_copy_proc);
+  add_procedure("string=?", string_equal_proc);
+  add_procedure("string<?", string_less_proc);
+  add_procedure("string-index", string_index_proc);
+  add_procedure("string-upcase", string_upcase_proc);
+  add_procedure("string-downcase", string_downcase_proc);
+  add_procedure("string-append", string_append_proc);
+  add_procedure("string-search-forward", string_search_forward_proc);
+  add_procedure("string-split", string_split_proc);
+  add_procedure("string-join", string_join_proc);
+  add_procedure("string-trim", string_trim_proc);
+  add_procedure("string-trim-left", string_trim_left_proc);
+  add_procedure("string-trim-right", string_trim_right_proc);
+  add_procedure("string-count", string_count_proc);
+  add_procedure("make-string-builder", make_string_builder_proc);
+  add_procedure("string-builder?", is_string_builder_proc);
+  add_procedure("string-builder-append!", string_builder_append_proc);
+  add_procedure("string-builder-length", string_builder_length_proc);
+  add_procedure("string-builder-ref", string_builder_ref_proc);
+  add_procedure("string-builder->string", string_builder_to_string_proc);
   add_procedure("number->string", number_to_string_proc);
   add_procedure("string->number", string_to_number_proc);
   add_procedure("symbol->string", symbol_to_string_proc);
@@ -1703,6 +2430,8 @@ void interp_add_roots(void) {
   push_root(&(g->vm_env));
   push_root(&(g->error_sym));
   push_root(&(g->all_characters));
+  push_root(&(g->reader_macros));
+  push_root(&(g->reader_dispatch));
 }
 
 void init() {
@@ -1731,7 +2460,8 @@ void init() {
   g->true->data.boolean.value = 1;
   push_root(&(g->true));
 
-  g->symbol_table = g->empty_list;
+  g->symbol_table = make_vector(g->empty_list, 1024);
+  g->symbol_count = 0;
   push_root(&(g->symbol_table));
 
   /* build the intern'd character table */
@@ -1745,6 +2475,12 @@ void init() {
     VARRAY(g->all_characters)[ii] = obj;
   }
 
+  /* reader macros written in Scheme, by character */
+  g->reader_macros = make_vector(g->false, 256);
+  push_root(&(g->reader_macros));
+  g->reader_dispatch = make_vector(g->false, 256);
+  push_root(&(g->reader_dispatch));
+
   g->unquote_symbol = make_symbol("unquote");
   g->unquotesplicing_symbol = make_symbol("unquotesplicing");
   g->quote_symbol = make_symbol("quote");
@@ -1780,11 +2516,25 @@ void init() {
   vm_init_environment(interp_definer);
   init_ffi(interp_definer);
   init_socket(interp_definer);
+  init_bytevector(interp_definer);
+  init_hvector(interp_definer);
+  init_port(interp_definer);
+  init_event(interp_definer);
+  init_http(interp_definer);
+  init_read(interp_definer);
+  init_fasl(interp_definer);
 
   init_prim_environment(vm_definer);
   vm_init_environment(vm_definer);
   init_ffi(vm_definer);
   init_socket(vm_definer);
+  init_bytevector(vm_definer);
+  init_hvector(vm_definer);
+  init_port(vm_definer);
+  init_event(vm_definer);
+  init_http(vm_definer);
+  init_read(vm_definer);
+  init_fasl(vm_definer);
 
   vm_init();
 
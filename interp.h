@@ -37,6 +37,7 @@ object *cdr(object *pair);
 #define THIRD (VARRAY(args)[stack_top-(n_args-2)])
 #define FOURTH (VARRAY(args)[stack_top-(n_args-3)])
 #define FIFTH (VARRAY(args)[stack_top-(n_args-4)])
+#define NTH_ARG(n) (VARRAY(args)[stack_top-n_args+(n)])
 
 #define AS_BOOL(x) (x ? g->true : g->false)
 
@@ -80,6 +81,7 @@ object *expand_macro(object *macro, object *args,
 object *interp(object *exp, object *env);
 object *interp1(object *exp, object *env, int level, object * stack, long stack_top);
 object *apply(object *fn, object *args);
+long string_search(char *hay, long hlen, char *needle, long nlen);
 object *debug_write(char * msg, object *obj, int level);
 
 void print_obj(object *obj);
@@ -0,0 +1,206 @@
+/**
+ * Copyright 2010 Brian Taylor
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* a small LZ77 codec in the style of LZ4, traded against zlib for
+ * speed of decompression, which is what image loading waits on.
+ * compressed data is a run of sequences, each
+ *
+ *   token            literal count in the high four bits and match
+ *                    length less four in the low four, 15 meaning
+ *                    more follows
+ *   [255 ... n]      the rest of the literal count, if any
+ *   literals
+ *   offset           two bytes, little endian, back from here
+ *   [255 ... n]      the rest of the match length, if any
+ *
+ * except the last, which has only literals. matches are found
+ * greedily through a hash of the next four bytes */
+
+#include <string.h>
+#include <stdint.h>
+#include "lz.h"
+
+#define LZ_HASH_BITS 14
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+/* the tail never starts a match, so the compressor can read four
+ * bytes anywhere it looks for one */
+#define LZ_TAIL 12
+
+static uint32_t lz_read32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t lz_hash(uint32_t v) {
+  return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static unsigned char *lz_write_length(unsigned char *op, size_t len) {
+  while(len >= 255) {
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = len;
+  return op;
+}
+
+static unsigned char *lz_sequence(unsigned char *op,
+				  const unsigned char *literals,
+				  size_t nliterals, size_t offset,
+				  size_t match) {
+  unsigned char *token = op++;
+  *token = (nliterals < 15 ? nliterals : 15) << 4;
+  if(nliterals >= 15) {
+    op = lz_write_length(op, nliterals - 15);
+  }
+  memcpy(op, literals, nliterals);
+  op += nliterals;
+  if(match == 0) {
+    return op;
+  }
+  *op++ = offset & 0xff;
+  *op++ = offset >> 8;
+  match -= LZ_MIN_MATCH;
+  *token |= match < 15 ? match : 15;
+  if(match >= 15) {
+    op = lz_write_length(op, match - 15);
+  }
+  return op;
+}
+
+size_t lz_bound(size_t n) {
+  return n + n / 255 + 16;
+}
+
+size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst) {
+  uint32_t table[1 << LZ_HASH_BITS];
+  unsigned char *op = dst;
+  size_t anchor = 0, ip = 0, misses = 0;
+  size_t limit = n > LZ_TAIL ? n - LZ_TAIL : 0;
+
+  memset(table, 0, sizeof(table));
+  while(ip < limit) {
+    uint32_t v = lz_read32(src + ip);
+    uint32_t h = lz_hash(v);
+    size_t ref = table[h];
+    table[h] = ip;
+    if(ref >= ip || ip - ref > LZ_MAX_OFFSET || lz_read32(src + ref) != v) {
+      /* skip ahead faster through data that won't compress */
+      ip += 1 + (misses++ >> 6);
+      continue;
+    }
+    size_t len = LZ_MIN_MATCH;
+    while(ip + len < n - LZ_TAIL / 2 && src[ref + len] == src[ip + len]) {
+      ++len;
+    }
+    /* the match may well begin before the bytes that were hashed */
+    while(ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+      --ip;
+      --ref;
+      ++len;
+    }
+    op = lz_sequence(op, src + anchor, ip - anchor, ip - ref, len);
+    ip += len;
+    anchor = ip;
+    misses = 0;
+    if(ip < limit) {
+      table[lz_hash(lz_read32(src + ip - 2))] = ip - 2;
+    }
+  }
+  op = lz_sequence(op, src + anchor, n - anchor, 0, 0);
+  return op - dst;
+}
+
+static int lz_read_length(const unsigned char **ip, const unsigned char *end,
+			  size_t * len) {
+  unsigned char b;
+  do {
+    if(*ip >= end) {
+      return -1;
+    }
+    b = *(*ip)++;
+    *len += b;
+  } while(b == 255);
+  return 0;
+}
+
+long lz_decompress(const unsigned char *src, size_t n,
+		   unsigned char *dst, size_t cap) {
+  const unsigned char *ip = src, *end = src + n;
+  unsigned char *op = dst, *limit = dst + cap;
+
+  while(ip < end) {
+    unsigned char token = *ip++;
+    size_t nliterals = token >> 4;
+
+    /* away from either end, short literals and matches are copied a
+     * fixed 16 or 18 bytes at a time, the excess being written over
+     * by what comes next */
+    if(nliterals < 15 && end - ip >= 32 && limit - op >= 32) {
+      memcpy(op, ip, 16);
+      ip += nliterals;
+      op += nliterals;
+      size_t offset = ip[0] | (ip[1] << 8);
+      if((token & 15) < 15 && offset >= 16 && offset <= (size_t) (op - dst)) {
+	memcpy(op, op - offset, 16);
+	memcpy(op + 16, op + 16 - offset, 2);
+	ip += 2;
+	op += (token & 15) + LZ_MIN_MATCH;
+	continue;
+      }
+      nliterals = 0;
+    }
+
+    if(nliterals == 15 && lz_read_length(&ip, end, &nliterals) < 0) {
+      return -1;
+    }
+    if(nliterals > (size_t) (end - ip) || nliterals > (size_t) (limit - op)) {
+      return -1;
+    }
+    memcpy(op, ip, nliterals);
+    ip += nliterals;
+    op += nliterals;
+    if(ip == end) {
+      break;
+    }
+
+    if(end - ip < 2) {
+      return -1;
+    }
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    size_t match = (token & 15) + LZ_MIN_MATCH;
+    if((token & 15) == 15 && lz_read_length(&ip, end, &match) < 0) {
+      return -1;
+    }
+    if(offset == 0 || offset > (size_t) (op - dst) ||
+       match > (size_t) (limit - op)) {
+      return -1;
+    }
+    /* a match longer than its offset repeats the bytes it starts at,
+     * so copy what has been written of it so far, doubling each time */
+    const unsigned char *from = op - offset;
+    while(match > 0) {
+      size_t len = op - from < (long)match ? (size_t) (op - from) : match;
+      memcpy(op, from, len);
+      op += len;
+      match -= len;
+    }
+  }
+  return op - dst;
+}
@@ -0,0 +1,34 @@
+/**
+ * Copyright 2010 Brian Taylor
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+
+/* the most lz_compress() can write for n bytes of input */
+size_t lz_bound(size_t n);
+
+/* compresses n bytes of src into dst, which must hold lz_bound(n)
+ * bytes, and returns the compressed length */
+size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst);
+
+/* decompresses n bytes of src into at most cap bytes of dst. returns
+ * the decompressed length, or -1 if src is corrupt */
+long lz_decompress(const unsigned char *src, size_t n,
+		   unsigned char *dst, size_t cap);
+
+#endif
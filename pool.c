@@ -15,6 +15,7 @@
  * limitations under the License.
  */
 
+#define _GNU_SOURCE		/* SEEK_DATA */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,8 +24,10 @@
 #include <errno.h>
 #include <stdint.h>
 #include <sys/mman.h>
+#include <pthread.h>
 #include <zlib.h>
 #include "pool.h"
+#include "lz.h"
 #include "gc.h"
 #include "tlsf.h"
 
@@ -36,9 +39,11 @@ size_t default_pool_size = 1048576;
 int miss_limit = 8;
 int pool_scale = 2;
 size_t init_freed_stack = 256;
+intptr_t pool_relocation = 0;
+int pool_relocate = 0;
 
-void *new_mmap(size_t size) {
-  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+void *new_mmap(void *hint, size_t size) {
+  void *p = mmap(hint, size, PROT_READ | PROT_WRITE,
 		 MAP_PRIVATE | MAP_ANON, -1, 0);
   if(p == MAP_FAILED) {
     fprintf(stderr, "error: mmap() failed to create mempool: %s\n",
@@ -49,7 +54,7 @@ void *new_mmap(size_t size) {
 }
 
 /* Used internally to allocate more pool space. */
-static subpool_t *create_subpool_node(size_t size);
+static subpool_t *create_subpool_node(void *hint, size_t size);
 
 pool_t *create_pool(size_t init_alloc, void **init) {
   /* Make sure it aligns as a page. */
@@ -57,7 +62,7 @@ pool_t *create_pool(size_t init_alloc, void **init) {
   size_t init_size = (default_pool_size / ps) * ps;
 
   /* allocate first subpool and use it for the pool */
-  subpool_t *first = create_subpool_node(init_size);
+  subpool_t *first = create_subpool_node(NULL, init_size);
   pool_t *new_pool = first->free_start;
   first->free_start += sizeof(pool_t);
   new_pool->pools = first;
@@ -88,8 +93,15 @@ void *pool_alloc(pool_t * source_pool, size_t size) {
     /* double the size of the last one */
     size_t new_size = last->size * pool_scale;
 
-    /* create new subpool */
-    last->next = create_subpool_node(new_size);
+    /* create new subpool, right below the others if there's room so
+       an image of the pool spans as little address space as it can */
+    subpool_t *cur;
+    char *low = (char *)last->mem_block;
+    for(cur = source_pool->pools; cur != NULL; cur = cur->next) {
+      if((char *)cur->mem_block < low)
+	low = cur->mem_block;
+    }
+    last->next = create_subpool_node(low - new_size, new_size);
     last = last->next;
     source_pool->first = last;
 
@@ -117,9 +129,9 @@ void pool_free(pool_t * source_pool, void *p) {
   free_ex(p, source_pool->pools->free_start);
 }
 
-subpool_t *create_subpool_node(size_t size) {
+subpool_t *create_subpool_node(void *hint, size_t size) {
   /* allocate subpool memory */
-  void *block = new_mmap(size);
+  void *block = new_mmap(hint, size);
   subpool_t *new_subpool = block + hdr;
   new_subpool->mem_block = block;
 
@@ -135,38 +147,523 @@ subpool_t *create_subpool_node(size_t size) {
   return new_subpool;
 }
 
+/* Total size of all the subpools. */
+size_t pool_size(pool_t * pool) {
+  size_t size = 0;
+  subpool_t *cur;
+  for(cur = pool->pools; cur != NULL; cur = cur->next)
+    size += cur->size;
+  return size;
+}
+
+/* Bytes free for allocation, zeroing them when clear is set. */
+size_t pool_free_size(pool_t * pool, int clear) {
+  return get_free_size(pool->pools->free_start, clear);
+}
+
+/* Stop allocating from the memory the pool has now, leaving it
+ * untouched, and take it back. */
+void pool_seal(pool_t * pool) {
+  seal_memory_pool(pool->pools->free_start);
+}
+
+void pool_unseal(pool_t * pool) {
+  unseal_memory_pool(pool->pools->free_start);
+}
+
+/* Whether W points into the pool, up to and including the end of a
+ * subpool, as relocate() takes it to. */
+int pool_holds(pool_t * pool, uintptr_t w) {
+  subpool_t *cur;
+  for(cur = pool->pools; cur != NULL; cur = cur->next)
+    if(w - (uintptr_t) cur->mem_block <= cur->size)
+      return 1;
+  return 0;
+}
+
+static int compare_raw(const void *a, const void *b) {
+  intptr_t x = *(const intptr_t *)a, y = *(const intptr_t *)b;
+  return (x > y) - (x < y);
+}
+
+/* The words are kept sorted as offsets from the first subpool, which
+ * are never taken for pointers into the pool themselves. */
+int pool_set_raw(pool_t * pool, void **words, size_t count) {
+  size_t size = pool_size(pool), ii, n = 0;
+  if(pool->raw != NULL)
+    pool_free(pool, pool->raw);
+  pool->raw = NULL;
+  pool->raw_count = 0;
+  if(count == 0)
+    return 0;
+
+  intptr_t *raw = pool_alloc(pool, count * sizeof(intptr_t));
+  intptr_t base = (intptr_t) pool->pools->mem_block;
+  for(ii = 0; ii < count; ++ii)
+    raw[ii] = (intptr_t) words[ii] - base;
+  qsort(raw, count, sizeof(intptr_t), compare_raw);
+  for(ii = 0; ii < count; ++ii)
+    if(n == 0 || raw[ii] != raw[n - 1])
+      raw[n++] = raw[ii];
+  pool->raw = raw;
+  pool->raw_count = n;
+  return pool_size(pool) == size ? 0 : -1;
+}
+
+/* Read a byte from every page, faulting the whole pool in. */
+size_t pool_touch(pool_t * pool) {
+  size_t ps = sysconf(_SC_PAGE_SIZE), sum = 0, off;
+  subpool_t *cur;
+  for(cur = pool->pools; cur != NULL; cur = cur->next) {
+    volatile char *block = cur->mem_block;
+    for(off = 0; off < cur->size; off += ps)
+      sum += block[off];
+  }
+  return sum;
+}
+
+/* Write a subpool, seeking over pages of zeros so they become holes in
+ * the file rather than taking up disk. */
+static int write_all(int fd, void *buf, size_t size) {
+  char *p = buf;
+  while(size > 0) {
+    ssize_t r = write(fd, p, size);
+    if(r <= 0)
+      return -1;
+    p += r;
+    size -= r;
+  }
+  return 0;
+}
+
+static int write_sparse(int fd, char *block, size_t size) {
+  static const char zeros[4096];
+  size_t off = 0;
+  while(off < size) {
+    size_t n = size - off < sizeof(zeros) ? size - off : sizeof(zeros);
+    if(memcmp(block + off, zeros, n) == 0) {
+      if(lseek(fd, n, SEEK_CUR) < 0)
+	return -1;
+    }
+    else if(write_all(fd, block + off, n) < 0)
+      return -1;
+    off += n;
+  }
+  return 0;
+}
+
+/* Compressed images hold only the pages of the pool that aren't all
+ * zeros, cut into chunks that are compressed independently so saving
+ * and loading can spread them over threads. After the header comes a
+ * table of the subpools, then a table of the chunks, then the chunk
+ * data. Offsets count from the start of the image. */
+#define IMAGE_MAGIC "bschimg1"
+#define IMAGE_PAGE 4096
+#define IMAGE_CHUNK (256 * 1024)
+#define IMAGE_MAX_THREADS 16
+
+typedef struct image_header {
+  char magic[8];
+  uint32_t codec;		/* POOL_LZ or a zlib level */
+  uint32_t subpools;
+  uint64_t chunks;
+} image_header;
+
+typedef struct image_subpool {
+  uint64_t address;
+  uint64_t size;
+} image_subpool;
+
+typedef struct image_chunk {
+  uint64_t address;		/* where the chunk goes in memory */
+  uint64_t offset;		/* where its data is in the image */
+  uint32_t size;
+  uint32_t packed;		/* bytes of data in the image */
+} image_chunk;
+
+/* Where an image is loaded. The subpools keep their places relative
+ * to each other, so they all move by the same delta, and any word
+ * that points into one of them is a pointer needing that delta. */
+typedef struct image_place {
+  image_subpool *subpools;
+  uint32_t count;
+  uintptr_t low;		/* span of the subpools as saved */
+  uintptr_t high;
+  intptr_t delta;
+  image_subpool *gaps;		/* between the subpools in the span */
+  uint32_t gap_count;
+  intptr_t *raw;		/* words not to move, see pool_set_raw() */
+  size_t raw_count;
+  uintptr_t base;		/* the first subpool as saved */
+} image_place;
+
+/* Work shared by the threads packing or unpacking chunks. Each takes
+ * the next chunk not yet claimed until none are left. */
+typedef struct chunk_job {
+  image_chunk *chunks;
+  unsigned char **data;		/* packed chunks, when saving */
+  long count;
+  long next;
+  int codec;
+  int fd;			/* image being loaded */
+  off_t base;
+  int failed;
+  image_place *place;		/* set when the image has moved */
+} chunk_job;
+
+static int page_is_zero(char *page) {
+  static const char zeros[IMAGE_PAGE];
+  return memcmp(page, zeros, IMAGE_PAGE) == 0;
+}
+
+/* Cut the pages of the pool that hold anything into chunks. */
+static image_chunk *find_chunks(pool_t * pool, long *count) {
+  long size = 16, n = 0;
+  image_chunk *chunks = malloc(sizeof(image_chunk) * size);
+  subpool_t *cur;
+  for(cur = pool->pools; cur != NULL; cur = cur->next) {
+    char *block = cur->mem_block;
+    size_t off = 0;
+    while(off < cur->size) {
+      if(page_is_zero(block + off)) {
+	off += IMAGE_PAGE;
+	continue;
+      }
+      size_t start = off;
+      while(off < cur->size && off - start < IMAGE_CHUNK &&
+	    !page_is_zero(block + off)) {
+	off += IMAGE_PAGE;
+      }
+      if(n == size) {
+	size *= 2;
+	chunks = realloc(chunks, sizeof(image_chunk) * size);
+      }
+      chunks[n].address = (uintptr_t) (block + start);
+      chunks[n].size = off - start;
+      chunks[n].packed = 0;
+      chunks[n].offset = 0;
+      ++n;
+    }
+  }
+  *count = n;
+  return chunks;
+}
+
+static void *pack_chunks(void *arg) {
+  chunk_job *job = arg;
+  long ii;
+  while((ii = __sync_fetch_and_add(&job->next, 1)) < job->count) {
+    image_chunk *chunk = &job->chunks[ii];
+    unsigned char *src = (unsigned char *)(uintptr_t) chunk->address;
+    if(job->codec == POOL_LZ) {
+      job->data[ii] = malloc(lz_bound(chunk->size));
+      chunk->packed = lz_compress(src, chunk->size, job->data[ii]);
+    }
+    else {
+      uLongf packed = compressBound(chunk->size);
+      job->data[ii] = malloc(packed);
+      if(compress2(job->data[ii], &packed, src, chunk->size,
+		   job->codec) != Z_OK)
+	job->failed = 1;
+      chunk->packed = packed;
+    }
+  }
+  return NULL;
+}
+
+/* Move the pointers in a chunk that has been put in its new place.
+ * Every aligned word that points into the saved image is taken to be
+ * one, up to and including the end of a subpool, except for the raw
+ * words saved with the pool, which only look like pointers. Pointers
+ * and other words are mixed about evenly, so this is done without
+ * branching. */
+static void relocate_words(image_place * place, uintptr_t * word,
+			   uintptr_t * end) {
+  uintptr_t low = place->low, span = place->high - place->low;
+  uintptr_t delta = place->delta;
+  uint32_t ii;
+  for(; word < end; ++word) {
+    uintptr_t w = *word;
+    uintptr_t move = w - low <= span;
+    for(ii = 0; ii < place->gap_count; ++ii)
+      move &= w - place->gaps[ii].address >= place->gaps[ii].size;
+    *word = w + (-move & delta);
+  }
+}
+
+static void relocate(image_place * place, void *start, size_t size) {
+  uintptr_t *word = start, *end = word + size / sizeof(*word);
+
+  /* find the first raw word from where the chunk was */
+  intptr_t at = (uintptr_t) start - place->delta - place->base;
+  size_t lo = 0, hi = place->raw_count;
+  while(lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if(place->raw[mid] < at)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for(; lo < place->raw_count; ++lo) {
+    uintptr_t *raw = (uintptr_t *) (place->base + place->raw[lo] +
+				    place->delta);
+    if(raw >= end)
+      break;
+    relocate_words(place, word, raw);
+    word = raw + 1;
+  }
+  relocate_words(place, word, end);
+}
+
+/* Find the raw words kept with a pool that has been put in its new
+ * place but not moved yet, so its pool_t still points where it was. */
+static void find_raw(image_place * place) {
+  uintptr_t base = place->subpools[0].address;
+  pool_t *pool = (pool_t *) (base + place->delta + hdr + sizeof(subpool_t));
+  place->base = base;
+  place->raw_count = pool->raw_count;
+  place->raw = (intptr_t *) ((uintptr_t) pool->raw + place->delta);
+}
+
+static void *relocate_chunks(void *arg) {
+  chunk_job *job = arg;
+  long ii;
+  while((ii = __sync_fetch_and_add(&job->next, 1)) < job->count) {
+    image_chunk *chunk = &job->chunks[ii];
+    relocate(job->place, (void *)(uintptr_t)
+	     (chunk->address + job->place->delta), chunk->size);
+  }
+  return NULL;
+}
+
+static void *unpack_chunks(void *arg) {
+  chunk_job *job = arg;
+  unsigned char *packed = NULL;
+  size_t packed_size = 0;
+  intptr_t delta = job->place ? job->place->delta : 0;
+  long ii;
+  while((ii = __sync_fetch_and_add(&job->next, 1)) < job->count) {
+    image_chunk *chunk = &job->chunks[ii];
+    unsigned char *dst = (unsigned char *)(uintptr_t)
+      (chunk->address + delta);
+    if(chunk->packed > packed_size) {
+      packed_size = chunk->packed;
+      packed = realloc(packed, packed_size);
+    }
+    if(pread(job->fd, packed, chunk->packed, job->base + chunk->offset)
+       != (ssize_t) chunk->packed) {
+      job->failed = 1;
+      break;
+    }
+    if(job->codec == POOL_LZ) {
+      if(lz_decompress(packed, chunk->packed, dst, chunk->size)
+	 != (long)chunk->size)
+	job->failed = 1;
+    }
+    else {
+      uLongf size = chunk->size;
+      if(uncompress(dst, &size, packed, chunk->packed) != Z_OK ||
+	 size != chunk->size)
+	job->failed = 1;
+    }
+  }
+  free(packed);
+  return NULL;
+}
+
+/* Run the job on as many threads as there are processors to use. */
+static void run_chunk_job(chunk_job * job, void *(*work) (void *)) {
+  pthread_t threads[IMAGE_MAX_THREADS];
+  long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  long ii, started = 0;
+  if(nthreads > IMAGE_MAX_THREADS)
+    nthreads = IMAGE_MAX_THREADS;
+  if(nthreads > job->count)
+    nthreads = job->count;
+  for(ii = 1; ii < nthreads; ++ii) {
+    if(pthread_create(&threads[started], NULL, work, job) == 0)
+      ++started;
+  }
+  work(job);
+  for(ii = 0; ii < started; ++ii)
+    pthread_join(threads[ii], NULL);
+}
+
+static int pool_dump_chunks(pool_t * pool, int fd, int codec) {
+  image_header header;
+  subpool_t *cur;
+  long ii, nchunks;
+  uint32_t nsubpools = 0;
+
+  for(cur = pool->pools; cur != NULL; cur = cur->next)
+    ++nsubpools;
+  image_subpool *subpools = malloc(sizeof(image_subpool) * nsubpools);
+  nsubpools = 0;
+  for(cur = pool->pools; cur != NULL; cur = cur->next) {
+    subpools[nsubpools].address = (uintptr_t) cur->mem_block;
+    subpools[nsubpools].size = cur->size;
+    ++nsubpools;
+  }
+
+  image_chunk *chunks = find_chunks(pool, &nchunks);
+  chunk_job job = { chunks, calloc(nchunks, sizeof(unsigned char *)),
+    nchunks, 0, codec, fd, 0, 0, NULL
+  };
+  run_chunk_job(&job, pack_chunks);
+
+  memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+  header.codec = codec;
+  header.subpools = nsubpools;
+  header.chunks = nchunks;
+  uint64_t offset = sizeof(header) + sizeof(image_subpool) * nsubpools +
+    sizeof(image_chunk) * nchunks;
+  for(ii = 0; ii < nchunks; ++ii) {
+    chunks[ii].offset = offset;
+    offset += chunks[ii].packed;
+  }
+
+  int r = job.failed ? -1 : 0;
+  if(r == 0)
+    r = write_all(fd, &header, sizeof(header));
+  if(r == 0)
+    r = write_all(fd, subpools, sizeof(image_subpool) * nsubpools);
+  if(r == 0)
+    r = write_all(fd, chunks, sizeof(image_chunk) * nchunks);
+  for(ii = 0; ii < nchunks; ++ii) {
+    if(r == 0)
+      r = write_all(fd, job.data[ii], chunks[ii].packed);
+    free(job.data[ii]);
+  }
+  free(job.data);
+  free(chunks);
+  free(subpools);
+  return r;
+}
+
 /* Dump entire pool to file that can be read back in later to the same
  * place in memory. */
 int pool_dump(pool_t * pool, char *file, int compress) {
   int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
   if(fd < 0)
     return -1;
-  subpool_t *cur = pool->pools;
 
-  gzFile gz;
+  int r = 0;
   if(compress != 0) {
-    gz = gzdopen(fd, "w");
-    gzsetparams(gz, compress, Z_DEFAULT_STRATEGY);
+    r = pool_dump_chunks(pool, fd, compress);
+  }
+  else {
+    subpool_t *cur;
+    for(cur = pool->pools; cur != NULL && r == 0; cur = cur->next)
+      r = write_sparse(fd, cur->mem_block, cur->size);
+    /* a hole at the very end still has to count toward the length */
+    if(r == 0) {
+      off_t end = lseek(fd, 0, SEEK_CUR);
+      if(end < 0 || ftruncate(fd, end) < 0)
+	r = -1;
+    }
   }
+  if(close(fd) < 0)
+    r = -1;
+  return r;
+}
 
-  while(cur != NULL) {
-    if(compress == 0) {
-      write(fd, cur->mem_block, cur->size);
+/* Reserve address space for the subpools of an image, all in one
+ * piece so they keep their layout. It's taken at the addresses they
+ * were saved from if nothing else is there, and anywhere it fits
+ * otherwise, never on top of an existing mapping. The gaps between
+ * subpools are given back and the subpools are left to be mapped over
+ * the reservation. */
+static int place_image(image_place * place) {
+  uint32_t ii;
+  place->low = UINTPTR_MAX;
+  place->high = 0;
+  for(ii = 0; ii < place->count; ++ii) {
+    uintptr_t start = place->subpools[ii].address;
+    uintptr_t end = start + place->subpools[ii].size;
+    if(start < place->low)
+      place->low = start;
+    if(end > place->high)
+      place->high = end;
+  }
+
+  size_t span = place->high - place->low;
+  int flags = MAP_PRIVATE | MAP_ANON | MAP_NORESERVE;
+  void *want = (void *)place->low, *got = MAP_FAILED;
+  if(!pool_relocate)
+    got = mmap(want, span, PROT_NONE, flags, -1, 0);
+  if(got != want) {
+    if(got != MAP_FAILED)
+      munmap(got, span);
+    got = mmap(NULL, span, PROT_NONE, flags, -1, 0);
+    if(got == MAP_FAILED)
+      return -1;
+  }
+  place->delta = (uintptr_t) got - place->low;
+
+  /* the end of a subpool is still a pointer to it */
+  place->gaps = malloc(sizeof(image_subpool) * place->count);
+  place->gap_count = 0;
+  uintptr_t at = place->low;
+  while(at < place->high) {
+    image_subpool *next = NULL;
+    for(ii = 0; ii < place->count; ++ii) {
+      if(place->subpools[ii].address >= at &&
+	 (next == NULL || place->subpools[ii].address < next->address))
+	next = &place->subpools[ii];
     }
-    else {
-      gzwrite(gz, cur->mem_block, cur->size);
+    if(next->address > at) {
+      munmap((void *)(at + place->delta), next->address - at);
+      if(next->address > at + 1) {
+	place->gaps[place->gap_count].address = at + 1;
+	place->gaps[place->gap_count].size = next->address - at - 1;
+	++place->gap_count;
+      }
     }
-    cur = cur->next;
+    at = next->address + next->size;
   }
-
-  if(compress != 0)
-    gzclose(gz);
-  else
-    close(fd);
   return 0;
 }
 
+/* Cut the parts of a raw image that aren't holes into chunks, so
+ * relocating it goes over threads the same as unpacking chunks does
+ * and the holes are never faulted in. Where the file system can't
+ * find holes the whole image is taken. */
+static image_chunk *find_data_chunks(image_place * place, int fd,
+				     off_t offset, long *count) {
+  long size = 16, n = 0;
+  image_chunk *chunks = malloc(sizeof(image_chunk) * size);
+  off_t loc = offset;
+  uint32_t ii;
+  for(ii = 0; ii < place->count; loc += place->subpools[ii++].size) {
+    off_t end = loc + place->subpools[ii].size, start = loc;
+    while(start < end) {
+      off_t data = lseek(fd, start, SEEK_DATA);
+      off_t hole = data < 0 ? end : lseek(fd, data, SEEK_HOLE);
+      if(data < 0)
+	data = errno == ENXIO ? end : start;
+      if(hole < 0 || hole > end)
+	hole = end;
+      for(start = data; start < hole; start += IMAGE_CHUNK) {
+	if(n == size) {
+	  size *= 2;
+	  chunks = realloc(chunks, sizeof(image_chunk) * size);
+	}
+	chunks[n].address = place->subpools[ii].address + (start - loc);
+	chunks[n].size = hole - start < IMAGE_CHUNK ? hole - start : IMAGE_CHUNK;
+	chunks[n].offset = 0;
+	chunks[n].packed = 0;
+	++n;
+      }
+      start = hole;
+    }
+  }
+  *count = n;
+  return chunks;
+}
+
 void *pool_loadz(char *file, off_t offset);
+static void *pool_load_raw(char *file, off_t offset);
+static void *pool_load_chunks(char *file, off_t offset);
 
 /* Read the pool from the given file into memory. */
 void *pool_load(char *file, off_t offset) {
@@ -178,54 +675,94 @@ void *pool_load(char *file, off_t offset) {
   }
   if(offset > 0)
     fseek(zcheck, offset, SEEK_SET);
+  char magic[8] = { 0 };
+  fread(magic, 1, sizeof(magic), zcheck);
+  fclose(zcheck);
+  pool_relocation = 0;
+  if(memcmp(magic, IMAGE_MAGIC, sizeof(magic)) == 0) {
+    return pool_load_chunks(file, offset);
+  }
   uint16_t zheader;
-  fread(&zheader, 1, 2, zcheck);
+  memcpy(&zheader, magic, sizeof(zheader));
   if(zheader == 0x8b1f) {
-    /* This is a compressed stream. */
-    fclose(zcheck);
+    /* This is a compressed stream, from before images were chunked. */
     return pool_loadz(file, offset);
   }
-  fclose(zcheck);
+  return pool_load_raw(file, offset);
+}
 
+/* Map an uncompressed image straight from the file. Each subpool
+ * starts with its size and the address it was at. */
+static void *pool_load_raw(char *file, off_t offset) {
   int fd = open(file, O_RDONLY);
   if(fd < 0) {
     fprintf(stderr, "error: failed to open %s: %s\n", file, strerror(errno));
     return NULL;
   }
+  uint32_t ii, size = 16;
+  image_place place = { malloc(sizeof(image_subpool) * size), 0, 0, 0, 0,
+    NULL, 0, NULL, 0, 0
+  };
   off_t loc = offset;
-  if(offset > 0)
-    lseek(fd, offset, SEEK_SET);
-  void *first = NULL;
   while(1) {
-    void *address;
-    size_t size, r;
-    r = read(fd, &size, sizeof(size_t));
-    if(r == 0)
+    uint64_t head[2];
+    if(pread(fd, head, sizeof(head), loc) != sizeof(head))
       break;
-    r = read(fd, &address, sizeof(void *));
-    if(r == 0)
-      break;
-    if(first == NULL)
-      first = address;
-    void *p = mmap(address, size, PROT_READ | PROT_WRITE,
-		   MAP_PRIVATE | MAP_FIXED, fd, loc);
-    if(p == MAP_FAILED) {
-      fprintf(stderr, "error: failed to mmap() %s: %s\n",
-	      file, strerror(errno));
-      return NULL;
+    if(place.count == size) {
+      size *= 2;
+      place.subpools = realloc(place.subpools, sizeof(image_subpool) * size);
     }
-    loc += size;
-    lseek(fd, size - hdr, SEEK_CUR);
+    place.subpools[place.count].size = head[0];
+    place.subpools[place.count].address = head[1];
+    ++place.count;
+    loc += head[0];
   }
-  if(first == NULL) {
+  if(place.count == 0) {
     fprintf(stderr, "error: empty image file: %s\n", file);
+    free(place.subpools);
+    close(fd);
     return NULL;
   }
+
+  void *first = NULL;
+  if(place_image(&place) == 0) {
+    loc = offset;
+    for(ii = 0; ii < place.count; ++ii) {
+      void *address = (void *)(uintptr_t)
+	(place.subpools[ii].address + place.delta);
+      void *p = mmap(address, place.subpools[ii].size,
+		     PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, loc);
+      if(p == MAP_FAILED)
+	break;
+      loc += place.subpools[ii].size;
+    }
+    if(ii == place.count)
+      first = (void *)(uintptr_t) (place.subpools[0].address + place.delta);
+  }
+  if(first == NULL) {
+    fprintf(stderr, "error: failed to mmap() %s: %s\n",
+	    file, strerror(errno));
+  }
+  else if(place.delta != 0) {
+    find_raw(&place);
+    chunk_job job = { NULL, NULL, 0, 0, 0, fd, 0, 0, &place };
+    job.chunks = find_data_chunks(&place, fd, offset, &job.count);
+    run_chunk_job(&job, relocate_chunks);
+    free(job.chunks);
+  }
+  close(fd);
+  pool_relocation = place.delta;
+  free(place.subpools);
+  free(place.gaps);
+  if(first == NULL)
+    return NULL;
   return first + hdr + sizeof(subpool_t) + sizeof(pool_t);
 }
 
 /* Load a compressed pool. Rather than mmap() a file, we just mmap()
- * MAP_ANON again and write into it. */
+ * MAP_ANON again and write into it. These images can't be moved, as
+ * the subpools are only known one at a time, so they load only where
+ * they were saved from. */
 void *pool_loadz(char *file, off_t offset) {
   int fd = open(file, O_RDONLY);
   if(fd < 0) {
@@ -249,12 +786,18 @@ void *pool_loadz(char *file, off_t offset) {
     if(first == NULL)
       first = address;
     void *p = mmap(address, size, PROT_READ | PROT_WRITE,
-		   MAP_PRIVATE | MAP_ANON | MAP_FIXED, -1, 0);
+		   MAP_PRIVATE | MAP_ANON, -1, 0);
     if(p == MAP_FAILED) {
       fprintf(stderr, "error: loadz failed to mmap() %s: %s\n",
 	      file, strerror(errno));
       return NULL;
     }
+    if(p != address) {
+      fprintf(stderr, "error: %s can't be loaded at its old address, "
+	      "save it again to make it relocatable\n", file);
+      munmap(p, size);
+      return NULL;
+    }
     memcpy(address, &size, sizeof(size));
     memcpy(address + sizeof(size), &address, sizeof(address));
     size_t amt = size - hdr;
@@ -271,3 +814,76 @@ void *pool_loadz(char *file, off_t offset) {
   gzclose(gz);
   return first + hdr + sizeof(subpool_t) + sizeof(pool_t);
 }
+
+/* Load a chunked image. Every subpool is mapped fresh, which leaves
+ * the pages that weren't saved as zeros, and the chunks are unpacked
+ * into place by as many threads as there are processors. */
+static void *pool_load_chunks(char *file, off_t offset) {
+  int fd = open(file, O_RDONLY);
+  if(fd < 0) {
+    fprintf(stderr, "error: failed to open %s: %s\n", file, strerror(errno));
+    return NULL;
+  }
+  image_header header;
+  if(pread(fd, &header, sizeof(header), offset) != sizeof(header) ||
+     header.subpools == 0) {
+    fprintf(stderr, "error: bad image header in %s\n", file);
+    close(fd);
+    return NULL;
+  }
+
+  size_t tables = sizeof(image_subpool) * header.subpools +
+    sizeof(image_chunk) * header.chunks;
+  image_subpool *subpools = malloc(tables);
+  image_chunk *chunks = (image_chunk *) (subpools + header.subpools);
+  if(pread(fd, subpools, tables, offset + sizeof(header)) != (ssize_t) tables) {
+    fprintf(stderr, "error: truncated image %s\n", file);
+    free(subpools);
+    close(fd);
+    return NULL;
+  }
+
+  image_place place = { subpools, header.subpools, 0, 0, 0, NULL, 0, NULL,
+    0, 0
+  };
+  uint32_t ii = 0;
+  if(place_image(&place) == 0) {
+    for(ii = 0; ii < header.subpools; ++ii) {
+      void *address = (void *)(uintptr_t) (subpools[ii].address + place.delta);
+      void *p = mmap(address, subpools[ii].size, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANON | MAP_FIXED, -1, 0);
+      if(p == MAP_FAILED)
+	break;
+    }
+  }
+  if(ii < header.subpools) {
+    fprintf(stderr, "error: failed to mmap() %s: %s\n",
+	    file, strerror(errno));
+    free(place.gaps);
+    free(subpools);
+    close(fd);
+    return NULL;
+  }
+
+  chunk_job job = { chunks, NULL, header.chunks, 0, header.codec, fd,
+    offset, 0, place.delta ? &place : NULL
+  };
+  run_chunk_job(&job, unpack_chunks);
+  /* the raw words can be anywhere, so nothing is moved until every
+   * chunk is in */
+  if(place.delta != 0 && !job.failed) {
+    find_raw(&place);
+    job.next = 0;
+    run_chunk_job(&job, relocate_chunks);
+  }
+  close(fd);
+  void *first = (void *)(uintptr_t) (subpools[0].address + place.delta);
+  free(place.gaps);
+  free(subpools);
+  if(job.failed) {
+    fprintf(stderr, "error: failed to decompress image %s\n", file);
+    return NULL;
+  }
+  pool_relocation = place.delta;
+  return first + hdr + sizeof(subpool_t) + sizeof(pool_t);
+}
@@ -18,6 +18,8 @@
 #ifndef POOL_H
 #define POOL_H
 
+#include <stdint.h>
+
 extern size_t default_pool_size;
 
 typedef struct freed_t
@@ -39,6 +41,8 @@ typedef struct pool_t
 {
   subpool_t *pools;		/* first element in linked list */
   subpool_t *first;		/* first good subpool in list */
+  intptr_t *raw;		/* words pool_load() mustn't move */
+  size_t raw_count;
 } pool_t;
 
 /* Create a pool with a given minimal allocation size. Given a
@@ -57,11 +61,50 @@ void *pool_realloc (pool_t * source_pool, void * p, size_t new);
 /* Free memory back into the pool. */
 void pool_free (pool_t * pool, void *p);
 
+/* Total size of all the subpools. */
+size_t pool_size (pool_t * pool);
+
+/* Bytes free for allocation in the pool. When clear is set the free
+ * memory is zeroed as well, so it compresses away in an image. */
+size_t pool_free_size (pool_t * pool, int clear);
+
+void pool_seal (pool_t * pool);
+
+void pool_unseal (pool_t * pool);
+
+/* Fault in every page of the pool ahead of its first use. */
+size_t pool_touch (pool_t * pool);
+
+/* Whether the word W points into the pool, or looks like it does. */
+int pool_holds (pool_t * pool, uintptr_t w);
+
+/* Keep the addresses of the given words with the pool, so moving it
+ * with pool_load() leaves them alone. They hold raw data that only
+ * looks like a pointer into the pool. Returns -1 if the pool grew
+ * while they were stored, as a word that wasn't in it before may be
+ * now, and 0 otherwise. */
+int pool_set_raw (pool_t * pool, void **words, size_t count);
+
+/* Compression for pool_dump() with the in-tree LZ codec rather than
+ * a zlib level, to load faster at some cost in size. */
+#define POOL_LZ 100
+
 /* Dump entire pool to file that can be read back in later to the same
- * place in memory. */
+ * place in memory. With compress 0 the file is the pool as is, with
+ * pages of zeros left as holes. Otherwise it is compressed in chunks
+ * using POOL_LZ or zlib at the level given. */
 int pool_dump (pool_t * pool, char *file, int compress);
 
-/* Read the pool from the given file into memory. */
+/* Read the pool from the given file into memory. The pool goes back
+ * where it was saved from when that address space is free, otherwise
+ * somewhere else with every pointer into it adjusted to match. */
 void *pool_load (char * file, off_t offset);
 
+/* How far the last pool_load() moved the pool from where it was
+ * saved, zero when it went back in place. */
+extern intptr_t pool_relocation;
+
+/* When set, pool_load() always moves the pool, for testing. */
+extern int pool_relocate;
+
 #endif
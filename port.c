@@ -0,0 +1,771 @@
+/**
+ * Copyright 2010 Brian Taylor
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* bulk reading and writing on ports. these work straight on the stdio
+ * buffer of the underlying FILE rather than a character at a time. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __GLIBC__
+#include <stdio_ext.h>
+#endif
+
+#include "types.h"
+#include "gc.h"
+#include "interp.h"
+#include "bytevector.h"
+#include "socket.h"
+#include "port.h"
+
+/* stdio only honours a requested buffer size when it is handed the
+ * storage itself, so remember those buffers until the port closes.
+ * ports opened over an mmap()ed file keep their mapping here too. */
+typedef struct port_state {
+  FILE *stream;
+  char *buffer;
+  size_t size;
+  unsigned char *map;
+  long map_length;
+  struct port_state *next;
+} port_state;
+
+static port_state *port_states = NULL;
+
+static port_state *find_port_state(FILE * stream) {
+  port_state *ps;
+  for(ps = port_states; ps != NULL; ps = ps->next) {
+    if(ps->stream == stream) {
+      return ps;
+    }
+  }
+  return NULL;
+}
+
+static port_state *add_port_state(FILE * stream) {
+  port_state *ps = malloc(sizeof(port_state));
+  ps->stream = stream;
+  ps->buffer = NULL;
+  ps->size = 0;
+  ps->map = NULL;
+  ps->map_length = 0;
+  ps->next = port_states;
+  port_states = ps;
+  return ps;
+}
+
+/* called after the stream has been closed */
+void release_port_state(FILE * stream) {
+  port_state **link = &port_states;
+  while(*link != NULL) {
+    if((*link)->stream == stream) {
+      port_state *dead = *link;
+      *link = dead->next;
+      free(dead->buffer);
+      if(dead->map != NULL) {
+	munmap(dead->map, dead->map_length);
+      }
+      free(dead);
+      return;
+    }
+    link = &(*link)->next;
+  }
+}
+
+/* a port collected while open would leave its state behind for the
+ * next stream malloc() puts at the same address, and its buffer can't
+ * be freed while the stream is open, so the stream is closed here
+ * too. a closed port gave its state up when it was closed, and its
+ * stream's address may belong to a newer port by now, so it is left
+ * alone. so are ports with no state and the standard streams, which
+ * other port objects share. */
+void finalize_port(object * port) {
+  int input = is_input_port(port);
+  FILE *stream = input ? INPUT(port) : OUTPUT(port);
+  if(!(input ? is_input_port_opened(port) : is_output_port_opened(port))) {
+    return;
+  }
+  if(find_port_state(stream) == NULL || stream == stdin || stream == stdout
+     || stream == stderr) {
+    return;
+  }
+  if(input ? is_input_port_pipe(port) : is_output_port_pipe(port)) {
+    pclose(stream);
+  }
+  else {
+    fclose(stream);
+  }
+  if(input) {
+    set_input_port_opened(port, 0);
+  }
+  else {
+    set_output_port_opened(port, 0);
+  }
+  release_port_state(stream);
+}
+
+/* reads on a mapped port index straight into the mapping, keeping
+ * the stdio position in step so read-char and read-port still work */
+static port_state *mapped_port(FILE * stream) {
+  port_state *ps = find_port_state(stream);
+  return (ps != NULL && ps->map != NULL) ? ps : NULL;
+}
+
+/* claim up to WANT bytes at the current position of a mapped port */
+static long mapped_take(port_state * ps, long want, unsigned char **from) {
+  long pos = ftell(ps->stream);
+  long avail = ps->map_length - pos;
+  if(avail < 0) {
+    avail = 0;
+  }
+  if(want > avail) {
+    want = avail;
+  }
+  *from = ps->map + pos;
+  fseek(ps->stream, pos + want, SEEK_SET);
+  return want;
+}
+
+static FILE *port_stream(object * port) {
+  if(is_input_port(port)) {
+    return INPUT(port);
+  }
+  if(is_output_port(port)) {
+    return OUTPUT(port);
+  }
+  return NULL;
+}
+
+DEFUN1(set_port_buffer_size_proc) {
+  FILE *stream = port_stream(FIRST);
+  if(stream == NULL || !is_fixnum(SECOND) || LONG(SECOND) < 0) {
+    return throw_message("set-port-buffer-size! expects a port and a "
+			 "non-negative size");
+  }
+
+  int mode = _IOFBF;
+  if(n_args > 2) {
+    if(THIRD == make_symbol("line")) {
+      mode = _IOLBF;
+    }
+    else if(THIRD == make_symbol("none")) {
+      mode = _IONBF;
+    }
+    else if(THIRD != make_symbol("full")) {
+      return throw_message("set-port-buffer-size! mode must be full, "
+			   "line or none");
+    }
+  }
+
+  size_t size = LONG(SECOND);
+  char *buffer = NULL;
+  if(mode != _IONBF && size > 0) {
+    buffer = malloc(size);
+    if(buffer == NULL) {
+      return throw_message("set-port-buffer-size! cannot allocate %ld bytes",
+			   LONG(SECOND));
+    }
+  }
+
+  fflush(stream);
+  if(setvbuf(stream, buffer, mode, size) != 0) {
+    free(buffer);
+    return g->false;
+  }
+
+  port_state *ps = find_port_state(stream);
+  if(ps == NULL) {
+    ps = add_port_state(stream);
+    if(!is_socket_port(FIRST)) {
+      finalize_when_collected(FIRST);
+    }
+  }
+  free(ps->buffer);
+  ps->buffer = buffer;
+  ps->size = (mode == _IONBF) ? 0 : size;
+  return g->true;
+}
+
+DEFUN1(port_buffer_size_proc) {
+  FILE *stream = port_stream(FIRST);
+  if(stream == NULL) {
+    return throw_message("port-buffer-size expects a port");
+  }
+  port_state *ps = find_port_state(stream);
+  if(ps != NULL && (ps->buffer != NULL || ps->map == NULL)) {
+    return make_fixnum(ps->size);
+  }
+#ifdef __GLIBC__
+  /* zero until the first read or write allocates the buffer */
+  return make_fixnum(__fbufsize(stream));
+#else
+  return make_fixnum(BUFSIZ);
+#endif
+}
+
+/* the readers below also accept buffered socket ports */
+static int is_readable_port(object * obj) {
+  return is_input_port(obj) || is_socket_port(obj);
+}
+
+static port_state *mapped_input(object * port) {
+  return is_input_port(port) ? mapped_port(INPUT(port)) : NULL;
+}
+
+/* read up to N bytes, short only at end of stream or when a
+ * non-blocking socket has nothing more yet. SOCKET_AGAIN if it had
+ * nothing at all. */
+static long port_read(object * port, void *dst, long n) {
+  if(is_socket_port(port)) {
+    long got = socket_port_read(port, dst, n, 1);
+    return got == -1 ? 0 : got;
+  }
+  return fread(dst, 1, n, INPUT(port));
+}
+
+/* getline grows this as needed and it is reused for every line */
+static char *line_buffer = NULL;
+static size_t line_capacity = 0;
+
+DEFUN1(read_line_proc) {
+  if(is_socket_port(FIRST)) {
+    if(n_args > 1 && !is_fixnum(SECOND)) {
+      return throw_message("read-line expects a fixnum maximum length");
+    }
+    return socket_port_read_line(FIRST, n_args > 1 ? LONG(SECOND) : -1);
+  }
+  if(!is_input_port(FIRST)) {
+    return throw_message("read-line expects input port");
+  }
+
+  port_state *ps = mapped_port(INPUT(FIRST));
+  if(ps != NULL) {
+    long pos = ftell(ps->stream);
+    if(pos >= ps->map_length) {
+      return g->eof_object;
+    }
+    unsigned char *start = ps->map + pos;
+    unsigned char *newline = memchr(start, '\n', ps->map_length - pos);
+    long length = newline ? newline - start : ps->map_length - pos;
+    fseek(ps->stream, pos + length + (newline != NULL), SEEK_SET);
+    return make_counted_string((char *)start, length);
+  }
+
+  ssize_t length = getline(&line_buffer, &line_capacity, INPUT(FIRST));
+  if(length < 0) {
+    return g->eof_object;
+  }
+  if(length > 0 && line_buffer[length - 1] == '\n') {
+    --length;
+  }
+  return make_counted_string(line_buffer, length);
+}
+
+/* shrink a string read into oversized storage down to its contents */
+static object *trim_string(object * str, long length) {
+  if(length != STRLEN(str)) {
+    str->data.string.value = REALLOC(STRING(str), length + 1);
+    STRLEN(str) = length;
+    STRING(str)[length] = '\0';
+  }
+  return str;
+}
+
+DEFUN1(read_string_proc) {
+  if(!is_fixnum(FIRST) || LONG(FIRST) < 0 || !is_readable_port(SECOND)) {
+    return throw_message("read-string expects a count and input port");
+  }
+  long count = LONG(FIRST);
+  if(count == 0) {
+    return make_empty_string(0);
+  }
+
+  port_state *ps = mapped_input(SECOND);
+  if(ps != NULL) {
+    unsigned char *from;
+    long got = mapped_take(ps, count, &from);
+    return got == 0 ? g->eof_object : make_counted_string((char *)from, got);
+  }
+
+  object *str = make_empty_string(count);
+  long got = port_read(SECOND, STRING(str), count);
+  if(got == SOCKET_AGAIN) {
+    return socket_would_block();
+  }
+  if(got == 0) {
+    return g->eof_object;
+  }
+  return trim_string(str, got);
+}
+
+DEFUN1(read_block_proc) {
+  unsigned char *base;
+  long length;
+  if(is_string(FIRST)) {
+    base = (unsigned char *)STRING(FIRST);
+    length = STRLEN(FIRST);
+  }
+  else if(is_bytevector(FIRST)) {
+    base = BYTES(FIRST);
+    length = BVLEN(FIRST);
+  }
+  else {
+    return throw_message("read-block! expects a string or bytevector");
+  }
+  if(!is_readable_port(SECOND)) {
+    return throw_message("read-block! expects input port");
+  }
+
+  long start = 0, end = length;
+  if(n_args > 2) {
+    if(!is_fixnum(THIRD)) {
+      return throw_message("read-block! expects a fixnum start");
+    }
+    start = LONG(THIRD);
+  }
+  if(n_args > 3) {
+    if(!is_fixnum(FOURTH)) {
+      return throw_message("read-block! expects a fixnum end");
+    }
+    end = LONG(FOURTH);
+  }
+  if(start < 0 || end > length || start > end) {
+    return throw_message("read-block!: range %ld to %ld is invalid for "
+			 "buffer of length %ld", start, end, length);
+  }
+
+  long got;
+  port_state *ps = mapped_input(SECOND);
+  if(ps != NULL) {
+    unsigned char *from;
+    got = mapped_take(ps, end - start, &from);
+    memcpy(base + start, from, got);
+  }
+  else {
+    got = port_read(SECOND, base + start, end - start);
+  }
+  if(got == SOCKET_AGAIN) {
+    return socket_would_block();
+  }
+  if(got == 0 && end > start) {
+    return g->eof_object;
+  }
+  return make_fixnum(got);
+}
+
+DEFUN1(read_all_proc) {
+  if(!is_readable_port(FIRST)) {
+    return throw_message("read-all expects input port");
+  }
+
+  port_state *ps = mapped_input(FIRST);
+  if(ps != NULL) {
+    unsigned char *from;
+    long got = mapped_take(ps, ps->map_length, &from);
+    return make_counted_string((char *)from, got);
+  }
+  if(is_socket_port(FIRST)) {
+    return socket_port_read_all(FIRST);
+  }
+
+  long capacity = 65536, used = 0;
+  object *str = make_empty_string(capacity);
+  long got;
+  while((got = port_read(FIRST, STRING(str) + used, capacity - used)) > 0) {
+    used += got;
+    if(used == capacity) {
+      capacity *= 2;
+      str->data.string.value = REALLOC(STRING(str), capacity + 1);
+      STRLEN(str) = capacity;
+    }
+  }
+  return trim_string(str, used);
+}
+
+/* (open-mmap-input-port path [advice]) reads the file through a
+ * read-only mapping instead of read(). returns eof when the file
+ * cannot be opened, like open-input-port. */
+DEFUN1(open_mmap_input_port_proc) {
+  int advice = MADV_SEQUENTIAL;
+  if(!is_string(FIRST) || (n_args > 1 && !parse_madvise(SECOND, &advice))) {
+    return throw_message("open-mmap-input-port expects a path and optional "
+			 "advice");
+  }
+
+  int fd = open(STRING(FIRST), O_RDONLY);
+  if(fd < 0) {
+    return g->eof_object;
+  }
+  struct stat st;
+  if(fstat(fd, &st) < 0) {
+    close(fd);
+    return g->eof_object;
+  }
+  if(st.st_size == 0) {
+    /* nothing to map */
+    FILE *in = fdopen(fd, "r");
+    return in == NULL ? g->eof_object : make_input_port(in, 0);
+  }
+
+  unsigned char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    return g->eof_object;
+  }
+  madvise(map, st.st_size, advice);
+
+  FILE *in = fmemopen(map, st.st_size, "r");
+  if(in == NULL) {
+    munmap(map, st.st_size);
+    return g->eof_object;
+  }
+  port_state *ps = add_port_state(in);
+  ps->map = map;
+  ps->map_length = st.st_size;
+  object *port = make_input_port(in, 0);
+  finalize_when_collected(port);
+  return port;
+}
+
+static int is_writable_port(object * obj) {
+  return is_output_port(obj) || is_socket_port(obj);
+}
+
+static int is_closed_socket_port(object * obj) {
+  return is_socket_port(obj) && !socket_port_is_open(obj);
+}
+
+static void port_write(object * port, char *data, long n) {
+  if(is_socket_port(port)) {
+    socket_port_write(port, data, n);
+  }
+  else {
+    fwrite(data, 1, n, OUTPUT(port));
+  }
+}
+
+DEFUN1(write_string_proc) {
+  if(!is_string(FIRST) || !is_writable_port(SECOND)) {
+    return throw_message("write-string expects string and output port");
+  }
+  long start = 0, end = STRLEN(FIRST);
+  if(n_args > 2) {
+    if(!is_fixnum(THIRD)) {
+      return throw_message("write-string expects a fixnum start");
+    }
+    start = LONG(THIRD);
+  }
+  if(n_args > 3) {
+    if(!is_fixnum(FOURTH)) {
+      return throw_message("write-string expects a fixnum end");
+    }
+    end = LONG(FOURTH);
+  }
+  if(start < 0 || end > STRLEN(FIRST) || start > end) {
+    return throw_message("write-string: range %ld to %ld is invalid for "
+			 "string of length %ld", start, end, STRLEN(FIRST));
+  }
+
+  if(is_closed_socket_port(SECOND)) {
+    return throw_message("write-string: the socket port is closed");
+  }
+  port_write(SECOND, STRING(FIRST) + start, end - start);
+  return g->true;
+}
+
+DEFUN1(write_substring_proc) {
+  if(!is_string(FIRST) || !is_fixnum(SECOND) || !is_fixnum(THIRD)
+     || !is_writable_port(FOURTH)) {
+    return throw_message("write-substring expects string, start, end and "
+			 "output port");
+  }
+  long start = LONG(SECOND), end = LONG(THIRD);
+  if(start < 0 || end > STRLEN(FIRST) || start > end) {
+    return throw_message("write-substring: range %ld to %ld is invalid for "
+			 "string of length %ld", start, end, STRLEN(FIRST));
+  }
+
+  if(is_closed_socket_port(FOURTH)) {
+    return throw_message("write-substring: the socket port is closed");
+  }
+  port_write(FOURTH, STRING(FIRST) + start, end - start);
+  return g->true;
+}
+
+/* formatted output goes either to a port or into a string builder */
+typedef struct {
+  object *port;
+  object *builder;
+} sink;
+
+static void sink_write(sink * s, char *value, long length) {
+  if(s->port != NULL) {
+    port_write(s->port, value, length);
+  }
+  else {
+    string_builder_append(s->builder, value, length);
+  }
+}
+
+static void sink_puts(sink * s, char *value) {
+  sink_write(s, value, strlen(value));
+}
+
+static object *format_number(sink * s, object * num) {
+  char buffer[100];
+  if(is_fixnum(num)) {
+    snprintf(buffer, 100, "%ld", LONG(num));
+  }
+  else if(is_real(num)) {
+    snprintf(buffer, 100, "%.15lg", DOUBLE(num));
+  }
+  else if(is_small_fixnum(num)) {
+    snprintf(buffer, 100, "%ld", SMALL_FIXNUM(num));
+  }
+  else {
+    return throw_message("format: %%d expects a number");
+  }
+  sink_puts(s, buffer);
+  return g->true;
+}
+
+/* writes OBJ the way the print-object methods in clos.sch do. objects
+ * without a native printed form, such as class instances, are handed
+ * to FALLBACK which returns their printed form as a string. */
+static object *format_object(sink * s, object * obj, object * fallback) {
+  long ii;
+  object *result;
+
+  if(is_fixnum(obj) || is_small_fixnum(obj) || is_real(obj)) {
+    return format_number(s, obj);
+  }
+
+  switch (obj->type) {
+  case THE_EMPTY_LIST:
+    sink_puts(s, "()");
+    return g->true;
+  case BOOLEAN:
+    sink_puts(s, is_false(obj) ? "#f" : "#t");
+    return g->true;
+  case SYMBOL:
+    if(make_symbol(obj->data.symbol.value) != obj) {
+      sink_puts(s, "#:");
+    }
+    sink_puts(s, obj->data.symbol.value);
+    return g->true;
+  case CHARACTER:
+    switch (CHAR(obj)) {
+    case ' ':
+      sink_puts(s, "#\\space");
+      break;
+    case '\n':
+      sink_puts(s, "#\\newline");
+      break;
+    case '\t':
+      sink_puts(s, "#\\tab");
+      break;
+    default:
+      sink_puts(s, "#\\");
+      sink_write(s, &CHAR(obj), 1);
+    }
+    return g->true;
+  case STRING:{
+      char *str = STRING(obj);
+      long run = 0;
+      sink_puts(s, "\"");
+      for(ii = 0; ii < STRLEN(obj); ++ii) {
+	char *escape = NULL;
+	switch (str[ii]) {
+	case '\n':
+	  escape = "\\n";
+	  break;
+	case '\t':
+	  escape = "\\t";
+	  break;
+	case '"':
+	  escape = "\\\"";
+	  break;
+	case '\\':
+	  escape = "\\\\";
+	  break;
+	}
+	if(escape != NULL) {
+	  sink_write(s, str + run, ii - run);
+	  sink_puts(s, escape);
+	  run = ii + 1;
+	}
+      }
+      sink_write(s, str + run, ii - run);
+      sink_puts(s, "\"");
+      return g->true;
+    }
+  case PAIR:
+    sink_puts(s, "(");
+    for(;;) {
+      result = format_object(s, car(obj), fallback);
+      if(is_primitive_exception(result)) {
+	return result;
+      }
+      obj = cdr(obj);
+      if(is_pair(obj)) {
+	sink_puts(s, " ");
+      }
+      else {
+	break;
+      }
+    }
+    if(!is_the_empty_list(obj)) {
+      sink_puts(s, " . ");
+      result = format_object(s, obj, fallback);
+      if(is_primitive_exception(result)) {
+	return result;
+      }
+    }
+    sink_puts(s, ")");
+    return g->true;
+  case VECTOR:
+    sink_puts(s, "#(");
+    for(ii = 0; ii < VSIZE(obj); ++ii) {
+      if(ii > 0) {
+	sink_puts(s, " ");
+      }
+      result = format_object(s, VARRAY(obj)[ii], fallback);
+      if(is_primitive_exception(result)) {
+	return result;
+      }
+    }
+    sink_puts(s, ")");
+    return g->true;
+  default:
+    break;
+  }
+
+  object *args = cons(obj, g->empty_list);
+  push_root(&args);
+  result = apply(fallback, args);
+  push_root(&result);
+  if(is_string(result)) {
+    sink_write(s, STRING(result), STRLEN(result));
+  }
+  else if(!is_primitive_exception(result)) {
+    result = throw_message("format: printer did not return a string");
+  }
+  pop_root(&result);
+  pop_root(&args);
+  return result;
+}
+
+/* the directive engine behind printf and sprintf:
+ *   %a  the printed form of the argument, as print-object writes it
+ *   %s  strings and characters as they are, anything else like %a
+ *   %d  a number in decimal
+ *   %%  a literal percent sign
+ * unknown directives are copied through unchanged. */
+DEFUN1(format_proc) {
+  sink s;
+  if(is_closed_socket_port(FIRST)) {
+    return throw_message("format: the socket port is closed");
+  }
+  if(is_writable_port(FIRST)) {
+    s.port = FIRST;
+    s.builder = NULL;
+  }
+  else if(is_string_builder(FIRST)) {
+    s.port = NULL;
+    s.builder = FIRST;
+  }
+  else {
+    return throw_message("format expects output port or string builder");
+  }
+  if(!is_string(SECOND)) {
+    return throw_message("format expects a format string");
+  }
+
+  char *fmt = STRING(SECOND);
+  long len = STRLEN(SECOND);
+  object *fmt_args = THIRD;
+  object *fallback = FOURTH;
+  object *result;
+  long idx = 0, run = 0;
+
+  while(idx < len) {
+    if(fmt[idx] != '%' || idx + 1 == len) {
+      ++idx;
+      continue;
+    }
+
+    sink_write(&s, fmt + run, idx - run);
+    char directive = fmt[idx + 1];
+    idx += 2;
+    run = idx;
+
+    if(directive == '%') {
+      sink_puts(&s, "%");
+      continue;
+    }
+    if(directive != 'a' && directive != 's' && directive != 'd') {
+      sink_write(&s, fmt + idx - 2, 2);
+      continue;
+    }
+    if(!is_pair(fmt_args)) {
+      return throw_message("format: too few arguments for \"%s\"", fmt);
+    }
+
+    object *arg = car(fmt_args);
+    fmt_args = cdr(fmt_args);
+    if(directive == 'd') {
+      result = format_number(&s, arg);
+    }
+    else if(directive == 's' && is_string(arg)) {
+      sink_write(&s, STRING(arg), STRLEN(arg));
+      result = g->true;
+    }
+    else if(directive == 's' && is_character(arg)) {
+      sink_write(&s, &CHAR(arg), 1);
+      result = g->true;
+    }
+    else {
+      result = format_object(&s, arg, fallback);
+    }
+    if(is_primitive_exception(result)) {
+      return result;
+    }
+  }
+  sink_write(&s, fmt + run, len - run);
+  return g->true;
+}
+
+void init_port(definer defn) {
+#define add_procedure(scheme_name, c_name)			\
+  defn(scheme_name,						\
+       make_primitive_proc(c_name))
+
+  add_procedure("open-mmap-input-port", open_mmap_input_port_proc);
+  add_procedure("read-line", read_line_proc);
+  add_procedure("read-string", read_string_proc);
+  add_procedure("read-block!", read_block_proc);
+  add_procedure("read-all", read_all_proc);
+  add_procedure("write-string", write_string_proc);
+  add_procedure("write-substring", write_substring_proc);
+  add_procedure("%format", format_proc);
+  add_procedure("set-port-buffer-size!", set_port_buffer_size_proc);
+  add_procedure("port-buffer-size", port_buffer_size_proc);
+}
@@ -25,6 +25,7 @@
 #include "gc.h"
 /*temp*/
 #include "interp.h"
+#include "vm.h"
 
 char is_delimiter(int c) {
   return isspace(c) || c == EOF ||
@@ -447,3 +448,552 @@ object *lisp_read(FILE * in) {
     return throw_message("bad input. Unexpected '%c'", c);
   }
 }
+
+/* The buffer reader parses the syntax of read.sch straight out of a
+ * string or bytevector, including mapped files, without a stream
+ * in between. Reader macros defined in Scheme are called back with
+ * the buffer and the position after the macro character and hand
+ * back the datum and the position where they stopped. */
+
+typedef struct reader {
+  object *source;
+  const char *base;
+  long pos;
+  long end;
+} reader;
+
+enum { RC_ATOM, RC_SPACE, RC_MACRO };
+
+static char reader_class[256];
+
+/* token text with its escapes removed, shared by every read since a
+ * token never spans a callback */
+static char *scratch = NULL;
+static long scratch_size = 0;
+
+static object *read_datum(reader * r);
+
+static void reader_init_classes(void) {
+  int c;
+  for(c = 0; c < 256; ++c) {
+    reader_class[c] = isspace(c) ? RC_SPACE : RC_ATOM;
+  }
+  const char *macros = "()'`,\";#";
+  while(*macros) {
+    reader_class[(unsigned char)*macros++] = RC_MACRO;
+  }
+}
+
+static object *reader_macro(int c) {
+  object *fn = VARRAY(g->reader_macros)[c];
+  return fn == g->false ? NULL : fn;
+}
+
+static object *reader_dispatch_macro(int c) {
+  object *fn = VARRAY(g->reader_dispatch)[c];
+  return fn == g->false ? NULL : fn;
+}
+
+static int reader_delimiter(int c) {
+  return reader_class[c] != RC_ATOM || reader_macro(c);
+}
+
+static void scratch_push(long idx, char c) {
+  if(idx >= scratch_size) {
+    scratch_size = scratch_size ? scratch_size * 2 : 256;
+    scratch = realloc(scratch, scratch_size);
+  }
+  scratch[idx] = c;
+}
+
+static char reader_escape(char c) {
+  return c == 'n' ? '\n' : c == 't' ? '\t' : c;
+}
+
+/* skips whitespace, ; comments and #! lines, returning the next
+ * character or -1 at the end of the buffer */
+static int skip_atmosphere(reader * r) {
+  while(r->pos < r->end) {
+    unsigned char c = r->base[r->pos];
+    if(reader_class[c] == RC_SPACE) {
+      r->pos++;
+    }
+    else if(c == ';' || (c == '#' && r->pos + 1 < r->end &&
+			 r->base[r->pos + 1] == '!' &&
+			 !reader_macro('#') && !reader_dispatch_macro('!'))) {
+      while(r->pos < r->end && r->base[r->pos] != '\n') {
+	r->pos++;
+      }
+    }
+    else {
+      return c;
+    }
+  }
+  return -1;
+}
+
+/* scans an atom up to a delimiter, or up to STOP when reading a
+ * string. sets *text to the atom, in the buffer itself unless it had
+ * escapes. returns the length, or -1 if STOP never came */
+static long read_atom(reader * r, int stop, const char **text) {
+  long start = r->pos;
+  while(r->pos < r->end) {
+    unsigned char c = r->base[r->pos];
+    if(stop ? c == stop : reader_delimiter(c)) {
+      break;
+    }
+    if(c == '\\') {
+      break;
+    }
+    r->pos++;
+  }
+  if(r->pos == r->end || r->base[r->pos] != '\\') {
+    *text = r->base + start;
+    if(stop) {
+      if(r->pos == r->end) {
+	return -1;
+      }
+      r->pos++;
+    }
+    return r->pos - (stop ? 1 : 0) - start;
+  }
+
+  /* slow path: copy out with the escapes replaced */
+  long length = r->pos - start;
+  long ii;
+  for(ii = 0; ii < length; ++ii) {
+    scratch_push(ii, r->base[start + ii]);
+  }
+  while(r->pos < r->end) {
+    unsigned char c = r->base[r->pos];
+    if(stop ? c == stop : reader_delimiter(c)) {
+      break;
+    }
+    r->pos++;
+    if(c == '\\') {
+      if(r->pos == r->end) {
+	return -1;
+      }
+      c = reader_escape(r->base[r->pos++]);
+    }
+    scratch_push(length++, c);
+  }
+  if(stop) {
+    if(r->pos == r->end) {
+      return -1;
+    }
+    r->pos++;
+  }
+  *text = scratch;
+  return length;
+}
+
+static int integer_text(const char *text, long length) {
+  long ii = 0;
+  if(length > 1 && (text[0] == '-' || text[0] == '+')) {
+    ii = 1;
+  }
+  if(ii == length) {
+    return 0;
+  }
+  for(; ii < length; ++ii) {
+    if(!isdigit((unsigned char)text[ii])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* digits with at most one dot and at least one digit, optionally
+ * followed by an integer exponent, as real-string-list? decides */
+static int real_text(const char *text, long length) {
+  long ii = 0;
+  int saw_dot = 0, saw_digit = 0;
+  if(length > 0 && (text[0] == '-' || text[0] == '+')) {
+    ii = 1;
+  }
+  for(; ii < length; ++ii) {
+    char c = text[ii];
+    if(c == 'e') {
+      return saw_digit && integer_text(text + ii + 1, length - ii - 1);
+    }
+    else if(c == '.') {
+      if(saw_dot) {
+	return 0;
+      }
+      saw_dot = 1;
+    }
+    else if(isdigit((unsigned char)c)) {
+      saw_digit = 1;
+    }
+    else {
+      return 0;
+    }
+  }
+  return saw_dot && saw_digit;
+}
+
+static object *parse_integer(const char *text, long length, int base) {
+  long ii = 0, value = 0;
+  int negative = 0;
+  if(length > 1 && (text[0] == '-' || text[0] == '+')) {
+    negative = text[0] == '-';
+    ii = 1;
+  }
+  if(ii == length) {
+    return throw_message("invalid integer '%.*s'", (int)length, text);
+  }
+  for(; ii < length; ++ii) {
+    int c = tolower((unsigned char)text[ii]);
+    int digit = isdigit(c) ? c - '0' : isalpha(c) ? c - 'a' + 10 : base;
+    if(digit >= base) {
+      return throw_message("invalid integer '%.*s'", (int)length, text);
+    }
+    value = value * base + digit;
+  }
+  return make_fixnum(negative ? -value : value);
+}
+
+static object *read_token(reader * r) {
+  const char *text;
+  long length = read_atom(r, 0, &text);
+
+  if(integer_text(text, length)) {
+    return parse_integer(text, length, 10);
+  }
+  if(real_text(text, length)) {
+    char number[128];
+    if(length >= (long)sizeof(number)) {
+      return throw_message("real exceeded %d chars", (int)sizeof(number));
+    }
+    memcpy(number, text, length);
+    number[length] = '\0';
+    return make_real(strtod(number, NULL));
+  }
+
+  object *sym = make_symbol_n(text, length);
+  if(length > 0 && text[0] == ':') {
+    /* keywords evaluate to themselves */
+    push_root(&sym);
+    vm_definer(SYMBOL(sym), sym);
+    pop_root(&sym);
+  }
+  return sym;
+}
+
+static object *read_string(reader * r) {
+  const char *text;
+  long length = read_atom(r, '"', &text);
+  if(length < 0) {
+    return throw_message("unexpected eof in string");
+  }
+  return make_counted_string((char *)text, length);
+}
+
+/* runs a reader macro written in Scheme, which gets the buffer and
+ * the position after the macro character and returns the datum
+ * consed onto the position where it left off */
+static object *read_callback(reader * r, object * fn) {
+  object *args = make_fixnum(r->pos);
+  push_root(&args);
+  args = cons(args, g->empty_list);
+  args = cons(r->source, args);
+  object *result = apply(fn, args);
+  pop_root(&args);
+
+  if(is_primitive_exception(result)) {
+    return result;
+  }
+  if(!is_pair(result) || !is_fixnum(CDR(result)) ||
+     LONG(CDR(result)) < r->pos || LONG(CDR(result)) > r->end) {
+    return throw_message("reader macro must return (datum . position)");
+  }
+  r->pos = LONG(CDR(result));
+  return CAR(result);
+}
+
+/* reads list elements up to CLOSE, consing onto the tail so a long
+ * list costs no stack */
+static object *read_list(reader * r, int close) {
+  object *head = g->empty_list;
+  object *tail = NULL;
+  object *item = NULL;
+  push_root(&head);
+  push_root(&item);
+
+  for(;;) {
+    int c = skip_atmosphere(r);
+    if(c < 0) {
+      head = throw_message("unexpected eof in list");
+      break;
+    }
+    if(c == close) {
+      r->pos++;
+      break;
+    }
+
+    item = read_datum(r);
+    if(item == NULL) {
+      head = throw_message("unexpected eof in list");
+      break;
+    }
+    if(is_primitive_exception(item)) {
+      head = item;
+      break;
+    }
+
+    if(is_symbol(item) && strcmp(SYMBOL(item), ".") == 0) {
+      item = read_datum(r);
+      if(item == NULL || is_primitive_exception(item)) {
+	head = item ? item : throw_message("unexpected eof in list");
+	break;
+      }
+      if(skip_atmosphere(r) != close) {
+	head = throw_message("invalid improper list");
+	break;
+      }
+      r->pos++;
+      if(tail) {
+	set_cdr(tail, item);
+      }
+      else {
+	head = item;
+      }
+      break;
+    }
+
+    item = cons(item, g->empty_list);
+    if(tail) {
+      set_cdr(tail, item);
+    }
+    else {
+      head = item;
+    }
+    tail = item;
+  }
+
+  pop_root(&item);
+  pop_root(&head);
+  return head;
+}
+
+static object *read_quoted(reader * r, object * quote) {
+  object *datum = read_datum(r);
+  if(datum == NULL) {
+    return throw_message("unexpected eof after %s", SYMBOL(quote));
+  }
+  if(is_primitive_exception(datum)) {
+    return datum;
+  }
+  push_root(&datum);
+  datum = cons(datum, g->empty_list);
+  datum = cons(quote, datum);
+  pop_root(&datum);
+  return datum;
+}
+
+static object *read_character_literal(reader * r) {
+  if(r->pos == r->end) {
+    return throw_message("incomplete character literal");
+  }
+  char c = r->base[r->pos++];
+  char next = r->pos < r->end ? r->base[r->pos] : 0;
+  const char *text;
+  if(c == 'n' && next == 'e') {
+    read_atom(r, 0, &text);
+    return make_character('\n');
+  }
+  if(c == 's' && next == 'p') {
+    read_atom(r, 0, &text);
+    return make_character(' ');
+  }
+  if(c == 't' && next == 'a') {
+    read_atom(r, 0, &text);
+    return make_character('\t');
+  }
+  return make_character(c);
+}
+
+static object *read_dispatch(reader * r) {
+  if(r->pos == r->end) {
+    return throw_message("unexpected eof after #");
+  }
+  unsigned char c = r->base[r->pos++];
+  object *fn = reader_dispatch_macro(c);
+  if(fn) {
+    return read_callback(r, fn);
+  }
+
+  const char *text;
+  long length;
+  object *obj;
+  switch (c) {
+  case 't':
+    return g->true;
+  case 'f':
+    return g->false;
+  case '\\':
+    return read_character_literal(r);
+  case '(':
+    obj = read_list(r, ')');
+    if(is_primitive_exception(obj)) {
+      return obj;
+    }
+    push_root(&obj);
+    obj = list_to_vector(obj);
+    pop_root(&obj);
+    return obj;
+  case 'b':
+  case 'B':
+    length = read_atom(r, 0, &text);
+    return parse_integer(text, length, 2);
+  case 'o':
+  case 'O':
+    length = read_atom(r, 0, &text);
+    return parse_integer(text, length, 8);
+  case 'x':
+  case 'X':
+    length = read_atom(r, 0, &text);
+    return parse_integer(text, length, 16);
+  case ':':
+    read_atom(r, 0, &text);
+    return make_uninterned_symbol();
+  default:
+    return throw_message("unknown dispatch macro #%c", c);
+  }
+}
+
+/* the next datum, or NULL when only whitespace and comments remain */
+static object *read_datum(reader * r) {
+  int c = skip_atmosphere(r);
+  if(c < 0) {
+    return NULL;
+  }
+
+  object *fn = reader_macro(c);
+  if(fn) {
+    r->pos++;
+    return read_callback(r, fn);
+  }
+
+  switch (c) {
+  case '(':
+    r->pos++;
+    return read_list(r, ')');
+  case ')':
+    r->pos++;
+    return throw_message("read unexpected ')'");
+  case '\'':
+    r->pos++;
+    return read_quoted(r, g->quote_symbol);
+  case '`':
+    r->pos++;
+    return read_quoted(r, g->quasiquote_symbol);
+  case ',':
+    r->pos++;
+    if(r->pos < r->end && r->base[r->pos] == '@') {
+      r->pos++;
+      return read_quoted(r, g->unquotesplicing_symbol);
+    }
+    return read_quoted(r, g->unquote_symbol);
+  case '"':
+    r->pos++;
+    return read_string(r);
+  case '#':
+    r->pos++;
+    return read_dispatch(r);
+  default:
+    return read_token(r);
+  }
+}
+
+/* (%read-buffer buffer [start [end]]) reads the datum at START in a
+ * string or bytevector and returns it consed onto the position just
+ * past it, or eof when nothing but whitespace is left */
+DEFUN1(read_buffer_proc) {
+  object *source = FIRST;
+  reader r;
+  if(reader_class[' '] != RC_SPACE) {
+    /* statics do not live in the image, so build this on first use */
+    reader_init_classes();
+  }
+  r.source = source;
+  if(is_string(source)) {
+    r.base = STRING(source);
+    r.end = STRLEN(source);
+  }
+  else if(is_bytevector(source)) {
+    r.base = (const char *)BYTES(source);
+    r.end = BVLEN(source);
+  }
+  else {
+    return throw_message("%%read-buffer expects a string or bytevector");
+  }
+
+  r.pos = 0;
+  if(n_args > 1) {
+    if(!is_fixnum(SECOND)) {
+      return throw_message("%%read-buffer expects a fixnum start");
+    }
+    r.pos = LONG(SECOND);
+  }
+  if(n_args > 2) {
+    if(!is_fixnum(THIRD)) {
+      return throw_message("%%read-buffer expects a fixnum end");
+    }
+    r.end = LONG(THIRD) < r.end ? LONG(THIRD) : r.end;
+  }
+  if(r.pos < 0 || r.pos > r.end) {
+    return throw_message("%%read-buffer start out of range");
+  }
+
+  object *datum = read_datum(&r);
+  if(datum == NULL) {
+    return g->eof_object;
+  }
+  if(is_primitive_exception(datum)) {
+    return datum;
+  }
+  push_root(&datum);
+  object *next = make_fixnum(r.pos);
+  push_root(&next);
+  object *result = cons(datum, next);
+  pop_root(&next);
+  pop_root(&datum);
+  return result;
+}
+
+static object *set_reader_table(object * table, object * args, long n_args,
+				long stack_top, char *who) {
+  if(n_args != 2 || !is_character(FIRST)) {
+    return throw_message("%s expects a character and a procedure or #f",
+			 who);
+  }
+  write_barrier(table);
+  VARRAY(table)[(unsigned char)CHAR(FIRST)] = SECOND;
+  return g->true;
+}
+
+/* (%set-reader-macro! char fn) has the buffer reader call FN for
+ * CHAR, or parse CHAR itself again when FN is #f */
+DEFUN1(set_reader_macro_proc) {
+  return set_reader_table(g->reader_macros, args, n_args, stack_top,
+			  "%set-reader-macro!");
+}
+
+/* (%set-reader-dispatch-macro! char fn) is the same for #CHAR */
+DEFUN1(set_reader_dispatch_macro_proc) {
+  return set_reader_table(g->reader_dispatch, args, n_args, stack_top,
+			  "%set-reader-dispatch-macro!");
+}
+
+void init_read(definer defn) {
+#define add_procedure(scheme_name, c_name)			\
+  defn(scheme_name,						\
+       make_primitive_proc(c_name))
+
+  add_procedure("%read-buffer", read_buffer_proc);
+  add_procedure("%set-reader-macro!", set_reader_macro_proc);
+  add_procedure("%set-reader-dispatch-macro!",
+		set_reader_dispatch_macro_proc);
+}
@@ -20,6 +20,8 @@
 object *obj_read(FILE *in);
 object *string_to_number(char * str);
 
+void init_read(definer defn);
+
 extern char* prompt;
 
 #endif
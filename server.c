@@ -0,0 +1,392 @@
+/**
+ * Copyright 2010 Brian Taylor
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* a fork server. the image is booted once and each job sent by
+ * bsch-client runs in a child forked from it, so jobs start with the
+ * heap already warm and share its pages with the server instead of
+ * loading their own. the client's stdio travels over the socket with
+ * SCM_RIGHTS and the child's wait status goes back the same way. */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "server.h"
+
+extern char **environ;
+
+typedef struct job {
+  pid_t pid;
+  int conn;			/* where the wait status goes */
+} job;
+
+static job *jobs = NULL;
+static size_t njobs = 0, jobs_size = 0;
+
+/* how long a client has to send the whole of its job */
+#define JOB_TIMEOUT_MS 5000
+
+/* A connection whose job is still arriving. Its bytes are read as
+ * they come, so a client that stalls mid-request holds up nobody. */
+typedef struct pending {
+  int conn;
+  long long deadline;
+  int fds[3];			/* -1 until the header brings them */
+  job_header h;
+  int have_header;
+  char *strings;
+  size_t got;
+} pending;
+
+static pending *pendings = NULL;
+static size_t npendings = 0, pendings_size = 0;
+
+static int listener = -1;
+static int sigchld_pipe[2];
+static char *socket_path;
+
+static void on_sigchld(int sig) {
+  int saved = errno;
+  (void) sig;
+  if (write(sigchld_pipe[1], "", 1) < 0) {
+    /* the pipe is full, so a wakeup is already pending */
+  }
+  errno = saved;
+}
+
+static void on_sigterm(int sig) {
+  (void) sig;
+  unlink(socket_path);
+  _exit(EXIT_SUCCESS);
+}
+
+/* Bind under a temporary name and rename into place once listening,
+ * so a client never finds a socket that refuses it. */
+static int listen_unix(char *path) {
+  struct sockaddr_un addr;
+  char tmp[sizeof(addr.sun_path)];
+  if (snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long) getpid())
+      >= (int) sizeof(tmp)) {
+    fprintf(stderr, "server: socket path too long: %s\n", path);
+    return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("server: socket");
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, tmp);
+  unlink(tmp);
+  if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+      || listen(fd, SOMAXCONN) < 0 || rename(tmp, path) < 0) {
+    fprintf(stderr, "server: %s: %s\n", path, strerror(errno));
+    unlink(tmp);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static long long now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* Split n strings off the front of *strings, which has *left bytes,
+ * into a NULL terminated vector. */
+static char **split_strings(char **strings, size_t *left, uint32_t n) {
+  char **vec = malloc((n + 1) * sizeof(char *));
+  uint32_t i;
+  for (i = 0; i < n; i++) {
+    char *end = memchr(*strings, '\0', *left);
+    if (end == NULL) {
+      free(vec);
+      return NULL;
+    }
+    vec[i] = *strings;
+    *left -= end + 1 - *strings;
+    *strings = end + 1;
+  }
+  vec[n] = NULL;
+  return vec;
+}
+
+/* Receive the job_header and the client's three stdio descriptors.
+ * Returns 0 if they haven't arrived yet and -1 if the client sent
+ * anything else. */
+static int read_header(pending *p) {
+  char control[CMSG_SPACE(3 * sizeof(int))];
+  struct iovec iov = { &p->h, sizeof(p->h) };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t n = recvmsg(p->conn, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return 0;
+  if (n <= 0)
+    return -1;
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET
+      || cmsg->cmsg_type != SCM_RIGHTS)
+    return -1;
+  int nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+  if (nfds != 3 || n != sizeof(p->h) || p->h.size > JOB_MAX_SIZE
+      || p->h.argc > p->h.size || p->h.envc > p->h.size
+      || (msg.msg_flags & MSG_CTRUNC)) {
+    int i;
+    for (i = 0; i < nfds; i++)
+      close(((int *) CMSG_DATA(cmsg))[i]);
+    return -1;
+  }
+  memcpy(p->fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+  p->have_header = 1;
+  p->strings = malloc(p->h.size + 1);
+  return 1;
+}
+
+/* Read whatever of a job has arrived on p->conn: first the header and
+ * descriptors, then its directory, arguments and environment. Returns
+ * 1 once they are all in, handing them over, 0 while more is to come
+ * and -1 if the client sent anything else. */
+static int read_job(pending *p, int fds[3], char **cwd, char ***argv,
+		    char ***envp) {
+  if (!p->have_header) {
+    int r = read_header(p);
+    if (r <= 0)
+      return r;
+  }
+
+  while (p->got < p->h.size) {
+    ssize_t n = recv(p->conn, p->strings + p->got, p->h.size - p->got,
+		     MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+      return 0;
+    if (n <= 0)
+      return -1;
+    p->got += n;
+  }
+
+  char *strings = p->strings;
+  size_t left = p->h.size;
+  strings[p->h.size] = '\0';
+  *cwd = strings;
+  left -= strlen(strings) + 1;
+  strings += strlen(strings) + 1;
+  if (left > p->h.size
+      || (*argv = split_strings(&strings, &left, p->h.argc)) == NULL)
+    return -1;
+  if ((*envp = split_strings(&strings, &left, p->h.envc)) == NULL) {
+    free(*argv);
+    return -1;
+  }
+  memcpy(fds, p->fds, 3 * sizeof(int));
+  p->strings = NULL;
+  p->fds[0] = p->fds[1] = p->fds[2] = -1;
+  return 1;
+}
+
+static void add_pending(int conn) {
+  if (npendings == pendings_size) {
+    pendings_size = pendings_size ? pendings_size * 2 : 16;
+    pendings = realloc(pendings, pendings_size * sizeof(pending));
+  }
+  pending *p = &pendings[npendings++];
+  memset(p, 0, sizeof(*p));
+  p->conn = conn;
+  p->deadline = now_ms() + JOB_TIMEOUT_MS;
+  p->fds[0] = p->fds[1] = p->fds[2] = -1;
+}
+
+/* Forget pending i, closing what it holds unless its job is being
+ * started from it. */
+static void remove_pending(size_t i, int close_conn) {
+  pending *p = &pendings[i];
+  int j;
+  for (j = 0; j < 3; j++)
+    if (p->fds[j] >= 0)
+      close(p->fds[j]);
+  free(p->strings);
+  if (close_conn)
+    close(p->conn);
+  pendings[i] = pendings[--npendings];
+}
+
+static void reply(int conn, int status) {
+  send(conn, &status, sizeof(status), MSG_NOSIGNAL);
+  close(conn);
+}
+
+static void reap_jobs() {
+  pid_t pid;
+  int status;
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    size_t i;
+    for (i = 0; i < njobs; i++)
+      if (jobs[i].pid == pid) {
+	reply(jobs[i].conn, status);
+	jobs[i] = jobs[--njobs];
+	break;
+      }
+  }
+}
+
+static void add_job(pid_t pid, int conn) {
+  if (njobs == jobs_size) {
+    jobs_size = jobs_size ? jobs_size * 2 : 16;
+    jobs = realloc(jobs, jobs_size * sizeof(job));
+  }
+  jobs[njobs].pid = pid;
+  jobs[njobs].conn = conn;
+  njobs++;
+}
+
+/* Turn the freshly forked child into the job: drop everything the
+ * server was holding and take on the client's surroundings. */
+static void become_job(int conn, int fds[3], char *cwd, char **envp) {
+  size_t i;
+  signal(SIGCHLD, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  close(listener);
+  close(sigchld_pipe[0]);
+  close(sigchld_pipe[1]);
+  for (i = 0; i < njobs; i++)
+    close(jobs[i].conn);
+  njobs = 0;
+  while (npendings > 0)
+    remove_pending(npendings - 1, 1);
+  close(conn);
+
+  for (i = 0; i < 3; i++)
+    if (dup2(fds[i], i) < 0)
+      _exit(127);
+  for (i = 0; i < 3; i++)
+    if (fds[i] > 2)
+      close(fds[i]);
+  if (chdir(cwd) < 0) {
+    fprintf(stderr, "bsch: %s: %s\n", cwd, strerror(errno));
+    _exit(127);
+  }
+  environ = envp;
+}
+
+char **fork_server(char *path) {
+  socket_path = path;
+  listener = listen_unix(path);
+  if (listener < 0 || pipe2(sigchld_pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+    exit(EXIT_FAILURE);
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_sigchld;
+  sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &sa, NULL);
+  sa.sa_handler = on_sigterm;
+  sa.sa_flags = 0;
+  sigaction(SIGTERM, &sa, NULL);
+
+  struct pollfd *pfds = NULL;
+  size_t pfds_size = 0;
+  while (1) {
+    size_t i, npfds = 2 + npendings;
+    if (npfds > pfds_size) {
+      pfds_size = npfds * 2;
+      pfds = realloc(pfds, pfds_size * sizeof(struct pollfd));
+    }
+    pfds[0] = (struct pollfd) {listener, POLLIN, 0};
+    pfds[1] = (struct pollfd) {sigchld_pipe[0], POLLIN, 0};
+    long long now = now_ms(), wait = -1;
+    for (i = 0; i < npendings; i++) {
+      pfds[2 + i] = (struct pollfd) {pendings[i].conn, POLLIN, 0};
+      long long left = pendings[i].deadline - now;
+      if (wait < 0 || left < wait)
+	wait = left < 0 ? 0 : left;
+    }
+    if (poll(pfds, npfds, wait) < 0) {
+      if (errno == EINTR)
+	continue;
+      perror("server: poll");
+      exit(EXIT_FAILURE);
+    }
+
+    if (pfds[1].revents) {
+      char drain[64];
+      while (read(sigchld_pipe[0], drain, sizeof(drain)) > 0);
+      reap_jobs();
+    }
+
+    /* backwards, since removing one moves the last into its place */
+    now = now_ms();
+    for (i = npfds - 2; i-- > 0;) {
+      int fds[3];
+      char *cwd, **argv, **envp;
+      int r = 0;
+      if (pfds[2 + i].revents)
+	r = read_job(&pendings[i], fds, &cwd, &argv, &envp);
+      if (r < 0 || (r == 0 && pendings[i].deadline <= now)) {
+	remove_pending(i, 1);
+	continue;
+      }
+      if (r == 0)
+	continue;
+      int conn = pendings[i].conn;
+      remove_pending(i, 0);
+
+      fflush(NULL);
+      pid_t pid = fork();
+      if (pid == 0) {
+	become_job(conn, fds, cwd, envp);
+	return argv;
+      }
+
+      close(fds[0]);
+      close(fds[1]);
+      close(fds[2]);
+      free(cwd);
+      free(argv);
+      free(envp);
+      if (pid < 0) {
+	perror("server: fork");
+	reply(conn, 127 << 8);
+      } else {
+	add_job(pid, conn);
+      }
+    }
+
+    if (pfds[0].revents) {
+      int conn = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+      if (conn >= 0)
+	add_pending(conn);
+    }
+  }
+}
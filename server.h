@@ -0,0 +1,39 @@
+/**
+ * Copyright 2010 Brian Taylor
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+
+/* A job is asked for with a job_header carrying the client's stdin,
+ * stdout and stderr, followed by the working directory, argc
+ * arguments and envc environment entries, each ending in a NUL. The
+ * reply is the job's wait status as an int. */
+typedef struct job_header {
+  uint32_t size;		/* bytes of strings after the header */
+  uint32_t argc;
+  uint32_t envc;
+} job_header;
+
+#define JOB_MAX_SIZE (1024 * 1024)
+
+/* Serve jobs on the Unix socket at path, forking a child for each.
+ * Only returns in a child, with the client's stdio, directory and
+ * environment, giving the arguments it was sent. */
+char **fork_server(char *path);
+
+#endif
@@ -14,62 +14,690 @@
  * limitations under the License.
  */
 
+#define _GNU_SOURCE		/* splice */
+
 #include "types.h"
 #include "gc.h"
 #include "interp.h"
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "socket.h"
+
+/* a socket port buffers both directions of a connected socket so
+ * reading a line or writing a response costs a handful of syscalls
+ * rather than one per byte. the buffers grow when a non-blocking
+ * socket runs dry mid-line or the peer stops reading, so nothing is
+ * consumed or dropped when an operation would block. */
+typedef struct socket_port {
+  int fd;
+  int open;
+  long size;
+  unsigned char *in;
+  long in_pos;
+  long in_end;
+  long in_capacity;
+  unsigned char *out;
+  long out_len;
+  long out_capacity;
+} socket_port;
+
+#define DEFAULT_SOCKET_BUFFER 8192
+
+static int would_block(void) {
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+object *socket_would_block(void) {
+  return make_symbol("would-block");
+}
+
+object *make_socket_port(int fd, long size) {
+  socket_port *sp = malloc(sizeof(socket_port));
+  sp->fd = fd;
+  sp->open = 1;
+  sp->size = size > 0 ? size : DEFAULT_SOCKET_BUFFER;
+  sp->in = malloc(sp->size);
+  sp->in_pos = sp->in_end = 0;
+  sp->in_capacity = sp->size;
+  sp->out = malloc(sp->size);
+  sp->out_len = 0;
+  sp->out_capacity = sp->size;
+
+  object *obj = alloc_object(1);
+  obj->type = SOCKET_PORT;
+  SOCKET_STATE(obj) = sp;
+  return obj;
+}
+
+/* unflushed output is lost when an unreachable port is collected */
+void free_socket_port(object * port) {
+  socket_port *sp = SOCKET_STATE(port);
+  if(sp->open) {
+    close(sp->fd);
+  }
+  free(sp->in);
+  free(sp->out);
+  free(sp);
+}
+
+int socket_port_is_open(object * port) {
+  return SOCKET_STATE(port)->open;
+}
+
+int socket_port_fd(object * port) {
+  return SOCKET_STATE(port)->fd;
+}
+
+long socket_port_pending(object * port) {
+  socket_port *sp = SOCKET_STATE(port);
+  return sp->in_end - sp->in_pos;
+}
+
+long socket_port_pending_output(object * port) {
+  return SOCKET_STATE(port)->out_len;
+}
+
+/* read() once more onto the end of the receive buffer, keeping what
+ * is already there. returns the bytes added, 0 at end of stream,
+ * SOCKET_AGAIN if the socket would block or -1 on error */
+static long socket_more(socket_port * sp) {
+  long rb;
+  if(!sp->open) {
+    return 0;
+  }
+  if(sp->in_pos == sp->in_end) {
+    sp->in_pos = sp->in_end = 0;
+  }
+  else if(sp->in_pos > 0 && sp->in_end == sp->in_capacity) {
+    memmove(sp->in, sp->in + sp->in_pos, sp->in_end - sp->in_pos);
+    sp->in_end -= sp->in_pos;
+    sp->in_pos = 0;
+  }
+  if(sp->in_end == sp->in_capacity) {
+    sp->in_capacity *= 2;
+    sp->in = realloc(sp->in, sp->in_capacity);
+  }
+  do {
+    rb = read(sp->fd, sp->in + sp->in_end, sp->in_capacity - sp->in_end);
+  } while(rb < 0 && errno == EINTR);
+  if(rb < 0) {
+    return would_block() ? SOCKET_AGAIN : -1;
+  }
+  sp->in_end += rb;
+  return rb;
+}
+
+/* bytes buffered, reading once if there are none */
+static long socket_fill(socket_port * sp) {
+  if(sp->in_pos < sp->in_end) {
+    return sp->in_end - sp->in_pos;
+  }
+  return socket_more(sp);
+}
+
+/* direct access to the receive buffer for parsers that want to look
+ * at a whole message before consuming it */
+long socket_port_peek(object * port, unsigned char **data) {
+  socket_port *sp = SOCKET_STATE(port);
+  *data = sp->in + sp->in_pos;
+  return sp->in_end - sp->in_pos;
+}
+
+long socket_port_more_input(object * port) {
+  return socket_more(SOCKET_STATE(port));
+}
+
+void socket_port_consume(object * port, long n) {
+  SOCKET_STATE(port)->in_pos += n;
+}
+
+int socket_port_getc(object * port) {
+  socket_port *sp = SOCKET_STATE(port);
+  long avail = socket_fill(sp);
+  if(avail <= 0) {
+    return avail == SOCKET_AGAIN ? SOCKET_AGAIN : EOF;
+  }
+  return sp->in[sp->in_pos++];
+}
+
+/* one character of pushback, as ungetc() guarantees */
+int socket_port_ungetc(object * port, int ch) {
+  socket_port *sp = SOCKET_STATE(port);
+  if(sp->in_pos == sp->in_end) {
+    sp->in_pos = sp->in_end = 0;
+  }
+  if(sp->in_pos > 0) {
+    sp->in[--sp->in_pos] = ch;
+  }
+  else if(sp->in_end < sp->in_capacity) {
+    memmove(sp->in + 1, sp->in, sp->in_end++);
+    sp->in[0] = ch;
+  }
+  else {
+    return EOF;
+  }
+  return ch;
+}
+
+/* copy up to N bytes out, reading from the socket as needed. unless
+ * FILL is set it stops after the first read() that returns data, the
+ * way read() itself does. a short count is returned when the socket
+ * would block after some data arrived, SOCKET_AGAIN when none did. */
+long socket_port_read(object * port, void *dst, long n, int fill) {
+  socket_port *sp = SOCKET_STATE(port);
+  long got = 0;
+  while(got < n) {
+    long avail = socket_fill(sp);
+    if(avail <= 0) {
+      if(got > 0) {
+	return got;
+      }
+      return avail < 0 ? avail : 0;
+    }
+    if(avail > n - got) {
+      avail = n - got;
+    }
+    memcpy((char *)dst + got, sp->in + sp->in_pos, avail);
+    sp->in_pos += avail;
+    got += avail;
+    if(!fill) {
+      break;
+    }
+  }
+  return got;
+}
+
+/* the line is only consumed once its newline (or the end of stream)
+ * has arrived; until then a non-blocking port answers would-block and
+ * keeps the partial line buffered for the next attempt. a line longer
+ * than a non-negative MAX is bad, so a peer can't grow the buffer
+ * without bound. */
+object *socket_port_read_line(object * port, long max) {
+  socket_port *sp = SOCKET_STATE(port);
+  long scanned = 0;
+  unsigned char *newline;
+
+  for(;;) {
+    unsigned char *start = sp->in + sp->in_pos + scanned;
+    newline = memchr(start, '\n', sp->in_end - sp->in_pos - scanned);
+    if(newline) {
+      break;
+    }
+    scanned = sp->in_end - sp->in_pos;
+    if(max >= 0 && scanned > max) {
+      return make_symbol("bad");
+    }
+    long rb = socket_more(sp);
+    if(rb == SOCKET_AGAIN) {
+      return socket_would_block();
+    }
+    if(rb <= 0) {
+      if(sp->in_end == sp->in_pos) {
+	return g->eof_object;
+      }
+      break;
+    }
+  }
+
+  unsigned char *start = sp->in + sp->in_pos;
+  long length = newline ? newline - start : sp->in_end - sp->in_pos;
+  if(max >= 0 && length > max) {
+    return make_symbol("bad");
+  }
+  sp->in_pos += length + (newline != NULL);
+  return make_counted_string((char *)start, length);
+}
+
+/* everything up to the end of stream. like a line, it accumulates in
+ * the receive buffer until complete */
+object *socket_port_read_all(object * port) {
+  socket_port *sp = SOCKET_STATE(port);
+  long rb;
+  while((rb = socket_more(sp)) > 0) {
+  }
+  if(rb == SOCKET_AGAIN) {
+    return socket_would_block();
+  }
+  object *str = make_counted_string((char *)sp->in + sp->in_pos,
+				    sp->in_end - sp->in_pos);
+  sp->in_pos = sp->in_end = 0;
+  return str;
+}
+
+/* send as much as the socket takes. returns the bytes sent, stopping
+ * early only if a non-blocking socket is full, or -1 on error */
+static long socket_send_some(socket_port * sp, const unsigned char *data,
+			     long n) {
+  long sent = 0;
+  while(sent < n) {
+    long wb = send(sp->fd, data + sent, n - sent, MSG_NOSIGNAL);
+    if(wb < 0 && errno == ENOTSOCK) {
+      /* pipes and files work too */
+      wb = write(sp->fd, data + sent, n - sent);
+    }
+    if(wb < 0) {
+      if(errno == EINTR) {
+	continue;
+      }
+      return would_block() ? sent : -1;
+    }
+    sent += wb;
+  }
+  return sent;
+}
+
+/* returns 0 once everything queued is sent, SOCKET_AGAIN if a
+ * non-blocking socket filled up first (the rest stays queued) or -1 on
+ * error, which discards the queue */
+int socket_port_flush(object * port) {
+  socket_port *sp = SOCKET_STATE(port);
+  if(sp->out_len == 0) {
+    return 0;
+  }
+  long sent = sp->open ? socket_send_some(sp, sp->out, sp->out_len) : -1;
+  if(sent < 0) {
+    sp->out_len = 0;
+    return -1;
+  }
+  memmove(sp->out, sp->out + sent, sp->out_len - sent);
+  sp->out_len -= sent;
+  return sp->out_len == 0 ? 0 : SOCKET_AGAIN;
+}
 
+static void socket_queue(socket_port * sp, const void *src, long n) {
+  if(sp->out_len + n > sp->out_capacity) {
+    while(sp->out_len + n > sp->out_capacity) {
+      sp->out_capacity *= 2;
+    }
+    sp->out = realloc(sp->out, sp->out_capacity);
+  }
+  memcpy(sp->out + sp->out_len, src, n);
+  sp->out_len += n;
+}
+
+/* small writes collect in the send buffer; anything larger than the
+ * buffer goes straight out after whatever was already queued. what a
+ * non-blocking socket will not take yet is queued for a later flush. */
+long socket_port_write(object * port, const void *src, long n) {
+  socket_port *sp = SOCKET_STATE(port);
+  if(!sp->open) {
+    errno = EBADF;
+    return -1;
+  }
+  if(sp->out_len + n > sp->size) {
+    if(socket_port_flush(port) == -1) {
+      return -1;
+    }
+  }
+  if(n >= sp->size && sp->out_len == 0) {
+    long sent = socket_send_some(sp, src, n);
+    if(sent < 0) {
+      return -1;
+    }
+    socket_queue(sp, (const char *)src + sent, n - sent);
+    return n;
+  }
+  socket_queue(sp, src, n);
+  return n;
+}
+
+int socket_port_close(object * port) {
+  socket_port *sp = SOCKET_STATE(port);
+  if(!sp->open) {
+    return -1;
+  }
+  socket_port_flush(port);
+  sp->open = 0;
+  sp->in_pos = sp->in_end = 0;
+  sp->out_len = 0;
+  return close(sp->fd);
+}
+
+/* given a port rather than a descriptor, the socket port buffers a
+ * duplicate of its descriptor, so each of the two closes its own */
+DEFUN1(make_socket_port_proc) {
+  if(n_args > 1 && !is_fixnum(SECOND)) {
+    return throw_message("make-socket-port expects a fixnum buffer size");
+  }
+  long size = n_args > 1 ? LONG(SECOND) : 0;
+  if(is_input_port(FIRST) || is_output_port(FIRST)) {
+    FILE *stream = is_input_port(FIRST) ? INPUT(FIRST) : OUTPUT(FIRST);
+    int fd = dup(fileno(stream));
+    if(fd < 0) {
+      return throw_message("make-socket-port: %s", strerror(errno));
+    }
+    return make_socket_port(fd, size);
+  }
+  if(!is_fixnum(FIRST)) {
+    return throw_message("make-socket-port expects a socket or port and "
+			 "buffer size");
+  }
+  return make_socket_port(LONG(FIRST), size);
+}
+
+DEFUN1(is_socket_port_proc) {
+  return AS_BOOL(is_socket_port(FIRST));
+}
+
+DEFUN1(socket_flush_proc) {
+  if(!is_socket_port(FIRST)) {
+    return throw_message("socket-flush expects socket port");
+  }
+  int result = socket_port_flush(FIRST);
+  if(result == SOCKET_AGAIN) {
+    return socket_would_block();
+  }
+  return AS_BOOL(result == 0);
+}
+
+DEFUN1(socket_pending_proc) {
+  if(!is_socket_port(FIRST)) {
+    return throw_message("socket-pending expects socket port");
+  }
+  return make_fixnum(socket_port_pending(FIRST));
+}
+
+DEFUN1(socket_pending_output_proc) {
+  if(!is_socket_port(FIRST)) {
+    return throw_message("socket-pending-output expects socket port");
+  }
+  return make_fixnum(socket_port_pending_output(FIRST));
+}
+
+/* (socket-set-nonblocking! socket [on]) where socket is an fd or a
+   socket port. blocking calls then return would-block instead. */
+DEFUN1(socket_set_nonblocking_proc) {
+  int fd;
+  if(is_socket_port(FIRST)) {
+    fd = socket_port_fd(FIRST);
+  }
+  else if(is_fixnum(FIRST)) {
+    fd = LONG(FIRST);
+  }
+  else {
+    return throw_message("socket-set-nonblocking! expects socket");
+  }
+  int flags = fcntl(fd, F_GETFL);
+  if(flags < 0) {
+    return g->false;
+  }
+  if(n_args > 1 && is_false(SECOND)) {
+    flags &= ~O_NONBLOCK;
+  }
+  else {
+    flags |= O_NONBLOCK;
+  }
+  return AS_BOOL(fcntl(fd, F_SETFL, flags) == 0);
+}
+
+#define DEFAULT_BACKLOG 10
+
+/* socket options by name, either flags or buffer sizes in bytes.
+ * returns 0 on success, 1 for an unknown name or -1 if setsockopt
+ * failed */
+static int set_option(int sock, object * name, int value) {
+  int level = SOL_SOCKET, option;
+  if(name == make_symbol("nodelay")) {
+    level = IPPROTO_TCP;
+    option = TCP_NODELAY;
+  }
+  else if(name == make_symbol("reuseaddr")) {
+    option = SO_REUSEADDR;
+  }
+  else if(name == make_symbol("reuseport")) {
+    option = SO_REUSEPORT;
+  }
+  else if(name == make_symbol("keepalive")) {
+    option = SO_KEEPALIVE;
+  }
+  else if(name == make_symbol("rcvbuf")) {
+    option = SO_RCVBUF;
+  }
+  else if(name == make_symbol("sndbuf")) {
+    option = SO_SNDBUF;
+  }
+  else {
+    return 1;
+  }
+  return setsockopt(sock, level, option, &value, sizeof(value)) < 0 ? -1 : 0;
+}
+
+static object *listen_on(int sock, struct sockaddr *addr, socklen_t len,
+			 long backlog) {
+  if(bind(sock, addr, len) < 0 || listen(sock, backlog) < 0) {
+    close(sock);
+    return g->false;
+  }
+  return make_fixnum(sock);
+}
+
+/* (make-server-socket port [backlog [options]]) where options is a
+   list such as (reuseport) set before binding */
 DEFUN1(server_socket_proc) {
   struct sockaddr_in addr;
   long port = LONG(FIRST);
+  long backlog = n_args > 1 ? LONG(SECOND) : DEFAULT_BACKLOG;
+  object *options = n_args > 2 ? THIRD : g->empty_list;
   int sock;
+  int on = 1;
 
   sock = socket(AF_INET, SOCK_STREAM, 0);
   if(sock < 0) {
     return g->false;
   }
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  for(; is_pair(options); options = CDR(options)) {
+    if(set_option(sock, CAR(options), 1) > 0) {
+      close(sock);
+      return throw_message("make-server-socket: unknown option");
+    }
+  }
 
   memset(&addr, 0, sizeof(struct sockaddr_in));
   addr.sin_family = AF_INET;
   addr.sin_addr.s_addr = htonl(INADDR_ANY);
   addr.sin_port = htons(port);
 
-  if(bind(sock, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) < 0) {
+  return listen_on(sock, (struct sockaddr *)&addr,
+		   sizeof(struct sockaddr_in), backlog);
+}
+
+static int unix_address(object * path, struct sockaddr_un *addr) {
+  if(!is_string(path) || STRLEN(path) >= (long)sizeof(addr->sun_path)) {
+    return 0;
+  }
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+  memcpy(addr->sun_path, STRING(path), STRLEN(path));
+  return 1;
+}
+
+/* a socket file left behind by a server that has gone refuses
+ * connections. it is removed so the path can be bound again; a live
+ * server's socket and anything that is not a socket stay put. */
+static void unlink_stale_socket(struct sockaddr_un *addr) {
+  struct stat st;
+  if(stat(addr->sun_path, &st) < 0 || !S_ISSOCK(st.st_mode)) {
+    return;
+  }
+  int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(probe < 0) {
+    return;
+  }
+  if(connect(probe, (struct sockaddr *)addr, sizeof(*addr)) < 0
+     && errno == ECONNREFUSED) {
+    unlink(addr->sun_path);
+  }
+  close(probe);
+}
+
+/* (make-unix-server-socket path [backlog]) */
+DEFUN1(unix_server_socket_proc) {
+  struct sockaddr_un addr;
+  if(!unix_address(FIRST, &addr) || (n_args > 1 && !is_fixnum(SECOND))) {
+    return throw_message("make-unix-server-socket expects a path and "
+			 "backlog");
+  }
+  unlink_stale_socket(&addr);
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(sock < 0) {
+    return g->false;
+  }
+  return listen_on(sock, (struct sockaddr *)&addr, sizeof(addr),
+		   n_args > 1 ? LONG(SECOND) : DEFAULT_BACKLOG);
+}
+
+/* opens a socket and starts connecting it. a non-blocking connect
+ * that is still under way counts as success; socket-connect-result
+ * tells how it ended. returns the socket or -1. */
+static int start_connect(int family, int type, int protocol,
+			 struct sockaddr *addr, socklen_t len,
+			 int nonblocking) {
+  int sock = socket(family, type | SOCK_CLOEXEC |
+		    (nonblocking ? SOCK_NONBLOCK : 0), protocol);
+  if(sock < 0) {
+    return -1;
+  }
+  int result;
+  do {
+    result = connect(sock, addr, len);
+  } while(result < 0 && errno == EINTR && !nonblocking);
+  if(result == 0 || (nonblocking && (errno == EINPROGRESS ||
+				     errno == EINTR))) {
+    return sock;
+  }
+  close(sock);
+  return -1;
+}
+
+/* (socket-connect host port [nonblocking]) opens a TCP connection and
+   returns its socket, or #f. a non-blocking connect returns at once,
+   and the socket turns writable when socket-connect-result can say
+   whether it worked. */
+DEFUN1(socket_connect_proc) {
+  if(!is_string(FIRST) || !is_fixnum(SECOND)) {
+    return throw_message("socket-connect expects host and port");
+  }
+  int nonblocking = n_args > 2 && is_true(THIRD);
+  struct addrinfo hints, *found, *ai;
+  char service[32];
+  int sock = -1;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(service, sizeof(service), "%ld", LONG(SECOND));
+  if(getaddrinfo(STRING(FIRST), service, &hints, &found) != 0) {
     return g->false;
   }
+  for(ai = found; ai != NULL && sock < 0; ai = ai->ai_next) {
+    sock = start_connect(ai->ai_family, ai->ai_socktype, ai->ai_protocol,
+			 ai->ai_addr, ai->ai_addrlen, nonblocking);
+  }
+  freeaddrinfo(found);
+  return sock < 0 ? g->false : make_fixnum(sock);
+}
+
+/* (socket-connect-unix path [nonblocking]) */
+DEFUN1(socket_connect_unix_proc) {
+  struct sockaddr_un addr;
+  if(!unix_address(FIRST, &addr)) {
+    return throw_message("socket-connect-unix expects a path");
+  }
+  int sock = start_connect(AF_UNIX, SOCK_STREAM, 0, (struct sockaddr *)&addr,
+			   sizeof(addr), n_args > 1 && is_true(SECOND));
+  return sock < 0 ? g->false : make_fixnum(sock);
+}
 
-  if(listen(sock, 10) < 0) {
+/* (socket-connect-result socket) is #t once a non-blocking connect
+   has succeeded, in-progress before it finishes, or #f if it failed */
+DEFUN1(socket_connect_result_proc) {
+  if(!(is_fixnum(FIRST) || is_socket_port(FIRST))) {
+    return throw_message("socket-connect-result expects socket");
+  }
+  int sock = is_socket_port(FIRST) ? socket_port_fd(FIRST) : LONG(FIRST);
+  int error = 0;
+  socklen_t len = sizeof(error);
+  if(getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error) {
     return g->false;
   }
+  struct sockaddr_storage peer;
+  len = sizeof(peer);
+  if(getpeername(sock, (struct sockaddr *)&peer, &len) < 0) {
+    return errno == ENOTCONN ? make_symbol("in-progress") : g->false;
+  }
+  return g->true;
+}
 
-  return make_fixnum(sock);
+/* (socket-set-option! socket name [value]) for the flags nodelay,
+   reuseaddr, reuseport and keepalive, which value turns on or off,
+   and the buffer sizes rcvbuf and sndbuf */
+DEFUN1(socket_set_option_proc) {
+  if(!(is_fixnum(FIRST) || is_socket_port(FIRST)) || !is_symbol(SECOND)) {
+    return throw_message("socket-set-option! expects socket and option");
+  }
+  int sock = is_socket_port(FIRST) ? socket_port_fd(FIRST) : LONG(FIRST);
+  int value = n_args < 3 || is_true(THIRD);
+  if(n_args > 2 && is_fixnum(THIRD)) {
+    value = LONG(THIRD);
+  }
+  int result = set_option(sock, SECOND, value);
+  if(result > 0) {
+    return throw_message("socket-set-option!: unknown option");
+  }
+  return AS_BOOL(result == 0);
 }
 
 DEFUN1(socket_accept_proc) {
   long socket = LONG(FIRST);
   int conn_socket;
 
-  conn_socket = accept(socket, NULL, NULL);
+  do {
+    conn_socket = accept(socket, NULL, NULL);
+  } while(conn_socket < 0 && errno == EINTR);
   if(conn_socket < 0) {
-    return g->false;
+    return would_block() ? socket_would_block() : g->false;
   }
 
   return make_fixnum(conn_socket);
 }
 
 DEFUN1(socket_read_proc) {
-  long socket = LONG(FIRST);
+  long socket = is_socket_port(FIRST) ? 0 : LONG(FIRST);
   long n_bytes = LONG(SECOND);
 
-  object *bytes = make_filled_string(n_bytes + 1, '\0');
+  object *bytes = make_filled_string(n_bytes, '\0');
   push_root(&bytes);
-  long rb = read(socket, STRING(bytes), n_bytes);
+  long rb;
+  if(is_socket_port(FIRST)) {
+    rb = socket_port_read(FIRST, STRING(bytes), n_bytes, 0);
+  }
+  else {
+    rb = read(socket, STRING(bytes), n_bytes);
+    if(rb < 0 && would_block()) {
+      rb = SOCKET_AGAIN;
+    }
+  }
+  if(rb == SOCKET_AGAIN) {
+    pop_root(&bytes);
+    return socket_would_block();
+  }
+  if(rb >= 0) {
+    STRLEN(bytes) = rb;
+    STRING(bytes)[rb] = '\0';
+  }
 
   object *result = g->empty_list;
   push_root(&result);
@@ -86,16 +714,80 @@ DEFUN1(socket_read_proc) {
   return result;
 }
 
+/* reads straight into a bytevector: (socket-read-bytevector! conn bv
+   [start [end]]) returns the number of bytes read */
+DEFUN1(socket_read_bytevector_proc) {
+  object *bv = SECOND;
+  if(!(is_fixnum(FIRST) || is_socket_port(FIRST)) || !is_bytevector(bv) ||
+     (n_args > 2 && !is_fixnum(THIRD)) || (n_args > 3 && !is_fixnum(FOURTH))) {
+    return throw_message("socket-read-bytevector! expects socket, "
+			 "bytevector, start and end");
+  }
+  long socket = is_socket_port(FIRST) ? 0 : LONG(FIRST);
+
+  long start = n_args > 2 ? LONG(THIRD) : 0;
+  long end = n_args > 3 ? LONG(FOURTH) : BVLEN(bv);
+  if(start < 0 || end > BVLEN(bv) || start > end) {
+    return throw_message("socket-read-bytevector!: bad range");
+  }
+
+  long rb;
+  if(is_socket_port(FIRST)) {
+    rb = socket_port_read(FIRST, BYTES(bv) + start, end - start, 0);
+  }
+  else {
+    rb = read(socket, BYTES(bv) + start, end - start);
+    if(rb < 0 && would_block()) {
+      rb = SOCKET_AGAIN;
+    }
+  }
+  return rb == SOCKET_AGAIN ? socket_would_block() : make_fixnum(rb);
+}
+
 DEFUN1(socket_write_proc) {
-  long socket = LONG(FIRST);
-  char *data = STRING(SECOND);
-  long nbytes = LONG(THIRD);
+  if(!(is_fixnum(FIRST) || is_socket_port(FIRST)) ||
+     !(is_string(SECOND) || is_bytevector(SECOND)) ||
+     (n_args > 2 && !is_fixnum(THIRD))) {
+    return throw_message("socket-write expects socket, string or "
+			 "bytevector, and count");
+  }
+  long socket = is_socket_port(FIRST) ? 0 : LONG(FIRST);
+  char *data;
+  long length;
+  if(is_bytevector(SECOND)) {
+    data = (char *)BYTES(SECOND);
+    length = BVLEN(SECOND);
+  }
+  else {
+    data = STRING(SECOND);
+    length = STRLEN(SECOND);
+  }
 
-  long written = write(socket, data, nbytes);
+  long nbytes = n_args > 2 ? LONG(THIRD) : length;
+  if(nbytes < 0 || nbytes > length) {
+    return throw_message("socket-write: %ld bytes is out of range", nbytes);
+  }
+
+  long written;
+  if(is_socket_port(FIRST)) {
+    if(!socket_port_is_open(FIRST)) {
+      return throw_message("socket-write: the socket port is closed");
+    }
+    written = socket_port_write(FIRST, data, nbytes);
+  }
+  else {
+    written = write(socket, data, nbytes);
+    if(written < 0 && would_block()) {
+      return socket_would_block();
+    }
+  }
   return make_fixnum(written);
 }
 
 DEFUN1(socket_close_proc) {
+  if(is_socket_port(FIRST)) {
+    return AS_BOOL(socket_port_close(FIRST) == 0);
+  }
   long socket = LONG(FIRST);
   if(close(socket) < 0) {
     return g->false;
@@ -103,10 +795,399 @@ DEFUN1(socket_close_proc) {
   return g->true;
 }
 
+/* zero-copy transfers. the kernel moves file pages or pipe buffers
+ * straight to the destination, so a body never passes through a
+ * scheme string. each call moves what it can without blocking and
+ * leaves the parking to the caller. */
+
+#define SEND_FILE_CHUNK (1L << 20)
+
+/* a descriptor from an fd, a socket port or a file port */
+static int descriptor(object * obj) {
+  if(is_fixnum(obj)) {
+    return LONG(obj);
+  }
+  if(is_socket_port(obj)) {
+    return socket_port_fd(obj);
+  }
+  if(is_input_port(obj)) {
+    return fileno(INPUT(obj));
+  }
+  if(is_output_port(obj)) {
+    return fileno(OUTPUT(obj));
+  }
+  return -1;
+}
+
+/* whatever a socket port already queued has to go out first */
+static object *flush_before(object * obj, int *ready) {
+  *ready = 1;
+  if(is_socket_port(obj)) {
+    int result = socket_port_flush(obj);
+    if(result == SOCKET_AGAIN) {
+      *ready = 0;
+      return socket_would_block();
+    }
+    if(result < 0) {
+      *ready = 0;
+      return g->false;
+    }
+  }
+  return NULL;
+}
+
+/* (socket-send-file socket file offset count) sends COUNT bytes of
+   FILE from OFFSET, leaving the file position alone. returns the
+   bytes sent, 0 at the end of the file, would-block or #f. */
+DEFUN1(socket_send_file_proc) {
+  int out = descriptor(FIRST), in = descriptor(SECOND);
+  if(out < 0 || in < 0 || !is_fixnum(THIRD) || !is_fixnum(FOURTH)) {
+    return throw_message("socket-send-file expects socket, file, offset "
+			 "and count");
+  }
+  if(LONG(THIRD) < 0 || LONG(FOURTH) < 0) {
+    return throw_message("socket-send-file: offset %ld and count %ld must "
+			 "not be negative", LONG(THIRD), LONG(FOURTH));
+  }
+  int ready;
+  object *pending = flush_before(FIRST, &ready);
+  if(!ready) {
+    return pending;
+  }
+
+  off_t offset = LONG(THIRD);
+  long left = LONG(FOURTH), sent = 0;
+  while(left > 0) {
+    ssize_t wb = sendfile(out, in, &offset,
+			  left < SEND_FILE_CHUNK ? left : SEND_FILE_CHUNK);
+    if(wb < 0 && (errno == EINVAL || errno == ENOSYS)) {
+      /* a source sendfile cannot map: copy it the old way */
+      char buffer[8192];
+      ssize_t rb = pread(in, buffer, left < 8192 ? left : 8192, offset);
+      wb = rb <= 0 ? rb : write(out, buffer, rb);
+      if(wb > 0) {
+	offset += wb;
+      }
+    }
+    if(wb < 0) {
+      if(errno == EINTR) {
+	continue;
+      }
+      if(sent == 0) {
+	return would_block() ? socket_would_block() : g->false;
+      }
+      break;
+    }
+    if(wb == 0) {
+      break;
+    }
+    sent += wb;
+    left -= wb;
+  }
+  return make_fixnum(sent);
+}
+
+/* (socket-splice! from to count) moves up to COUNT bytes between two
+   descriptors, one of which must be a pipe. bytes a socket port has
+   already buffered are handed over first. returns the bytes moved, 0
+   at end of stream, would-block or #f. */
+DEFUN1(socket_splice_proc) {
+  int in = descriptor(FIRST), out = descriptor(SECOND);
+  if(in < 0 || out < 0 || !is_fixnum(THIRD)) {
+    return throw_message("socket-splice! expects two descriptors and a "
+			 "count");
+  }
+  if(LONG(THIRD) < 0) {
+    return throw_message("socket-splice!: count %ld is negative",
+			 LONG(THIRD));
+  }
+  int ready;
+  object *pending = flush_before(SECOND, &ready);
+  if(!ready) {
+    return pending;
+  }
+
+  long count = LONG(THIRD);
+  ssize_t moved;
+  if(is_socket_port(FIRST) && socket_port_pending(FIRST) > 0) {
+    unsigned char *data;
+    long avail = socket_port_peek(FIRST, &data);
+    do {
+      moved = write(out, data, avail < count ? avail : count);
+    } while(moved < 0 && errno == EINTR);
+    if(moved > 0) {
+      socket_port_consume(FIRST, moved);
+    }
+  }
+  else {
+    do {
+      moved = splice(in, NULL, out, NULL, count,
+		     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    } while(moved < 0 && errno == EINTR);
+  }
+  if(moved < 0) {
+    return would_block() ? socket_would_block() : g->false;
+  }
+  return make_fixnum(moved);
+}
+
+/* (make-pipe) is a non-blocking (read-fd . write-fd) pair, the
+   go-between for splicing one socket into another */
+DEFUN1(make_pipe_proc) {
+  int fds[2];
+  if(pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+    return g->false;
+  }
+  object *read_end = make_fixnum(fds[0]);
+  push_root(&read_end);
+  object *pair = cons(read_end, make_fixnum(fds[1]));
+  pop_root(&read_end);
+  return pair;
+}
+
+/* (file-descriptor-size file) is the size of a regular file, or #f */
+DEFUN1(file_descriptor_size_proc) {
+  int fd = descriptor(FIRST);
+  struct stat st;
+  if(fd < 0) {
+    return throw_message("file-descriptor-size expects fd or port");
+  }
+  if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+    return g->false;
+  }
+  return make_fixnum(st.st_size);
+}
+
+/* UDP. datagrams move in batches, one recvmmsg or sendmmsg per call,
+ * between the socket and either a vector of bytevectors or a single
+ * bytevector cut into equal slots. a vector of lengths says how much
+ * of each buffer holds a datagram. */
+
+#define UDP_MAX_BATCH 256
+#define UDP_RECEIVE_BUFFER (4 << 20)
+
+/* (make-udp-socket [port]) is a non-blocking datagram socket bound to
+   PORT on every address, or to a free port when PORT is 0 or missing.
+   the receive buffer is as large as the system allows, so a burst
+   waits in the kernel while the receiver is descheduled rather than
+   being dropped. */
+DEFUN1(make_udp_socket_proc) {
+  struct sockaddr_in addr;
+  int on = 1;
+  if(n_args > 0 && !is_fixnum(FIRST)) {
+    return throw_message("make-udp-socket expects a port");
+  }
+  int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(sock < 0) {
+    return g->false;
+  }
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  int size = UDP_RECEIVE_BUFFER;
+  setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+  memset(&addr, 0, sizeof(struct sockaddr_in));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(n_args > 0 ? LONG(FIRST) : 0);
+  if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(sock);
+    return g->false;
+  }
+  return make_fixnum(sock);
+}
+
+/* (udp-connect! socket host port) fixes where datagrams go, and the
+   only peer they are accepted from */
+DEFUN1(udp_connect_proc) {
+  if(!is_fixnum(FIRST) || !is_string(SECOND) || !is_fixnum(THIRD)) {
+    return throw_message("udp-connect! expects socket, host and port");
+  }
+  struct addrinfo hints, *found;
+  char service[32];
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  snprintf(service, sizeof(service), "%ld", LONG(THIRD));
+  if(getaddrinfo(STRING(SECOND), service, &hints, &found) != 0) {
+    return g->false;
+  }
+  int result = connect(LONG(FIRST), found->ai_addr, found->ai_addrlen);
+  freeaddrinfo(found);
+  return AS_BOOL(result == 0);
+}
+
+/* (socket-local-port socket) is the port a socket is bound to */
+DEFUN1(socket_local_port_proc) {
+  if(!(is_fixnum(FIRST) || is_socket_port(FIRST))) {
+    return throw_message("socket-local-port expects socket");
+  }
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  int sock = is_socket_port(FIRST) ? socket_port_fd(FIRST) : LONG(FIRST);
+  if(getsockname(sock, (struct sockaddr *)&addr, &len) < 0) {
+    return g->false;
+  }
+  return make_fixnum(ntohs(addr.sin_port));
+}
+
+/* lays the buffers out as COUNT iovecs, each its whole buffer or one
+ * of COUNT equal slots, at most a batch of them. returns how many, or
+ * -1 if the buffers are not usable */
+static long datagram_buffers(object * buffers, long count, struct iovec *iov) {
+  long i;
+  if(is_bytevector(buffers)) {
+    long slot = count > 0 ? BVLEN(buffers) / count : 0;
+    if(count > UDP_MAX_BATCH) {
+      count = UDP_MAX_BATCH;
+    }
+    for(i = 0; i < count; i++) {
+      iov[i].iov_base = BYTES(buffers) + i * slot;
+      iov[i].iov_len = slot;
+    }
+    return count;
+  }
+  if(!is_vector(buffers) || VSIZE(buffers) < count) {
+    return -1;
+  }
+  if(count > UDP_MAX_BATCH) {
+    count = UDP_MAX_BATCH;
+  }
+  for(i = 0; i < count; i++) {
+    object *buffer = VARRAY(buffers)[i];
+    if(!is_bytevector(buffer)) {
+      return -1;
+    }
+    iov[i].iov_base = BYTES(buffer);
+    iov[i].iov_len = BVLEN(buffer);
+  }
+  return count;
+}
+
+/* (udp-receive! socket buffers lengths) reads up to one datagram per
+   slot of LENGTHS and stores each length there. returns how many
+   arrived, or would-block. a datagram longer than its buffer is cut
+   short. */
+DEFUN1(udp_receive_proc) {
+  if(!is_fixnum(FIRST) || !is_vector(THIRD)) {
+    return throw_message("udp-receive! expects socket, buffers and lengths");
+  }
+  struct iovec iov[UDP_MAX_BATCH];
+  struct mmsghdr msgs[UDP_MAX_BATCH];
+  long count = datagram_buffers(SECOND, VSIZE(THIRD), iov);
+  if(count < 0) {
+    return throw_message("udp-receive!: buffers must be a bytevector or a "
+			 "vector of bytevectors");
+  }
+  long i;
+  memset(msgs, 0, count * sizeof(struct mmsghdr));
+  for(i = 0; i < count; i++) {
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  int got;
+  do {
+    got = recvmmsg(LONG(FIRST), msgs, count, MSG_DONTWAIT, NULL);
+  } while(got < 0 && errno == EINTR);
+  if(got < 0) {
+    return would_block() ? socket_would_block() : g->false;
+  }
+  write_barrier(THIRD);
+  for(i = 0; i < got; i++) {
+    VARRAY(THIRD)[i] = make_fixnum(msgs[i].msg_len);
+  }
+  return make_fixnum(got);
+}
+
+/* (udp-send! socket buffers lengths [start [end]]) sends datagrams
+   START up to END, each LENGTHS bytes from the start of its buffer
+   or slot, to the connected peer. returns how many went, or
+   would-block. */
+DEFUN1(udp_send_proc) {
+  if(!is_fixnum(FIRST) || !is_vector(THIRD) ||
+     (n_args > 3 && !is_fixnum(FOURTH)) || (n_args > 4 && !is_fixnum(FIFTH))) {
+    return throw_message("udp-send! expects socket, buffers and lengths");
+  }
+  long start = n_args > 3 ? LONG(FOURTH) : 0;
+  long end = n_args > 4 ? LONG(FIFTH) : VSIZE(THIRD);
+  if(start < 0 || end > VSIZE(THIRD) || start > end) {
+    return throw_message("udp-send!: range %ld to %ld is invalid", start, end);
+  }
+  struct iovec iov[UDP_MAX_BATCH];
+  struct mmsghdr msgs[UDP_MAX_BATCH];
+  long count = end - start > UDP_MAX_BATCH ? UDP_MAX_BATCH : end - start;
+  long i;
+  for(i = 0; i < count; i++) {
+    object *length = VARRAY(THIRD)[start + i];
+    object *buffer = SECOND;
+    unsigned char *base;
+    long size;
+    if(is_bytevector(buffer)) {
+      size = BVLEN(buffer) / VSIZE(THIRD);
+      base = BYTES(buffer) + (start + i) * size;
+    }
+    else if(is_vector(buffer) && VSIZE(buffer) > start + i &&
+	    is_bytevector(VARRAY(buffer)[start + i])) {
+      buffer = VARRAY(buffer)[start + i];
+      size = BVLEN(buffer);
+      base = BYTES(buffer);
+    }
+    else {
+      return throw_message("udp-send!: buffers must be a bytevector or a "
+			   "vector of bytevectors");
+    }
+    if(!is_fixnum(length) || LONG(length) < 0 || LONG(length) > size) {
+      return throw_message("udp-send!: datagram %ld does not fit its "
+			   "buffer", start + i);
+    }
+    iov[i].iov_base = base;
+    iov[i].iov_len = LONG(length);
+    memset(&msgs[i], 0, sizeof(struct mmsghdr));
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  int sent;
+  do {
+    sent = sendmmsg(LONG(FIRST), msgs, count, MSG_DONTWAIT);
+  } while(sent < 0 && errno == EINTR);
+  if(sent < 0) {
+    return would_block() ? socket_would_block() : g->false;
+  }
+  return make_fixnum(sent);
+}
+
 void init_socket(definer defn) {
   defn("make-server-socket", make_primitive_proc(server_socket_proc));
   defn("socket-accept", make_primitive_proc(socket_accept_proc));
+  defn("socket-connect", make_primitive_proc(socket_connect_proc));
+  defn("make-unix-server-socket",
+       make_primitive_proc(unix_server_socket_proc));
+  defn("socket-connect-unix", make_primitive_proc(socket_connect_unix_proc));
+  defn("socket-connect-result",
+       make_primitive_proc(socket_connect_result_proc));
+  defn("socket-set-option!", make_primitive_proc(socket_set_option_proc));
   defn("socket-read", make_primitive_proc(socket_read_proc));
+  defn("socket-read-bytevector!",
+       make_primitive_proc(socket_read_bytevector_proc));
   defn("socket-write", make_primitive_proc(socket_write_proc));
   defn("socket-close", make_primitive_proc(socket_close_proc));
+  defn("make-socket-port", make_primitive_proc(make_socket_port_proc));
+  defn("socket-port?", make_primitive_proc(is_socket_port_proc));
+  defn("socket-flush", make_primitive_proc(socket_flush_proc));
+  defn("socket-pending", make_primitive_proc(socket_pending_proc));
+  defn("socket-pending-output",
+       make_primitive_proc(socket_pending_output_proc));
+  defn("socket-set-nonblocking!",
+       make_primitive_proc(socket_set_nonblocking_proc));
+  defn("socket-send-file", make_primitive_proc(socket_send_file_proc));
+  defn("socket-splice!", make_primitive_proc(socket_splice_proc));
+  defn("make-pipe", make_primitive_proc(make_pipe_proc));
+  defn("file-descriptor-size",
+       make_primitive_proc(file_descriptor_size_proc));
+  defn("make-udp-socket", make_primitive_proc(make_udp_socket_proc));
+  defn("udp-connect!", make_primitive_proc(udp_connect_proc));
+  defn("socket-local-port", make_primitive_proc(socket_local_port_proc));
+  defn("udp-receive!", make_primitive_proc(udp_receive_proc));
+  defn("udp-send!", make_primitive_proc(udp_send_proc));
 }
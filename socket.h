@@ -14,4 +14,26 @@
  * limitations under the License.
  */
 
+/* returned by socket port operations that would block */
+#define SOCKET_AGAIN -2
+
+object *socket_would_block(void);
+object *make_socket_port(int fd, long size);
+void free_socket_port(object *port);
+int socket_port_fd(object *port);
+long socket_port_pending(object *port);
+long socket_port_pending_output(object *port);
+long socket_port_peek(object *port, unsigned char **data);
+long socket_port_more_input(object *port);
+void socket_port_consume(object *port, long n);
+int socket_port_getc(object *port);
+int socket_port_ungetc(object *port, int ch);
+long socket_port_read(object *port, void *dst, long n, int fill);
+object *socket_port_read_line(object *port, long max);
+object *socket_port_read_all(object *port);
+int socket_port_is_open(object *port);
+long socket_port_write(object *port, const void *src, long n);
+int socket_port_flush(object *port);
+int socket_port_close(object *port);
+
 void init_socket(definer defn);
@@ -514,7 +514,8 @@ size_t add_new_area(void *area, size_t area_size, void *mem_pool) {
     area_info_t *ptr, *ptr_prev, *ai;
     bhdr_t *ib0, *b0, *lb0, *ib1, *b1, *lb1, *next_b;
 
-    memset(area, 0, area_size);
+    /* Areas come fresh from mmap(), already zeroed, so they're left
+     * untouched until they're allocated from. */
     ptr = tlsf->area_head;
     ptr_prev = 0;
 
@@ -607,6 +608,69 @@ size_t get_max_size(void *mem_pool ATTRIBUTE_UNUSED) {
 #endif
 }
 
+/******************************************************************/
+size_t get_free_size(void *mem_pool, int clear) {
+/******************************************************************/
+    /* Walks every block of every area, adding up the free ones and,
+     * when asked, zeroing what follows their free list links. */
+    tlsf_t *tlsf = (tlsf_t *) mem_pool;
+    area_info_t *ai;
+    bhdr_t *b;
+    size_t size, free_size = 0;
+
+    for (ai = tlsf->area_head; ai; ai = ai->next) {
+        b = (bhdr_t *) ((char *) ai - BHDR_OVERHEAD);
+        while (b) {
+            size = b->size & BLOCK_SIZE;
+            if ((b->size & BLOCK_STATE) == FREE_BLOCK) {
+                free_size += size;
+                if (clear && size > MIN_BLOCK_SIZE)
+                    memset(b->ptr.buffer + MIN_BLOCK_SIZE, 0, size - MIN_BLOCK_SIZE);
+            }
+            b = size ? GET_NEXT_BLOCK(b->ptr.buffer, size) : NULL;
+        }
+    }
+    return free_size;
+}
+
+/******************************************************************/
+void seal_memory_pool(void *mem_pool) {
+/******************************************************************/
+    /* Forgets every free block, so nothing more is allocated from the
+     * areas there are now and their memory isn't written. The blocks
+     * themselves are left as they are. */
+    tlsf_t *tlsf = (tlsf_t *) mem_pool;
+
+    tlsf->fl_bitmap = 0;
+    memset(tlsf->sl_bitmap, 0, sizeof(tlsf->sl_bitmap));
+    memset(tlsf->matrix, 0, sizeof(tlsf->matrix));
+}
+
+/******************************************************************/
+void unseal_memory_pool(void *mem_pool) {
+/******************************************************************/
+    /* Rebuilds the free lists from every free block of every area,
+     * taking back those forgotten by seal_memory_pool(). */
+    tlsf_t *tlsf = (tlsf_t *) mem_pool;
+    area_info_t *ai;
+    bhdr_t *b;
+    size_t size;
+    int fl, sl;
+
+    seal_memory_pool(mem_pool);
+    for (ai = tlsf->area_head; ai; ai = ai->next) {
+        b = (bhdr_t *) ((char *) ai - BHDR_OVERHEAD);
+        while (b) {
+            size = b->size & BLOCK_SIZE;
+            if ((b->size & BLOCK_STATE) == FREE_BLOCK) {
+                MAPPING_INSERT(size, &fl, &sl);
+                INSERT_BLOCK(b, tlsf, fl, sl);
+            }
+            b = size ? GET_NEXT_BLOCK(b->ptr.buffer, size) : NULL;
+        }
+    }
+}
+
 /******************************************************************/
 void destroy_memory_pool(void *mem_pool) {
 /******************************************************************/
@@ -24,6 +24,9 @@
 extern size_t init_memory_pool(size_t, void *);
 extern size_t get_used_size(void *);
 extern size_t get_max_size(void *);
+extern size_t get_free_size(void *, int);
+extern void seal_memory_pool(void *);
+extern void unseal_memory_pool(void *);
 extern void destroy_memory_pool(void *);
 extern size_t add_new_area(void *, size_t, void *);
 extern void *malloc_ex(size_t, void *);
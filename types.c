@@ -72,30 +72,34 @@ char is_character(object * obj) {
   return !TAGGED(obj) && obj->type == CHARACTER;
 }
 
-object *make_empty_string(long len) {
+/* strings carry their length so they may contain NUL bytes. The
+ * storage is always NUL terminated as well so STRING() can still be
+ * handed directly to libc. */
+object *make_empty_string(long length) {
   object *obj = alloc_object(1);
   obj->type = STRING;
-  obj->data.string.value = MALLOC(len);
+  obj->data.string.value = MALLOC(length + 1);
+  STRLEN(obj) = length;
+  STRING(obj)[length] = '\0';
   return obj;
 }
 
 object *make_filled_string(long length, char fill_char) {
-  int idx;
   object *string = make_empty_string(length);
-  for(idx = 0; idx < length - 1; ++idx) {
-    STRING(string)[idx] = fill_char;
-  }
-  STRING(string)[length - 1] = '\0';
+  memset(STRING(string), fill_char, length);
   return string;
 }
 
-object *make_string(char *value) {
-  size_t len = strlen(value) + 1;
-  object *obj = make_empty_string(len);
-  strncpy(obj->data.string.value, value, len);
+object *make_counted_string(char *value, long length) {
+  object *obj = make_empty_string(length);
+  memcpy(STRING(obj), value, length);
   return obj;
 }
 
+object *make_string(char *value) {
+  return make_counted_string(value, strlen(value));
+}
+
 char is_string(object * obj) {
   return !TAGGED(obj) && obj->type == STRING;
 }
@@ -117,6 +121,7 @@ object *car(object * pair) {
 }
 
 void set_car(object * obj, object * value) {
+  write_barrier(obj);
   CAR(obj) = value;
 }
 
@@ -125,6 +130,7 @@ object *cdr(object * pair) {
 }
 
 void set_cdr(object * obj, object * value) {
+  write_barrier(obj);
   CDR(obj) = value;
 }
 
@@ -220,6 +226,7 @@ char is_hashtab(object * obj) {
 }
 
 void set_hashtab(object * tab, object * key, object * val) {
+  write_barrier(tab);
   htb_insert(HTAB(tab), key, val);
 }
 
@@ -370,20 +377,174 @@ object *make_dir_stream(DIR * stream) {
   return obj;
 }
 
-object *find_symbol(char *value) {
-  object *element;
+/* a string builder appends into a string object whose length is the
+ * capacity of the builder. Handing out the result trims that storage
+ * and returns it directly, which leaves the builder exactly full so
+ * the next append copies into fresh storage instead of writing into
+ * the string we gave away. */
+object *make_string_builder(long capacity) {
+  object *storage = make_empty_string(capacity);
+  push_root(&storage);
+  object *obj = alloc_object(0);
+  obj->type = STRING_BUILDER;
+  BUILDER_STORAGE(obj) = storage;
+  BUILDER_LENGTH(obj) = 0;
+  pop_root(&storage);
+  return obj;
+}
+
+char is_string_builder(object * obj) {
+  return !TAGGED(obj) && obj->type == STRING_BUILDER;
+}
+
+void string_builder_append(object * builder, char *value, long length) {
+  object *storage = BUILDER_STORAGE(builder);
+  long used = BUILDER_LENGTH(builder);
+
+  if(used + length > STRLEN(storage)) {
+    long capacity = STRLEN(storage) * 2;
+    if(capacity < 16) {
+      capacity = 16;
+    }
+    if(capacity < used + length) {
+      capacity = used + length;
+    }
+
+    object *grown = make_empty_string(capacity);
+    memcpy(STRING(grown), STRING(storage), used);
+    write_barrier(builder);
+    BUILDER_STORAGE(builder) = storage = grown;
+  }
+
+  memcpy(STRING(storage) + used, value, length);
+  BUILDER_LENGTH(builder) = used + length;
+}
+
+object *string_builder_to_string(object * builder) {
+  object *storage = BUILDER_STORAGE(builder);
+  long used = BUILDER_LENGTH(builder);
+
+  if(STRLEN(storage) != used) {
+    storage->data.string.value = REALLOC(STRING(storage), used + 1);
+    STRLEN(storage) = used;
+    STRING(storage)[used] = '\0';
+  }
+  return storage;
+}
+
+object *make_bytevector(long length) {
+  object *obj = alloc_object(1);
+  obj->type = BYTEVECTOR;
+  BYTES(obj) = MALLOC(length > 0 ? length : 1);
+  BVLEN(obj) = length;
+  return obj;
+}
+
+/* mapped bytevectors and their slices are bytevectors whose storage
+ * belongs to an mmap()ed file */
+char is_bytevector(object * obj) {
+  return !TAGGED(obj) && (obj->type == BYTEVECTOR ||
+			  obj->type == MAPPED_BYTEVECTOR ||
+			  obj->type == BYTEVECTOR_SLICE);
+}
 
-  element = g->symbol_table;
+char is_socket_port(object * obj) {
+  return !TAGGED(obj) && obj->type == SOCKET_PORT;
+}
+
+char is_event_loop(object * obj) {
+  return !TAGGED(obj) && obj->type == EVENT_LOOP;
+}
+
+char is_mapped_bytevector(object * obj) {
+  return !TAGGED(obj) && (obj->type == MAPPED_BYTEVECTOR ||
+			  obj->type == BYTEVECTOR_SLICE);
+}
+
+/* homogeneous numeric vectors share the bytevector layout, with the
+ * length counted in elements. a bytevector is the u8 case. */
+int hvector_element_size(object_type type) {
+  switch (type) {
+  case BYTEVECTOR:
+  case S8VECTOR:
+    return 1;
+  case U16VECTOR:
+  case S16VECTOR:
+    return 2;
+  case U32VECTOR:
+  case S32VECTOR:
+  case F32VECTOR:
+    return 4;
+  default:
+    return 8;
+  }
+}
+
+object *make_hvector(object_type type, long length) {
+  object *obj = make_bytevector(length * hvector_element_size(type));
+  obj->type = type;
+  BVLEN(obj) = length;
+  return obj;
+}
+
+char is_hvector(object * obj) {
+  return !TAGGED(obj) && (obj->type == BYTEVECTOR ||
+			  (obj->type >= S8VECTOR && obj->type <= F64VECTOR));
+}
+
+/* FNV-1a over the name picks the symbol table bucket */
+static unsigned long symbol_hash(const char *value, long length) {
+  unsigned long hash = 2166136261UL;
+  long ii;
+  for(ii = 0; ii < length; ++ii) {
+    hash = (hash ^ (unsigned char)value[ii]) * 16777619UL;
+  }
+  return hash;
+}
+
+static object *symbol_bucket(const char *value, long length) {
+  object *table = g->symbol_table;
+  return VARRAY(table)[symbol_hash(value, length) & (VSIZE(table) - 1)];
+}
+
+object *find_symbol_n(const char *value, long length) {
+  object *element = symbol_bucket(value, length);
   while(!is_the_empty_list(element)) {
-    if(strcmp(car(element)->data.symbol.value, value) == 0) {
+    char *name = SYMBOL(CAR(element));
+    if(strncmp(name, value, length) == 0 && name[length] == '\0') {
       return element;
     }
-    element = cdr(element);
+    element = CDR(element);
   }
 
   return NULL;
 }
 
+object *find_symbol(char *value) {
+  return find_symbol_n(value, strlen(value));
+}
+
+/* double the bucket vector, relinking the existing cells */
+static void grow_symbol_table(void) {
+  object *old = g->symbol_table;
+  long size = VSIZE(old) * 2;
+  object *table = make_vector(g->empty_list, size);
+
+  long ii;
+  for(ii = 0; ii < VSIZE(old); ++ii) {
+    object *element = VARRAY(old)[ii];
+    while(!is_the_empty_list(element)) {
+      object *next = CDR(element);
+      char *name = SYMBOL(CAR(element));
+      long bucket = symbol_hash(name, strlen(name)) & (size - 1);
+      set_cdr(element, VARRAY(table)[bucket]);
+      VARRAY(table)[bucket] = element;
+      element = next;
+    }
+  }
+  g->symbol_table = table;
+}
+
 static long next_uninterned_symbol = 0;
 object *make_uninterned_symbol() {
   object *obj = alloc_object(0);
@@ -396,27 +557,38 @@ char is_lazy_symbol(object * obj) {
   return !TAGGED(obj) && obj->type == LAZY_SYMBOL;
 }
 
-object *make_symbol(char *value) {
+object *make_symbol_n(const char *value, long length) {
   object *obj;
   object *element;
 
-  element = find_symbol(value);
+  element = find_symbol_n(value, length);
   if(element != NULL)
-    return car(element);
+    return CAR(element);
 
-  size_t len = strlen(value) + 1;
   obj = alloc_object(0);
   obj->type = SYMBOL;
-  obj->data.symbol.value = MALLOC(len);
-  strncpy(obj->data.symbol.value, value, len);
+  obj->data.symbol.value = MALLOC(length + 1);
+  memcpy(obj->data.symbol.value, value, length);
+  obj->data.symbol.value[length] = '\0';
 
   push_root(&obj);
-  g->symbol_table = cons(obj, g->symbol_table);
+  if(g->symbol_count >= VSIZE(g->symbol_table) * 2) {
+    grow_symbol_table();
+  }
+  object *table = g->symbol_table;
+  long bucket = symbol_hash(value, length) & (VSIZE(table) - 1);
+  write_barrier(table);
+  VARRAY(table)[bucket] = cons(obj, VARRAY(table)[bucket]);
+  g->symbol_count++;
   pop_root(&obj);
 
   return obj;
 }
 
+object *make_symbol(char *value) {
+  return make_symbol_n(value, strlen(value));
+}
+
 char is_atom(object * obj) {
   return !is_pair(obj) || is_the_empty_list(obj);
 }
@@ -26,7 +26,11 @@ typedef enum {NIL, BOOLEAN, SYMBOL, LAZY_SYMBOL, FIXNUM, FLOATNUM,
 	      COMPOUND_PROC, INPUT_PORT, OUTPUT_PORT,
 	      EOF_OBJECT, THE_EMPTY_LIST, SYNTAX_PROC,
 	      COMPILED_SYNTAX_PROC, VECTOR, COMPILED_PROC,
-	      HASH_TABLE, ALIEN, META_PROC, DIR_STREAM} object_type;
+	      HASH_TABLE, ALIEN, META_PROC, DIR_STREAM,
+	      STRING_BUILDER, BYTEVECTOR, S8VECTOR, U16VECTOR,
+	      S16VECTOR, U32VECTOR, S32VECTOR, U64VECTOR, S64VECTOR,
+	      F32VECTOR, F64VECTOR, MAPPED_BYTEVECTOR,
+	      BYTEVECTOR_SLICE, SOCKET_PORT, EVENT_LOOP} object_type;
 
 typedef struct object {
   char color;
@@ -53,6 +57,7 @@ typedef struct object {
     } character;
     struct {
       char *value;
+      long length;
     } string;
     struct {
       struct object *car;
@@ -101,6 +106,20 @@ typedef struct object {
     struct {
       DIR *stream;
     } dir;
+    struct {
+      struct object *storage;
+      long length;
+    } string_builder;
+    struct {
+      unsigned char *bytes;
+      long length;
+    } bytevector; /* also the homogeneous vectors and mappings */
+    struct {
+      struct socket_port *state;
+    } socket_port;
+    struct {
+      struct event_loop *state;
+    } event_loop;
   } data;
 } object;
 
@@ -122,6 +141,8 @@ char is_lazy_symbol(object *obj);
 
 object *make_symbol(char *value);
 
+object *make_symbol_n(const char *value, long length);
+
 char is_the_empty_list(object *obj);
 
 char is_boolean(object *obj);
@@ -150,6 +171,8 @@ object *make_filled_string(long len, char fill_char);
 
 object *make_string(char *value);
 
+object *make_counted_string(char *value, long length);
+
 char is_string(object *obj);
 
 object *cons(object *car, object *cdr);
@@ -220,11 +243,18 @@ object *make_meta_proc(object *proc, object *meta);
 #define DOUBLE(x) (x->data.floatnum.value)
 #define CHAR(x) (x->data.character.value)
 #define STRING(x) (x->data.string.value)
+#define STRLEN(x) (x->data.string.length)
 #define SYMBOL(x) (x->data.symbol.value)
 #define BOOLEAN(x) (x->data.boolean.value)
 #define INPUT(x) (x->data.input_port.stream)
 #define OUTPUT(x) (x->data.output_port.stream)
 #define DIR_STREAM(x) (x->data.dir.stream)
+#define BUILDER_STORAGE(x) (x->data.string_builder.storage)
+#define BUILDER_LENGTH(x) (x->data.string_builder.length)
+#define BYTES(x) (x->data.bytevector.bytes)
+#define BVLEN(x) (x->data.bytevector.length)
+#define SOCKET_STATE(x) (x->data.socket_port.state)
+#define EVENT_LOOP_STATE(x) (x->data.event_loop.state)
 #define COMPOUND_BODY(x) (x->data.compound_proc.body)
 #define COMPOUND_PARMS_AND_ENV(x) (x->data.compound_proc.parms_and_env)
 #define COMPOUND_PARAMS(x) (CAR(COMPOUND_PARMS_AND_ENV(x)))
@@ -272,6 +302,19 @@ char is_input_port_opened(object * obj);
 void set_output_port_opened(object * obj, char opened);
 void set_input_port_opened(object * obj, char opened);
 char is_dir_stream(object *obj);
+object *make_string_builder(long capacity);
+char is_string_builder(object *obj);
+void string_builder_append(object *builder, char *value, long length);
+object *string_builder_to_string(object *builder);
+object *make_bytevector(long length);
+char is_bytevector(object *obj);
+char is_mapped_bytevector(object *obj);
+char is_socket_port(object *obj);
+
+char is_event_loop(object *obj);
+object *make_hvector(object_type type, long length);
+char is_hvector(object *obj);
+int hvector_element_size(object_type type);
 char is_eof_object(object *obj);
 
 char is_atom(object *obj);
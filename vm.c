@@ -160,6 +160,53 @@ DEFUN1(code_to_symbol_proc) {
     return g->false;
 }
 
+/* opcodes by their number in the table above, so compiled code can be
+   written out and read back by a process where the labels differ */
+
+long bytecode_opcode(void *code) {
+  long ii;
+  for(ii = 0; ii < INVALID_BYTECODE; ++ii) {
+    if(code == ALIEN_PTR(VARRAY(dispatch_table)[ii])) {
+      return ii;
+    }
+  }
+  return -1;
+}
+
+void *opcode_bytecode(long opcode) {
+  if(opcode < 0 || opcode >= INVALID_BYTECODE) {
+    return NULL;
+  }
+  return ALIEN_PTR(VARRAY(dispatch_table)[opcode]);
+}
+
+long bytecode_gvar_opcode(void) {
+  return _gvar_;
+}
+
+long bytecode_fn_opcode(void) {
+  return _fn_;
+}
+
+int opcode_operand(long opcode) {
+  switch (opcode) {
+  case _cconst_:
+    return OPERAND_CONST;
+  case _gvar_:
+  case _gset_:
+    return OPERAND_GLOBAL;
+  case _fn_:
+    return OPERAND_CODE;
+  case _fjump_:
+  case _tjump_:
+  case _jump_:
+  case _save_:
+    return OPERAND_JUMP;
+  default:
+    return OPERAND_OTHER;
+  }
+}
+
 #define VM_ERROR_RESTART(obj)			\
   do {						\
     VPUSH(obj, stack, stack_top);		\
@@ -525,6 +572,7 @@ vm_fn_begin:
 	next = CDR(next);
       }
 
+      write_barrier(CAR(next));
       VARRAY(CAR(next))[idx] = VARRAY(stack)[stack_top - 1];
 
       NEXT_INSTRUCTION;
@@ -541,6 +589,7 @@ vm_fn_begin:
 	if(is_primitive_exception(val)) {
 	  VM_ERROR_RESTART(CDR(val));
 	}
+	write_barrier(const_array);
 	VARRAY(const_array)[ARG1] = val;
       }
 
@@ -553,6 +602,7 @@ vm_fn_begin:
       val = VARRAY(stack)[stack_top - 1];
       slot = get_hashtab(genv, var, NULL);
       if(slot) {
+	write_barrier(slot);
 	CDR(slot) = val;
       }
       else {
@@ -632,6 +682,7 @@ vm_fn_begin:
  __setcar__:
       top = VARRAY(stack)[stack_top - 2];
       VM_ASSERT(is_pair(top), "set-car! expects pair");
+      write_barrier(top);
       CAR(top) = VARRAY(stack)[stack_top - 1];
       VARRAY(stack)[stack_top - 2] = VARRAY(stack)[stack_top - 1];
       stack_top = stack_top - 1;
@@ -641,6 +692,7 @@ vm_fn_begin:
  __setcdr__:
       top = VARRAY(stack)[stack_top - 2];
       VM_ASSERT(is_pair(top), "set-cdr! expects pair");
+      write_barrier(top);
       CDR(top) = VARRAY(stack)[stack_top - 1];
       VARRAY(stack)[stack_top - 2] = VARRAY(stack)[stack_top - 1];
       stack_top = stack_top - 1;
@@ -31,6 +31,19 @@ void vector_push(object *stack, object *obj, long top);
 object *vector_pop(object *stack, long top);
 void vm_definer(char *sym, object *value);
 
+long bytecode_opcode(void *code);
+void *opcode_bytecode(long opcode);
+long bytecode_gvar_opcode(void);
+long bytecode_fn_opcode(void);
+
+/* what the first operand of an instruction refers to */
+#define OPERAND_OTHER 0
+#define OPERAND_CONST 1		/* a constant */
+#define OPERAND_GLOBAL 2	/* a constant naming a global */
+#define OPERAND_CODE 3		/* a constant holding a lambda's code */
+#define OPERAND_JUMP 4		/* an instruction */
+int opcode_operand(long opcode);
+
 #define VPUSH(obj, stack, top)				\
   do {							\
     vector_push(stack, obj, top);			\